@@ -0,0 +1,149 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include <algorithm>
+#include "analyzer.h"
+#include "program.h"
+
+static void addUnique(std::vector<uint16_t> &v, uint16_t num) {
+	if (std::find(v.begin(), v.end(), num) == v.end()) {
+		v.push_back(num);
+	}
+}
+
+ScriptAnalysis::ScriptAnalysis() {
+	clear();
+}
+
+void ScriptAnalysis::clear() {
+	std::vector<uint8_t>().swap(_flags);
+	_entryPoints.clear();
+	_resources.clear();
+	_parts.clear();
+	_sounds.clear();
+	_musics.clear();
+	_shapes.clear();
+	_instructions = 0;
+	_blocks = 0;
+}
+
+/*
+	Each pending offset is decoded linearly until a ret, a kill, an
+	unconditional jump, an invalid opcode or an already visited instruction.
+	The instruction sizes and operands are the ones of Program::decodeInstruction().
+*/
+bool ScriptAnalysis::analyze(const uint8_t *bytecode, uint32_t size, uint16_t partId, uint16_t numMemList) {
+	clear();
+	if (bytecode == 0 || size == 0) {
+		return false;
+	}
+	size = MIN(size, 0xFFFFu);
+	_flags.assign(MAX_SIZE, 0);
+	std::vector<uint16_t> pending;
+	pending.push_back(0);
+	_flags[0] |= BLOCK_START | ENTRY_POINT;
+	_entryPoints.push_back(0);
+	while (!pending.empty()) {
+		uint32_t offset = pending.back();
+		pending.pop_back();
+		while (offset < size && (_flags[offset] & REACHABLE) == 0) {
+			Instruction ins;
+			const uint32_t len = Program::decodeInstruction(bytecode, size, offset, partId, ins);
+			if (len == 0) {
+				break;
+			}
+			_flags[offset] |= REACHABLE;
+			++_instructions;
+			const uint8_t *p = bytecode + offset;
+			bool fallThrough = true;
+			bool branch = false;
+			if (ins.opcode & 0x80) {
+				_shapes.push_back(ins.addr);
+			} else if (ins.opcode & 0x40) {
+				_shapes.push_back(ins.addr | ((ins.c & Program::POLY_VIDEO2) ? SHAPE_VIDEO2 : 0));
+			} else {
+				switch (ins.opcode) {
+				case 0x04: // call
+				case 0x09: // jnz
+				case 0x0A: // condJmp
+					branch = true;
+					break;
+				case 0x05: // ret
+				case 0x11: // kill
+					fallThrough = false;
+					break;
+				case 0x06: // yield, resumed on the next frame
+					_flags[MIN(offset + len, 0xFFFFu)] |= BLOCK_START;
+					break;
+				case 0x07: // jmp
+					branch = true;
+					fallThrough = false;
+					break;
+				case 0x08: // setSetVect
+					if (ins.addr < size && (_flags[ins.addr] & ENTRY_POINT) == 0) {
+						_flags[ins.addr] |= BLOCK_START | ENTRY_POINT;
+						_entryPoints.push_back(ins.addr);
+						pending.push_back(ins.addr);
+					}
+					break;
+				case 0x18: // playSound
+					addUnique(_sounds, READ_BE_UINT16(p + 1));
+					break;
+				case 0x19: { // updateMemList
+						const uint16_t num = READ_BE_UINT16(p + 1);
+						if (num > numMemList) {
+							addUnique(_parts, num);
+						} else if (num != 0) {
+							addUnique(_resources, num);
+						}
+					}
+					break;
+				case 0x1A: { // playMusic
+						const uint16_t num = READ_BE_UINT16(p + 1);
+						if (num != 0) {
+							addUnique(_musics, num);
+						}
+					}
+					break;
+				}
+			}
+			if (branch) {
+				if (ins.addr < size) {
+					_flags[ins.addr] |= BLOCK_START;
+					pending.push_back(ins.addr);
+				}
+				_flags[MIN(offset + len, 0xFFFFu)] |= BLOCK_START;
+			}
+			if (!fallThrough) {
+				break;
+			}
+			offset += len;
+		}
+	}
+	for (uint32_t i = 0; i < size; ++i) {
+		if ((_flags[i] & (REACHABLE | BLOCK_START)) == (REACHABLE | BLOCK_START)) {
+			++_blocks;
+		}
+	}
+	std::sort(_shapes.begin(), _shapes.end());
+	_shapes.erase(std::unique(_shapes.begin(), _shapes.end()), _shapes.end());
+	debug(DBG_RES, "ScriptAnalysis::analyze() part 0x%X, %d instructions in %d blocks, %d entry points, %d resources, %d parts, %d sounds, %d musics, %d shapes",
+		partId, _instructions, _blocks, (int)_entryPoints.size(), (int)_resources.size(), (int)_parts.size(), (int)_sounds.size(), (int)_musics.size(), (int)_shapes.size());
+	return true;
+}
@@ -0,0 +1,67 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __ANALYZER_H__
+#define __ANALYZER_H__
+
+#include <vector>
+#include "intern.h"
+
+/*
+	Walks the bytecode of a part from the entry point of thread 0 and from the
+	op_setSetVect() targets, following the calls and the jumps, and collects
+	what the reachable code may use. The operands are immediate ones, the
+	scripts never compute a resource number or a jump target.
+
+	The resources are listed in the order they are first reached, which is
+	roughly the order the scenes of the part load them.
+*/
+struct ScriptAnalysis {
+	enum {
+		MAX_SIZE = 0x10000,
+		REACHABLE = 1 << 0,   // an instruction starts at this offset
+		BLOCK_START = 1 << 1, // a jump or call target, or the instruction after a branch, a call or a yield
+		ENTRY_POINT = 1 << 2  // offset 0 or an op_setSetVect() target
+	};
+
+	std::vector<uint8_t> _flags; // per bytecode offset, empty when not analyzed
+	std::vector<uint16_t> _entryPoints;
+	std::vector<uint16_t> _resources; // op_updateMemList() memlist entries
+	std::vector<uint16_t> _parts;     // op_updateMemList() game parts
+	std::vector<uint16_t> _sounds;    // op_playSound() memlist entries
+	std::vector<uint16_t> _musics;    // op_playMusic() memlist entries
+	std::vector<uint32_t> _shapes;    // sorted polygon data offsets, SHAPE_VIDEO2 set for the _segVideo2 ones
+	uint32_t _instructions;
+	uint32_t _blocks;
+
+	enum {
+		SHAPE_VIDEO2 = 1 << 16
+	};
+
+	ScriptAnalysis();
+
+	void clear();
+	bool analyze(const uint8_t *bytecode, uint32_t size, uint16_t partId, uint16_t numMemList);
+
+	bool empty() const { return _flags.empty(); }
+	bool isReachable(uint16_t offset) const { return !_flags.empty() && (_flags[offset] & REACHABLE) != 0; }
+	bool isBlockStart(uint16_t offset) const { return !_flags.empty() && (_flags[offset] & BLOCK_START) != 0; }
+};
+
+#endif
@@ -0,0 +1,258 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "zlib.h"
+#include "archive.h"
+#include "file.h"
+
+
+Archive::Archive()
+	: _file(0), _data(0), _size(0), _numEntries(0) {
+}
+
+Archive::~Archive() {
+	close();
+}
+
+bool Archive::open(const char *filename, const char *directory) {
+	close();
+	_file = new File(File::BACKEND_MAPPED);
+	if (!_file->open(filename, directory)) {
+		warning("Archive::open() unable to open '%s'", filename);
+		close();
+		return false;
+	}
+	const uint8_t *data = _file->getData();
+	const uint32_t size = _file->getSize();
+	if (size < HEADER_SIZE || READ_BE_UINT32(data) != MAGIC || READ_BE_UINT32(data + 4) != VERSION) {
+		warning("Archive::open() '%s' is not a version %d archive", filename, VERSION);
+		close();
+		return false;
+	}
+	const uint32_t numEntries = READ_BE_UINT32(data + 8);
+	if (numEntries == 0 || numEntries > (size - HEADER_SIZE) / ENTRY_SIZE || READ_BE_UINT32(data + 12) != checksum(data, data + HEADER_SIZE, numEntries * ENTRY_SIZE)) {
+		warning("Archive::open() '%s' has a corrupted header", filename);
+		close();
+		return false;
+	}
+	for (uint32_t i = 0; i < numEntries; ++i) {
+		const uint8_t *p = data + HEADER_SIZE + i * ENTRY_SIZE;
+		const uint32_t offset = READ_BE_UINT32(p + 0x14);
+		const uint32_t storedSize = READ_BE_UINT32(p + 0x18);
+		if (offset > size || storedSize > size - offset) {
+			warning("Archive::open() '%s' entry %d is out of bounds", filename, i);
+			close();
+			return false;
+		}
+	}
+	_data = data;
+	_size = size;
+	_numEntries = numEntries;
+	debug(DBG_RES, "Archive::open() '%s', %d entries, %d bytes", filename, numEntries, size);
+	return true;
+}
+
+void Archive::close() {
+	delete _file;
+	_file = 0;
+	_data = 0;
+	_size = 0;
+	_numEntries = 0;
+}
+
+const uint8_t *Archive::getRecord(uint32_t num) const {
+	assert(num < _numEntries);
+	return _data + HEADER_SIZE + num * ENTRY_SIZE;
+}
+
+bool Archive::read(uint32_t num, uint8_t *dst, uint32_t size) const {
+	const uint8_t *p = getRecord(num);
+	const uint8_t *src = _data + READ_BE_UINT32(p + 0x14);
+	const uint32_t storedSize = READ_BE_UINT32(p + 0x18);
+	switch (p[0x1C]) {
+	case CODEC_RAW:
+		if (storedSize != size) {
+			return false;
+		}
+		memcpy(dst, src, size);
+		return true;
+	case CODEC_LZ:
+		return decompress(src, storedSize, dst, size);
+	}
+	return false;
+}
+
+uint32_t Archive::checksum(const uint8_t *header, const uint8_t *index, uint32_t indexSize) {
+	uint8_t buf[HEADER_SIZE];
+	memcpy(buf, header, HEADER_SIZE);
+	memset(buf + 12, 0, 4);
+	uLong crc = crc32(0, buf, HEADER_SIZE);
+	crc = crc32(crc, index, indexSize);
+	return (uint32_t)crc;
+}
+
+/*
+	The payloads are a list of sequences, made of literal bytes followed by a
+	copy of the previous output:
+
+	  token, literals count in the high nibble, match length - MIN_MATCH in
+	         the low nibble, 15 is extended by the next bytes until one is not
+	         255, for the literals after the token and for the match after the
+	         literals
+	  literal bytes
+	  match offset, 2 bytes
+
+	The last sequence has no match, it ends at the end of the payload. The
+	encoder is a greedy one with a single entry hash table, the output only
+	needs to decode fast.
+*/
+enum {
+	LZ_MIN_MATCH = 4,
+	LZ_HASH_BITS = 12,
+	LZ_MAX_OFFSET = 0xFFFF
+};
+
+static bool writeLength(uint8_t *&p, const uint8_t *end, uint32_t len) {
+	for (; len >= 255; len -= 255) {
+		if (p == end) {
+			return false;
+		}
+		*p++ = 255;
+	}
+	if (p == end) {
+		return false;
+	}
+	*p++ = len;
+	return true;
+}
+
+static bool writeSequence(uint8_t *&p, const uint8_t *end, const uint8_t *literals, uint32_t count, uint32_t offset, uint32_t len) {
+	if (p == end) {
+		return false;
+	}
+	const uint32_t matchLen = (len != 0) ? len - LZ_MIN_MATCH : 0;
+	*p++ = (MIN(count, 15u) << 4) | MIN(matchLen, 15u);
+	if (count >= 15 && !writeLength(p, end, count - 15)) {
+		return false;
+	}
+	if ((uint32_t)(end - p) < count) {
+		return false;
+	}
+	memcpy(p, literals, count);
+	p += count;
+	if (len == 0) {
+		return true;
+	}
+	if (end - p < 2) {
+		return false;
+	}
+	*p++ = offset >> 8;
+	*p++ = offset & 255;
+	return matchLen < 15 || writeLength(p, end, matchLen - 15);
+}
+
+uint32_t Archive::compress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t dstSize) {
+	int32_t table[1 << LZ_HASH_BITS];
+	for (int i = 0; i < (1 << LZ_HASH_BITS); ++i) {
+		table[i] = -1;
+	}
+	uint8_t *p = dst;
+	const uint8_t *end = dst + dstSize;
+	uint32_t anchor = 0;
+	uint32_t pos = 0;
+	while (pos + LZ_MIN_MATCH <= size) {
+		const uint32_t h = (READ_BE_UINT32(src + pos) * 2654435761u) >> (32 - LZ_HASH_BITS);
+		const int32_t ref = table[h];
+		table[h] = pos;
+		if (ref < 0 || pos - ref > LZ_MAX_OFFSET || memcmp(src + ref, src + pos, LZ_MIN_MATCH) != 0) {
+			++pos;
+			continue;
+		}
+		uint32_t len = LZ_MIN_MATCH;
+		while (pos + len < size && src[ref + len] == src[pos + len]) {
+			++len;
+		}
+		if (!writeSequence(p, end, src + anchor, pos - anchor, pos - ref, len)) {
+			return 0;
+		}
+		pos += len;
+		anchor = pos;
+	}
+	if (!writeSequence(p, end, src + anchor, size - anchor, 0, 0)) {
+		return 0;
+	}
+	return p - dst;
+}
+
+static bool readLength(const uint8_t *&p, const uint8_t *end, uint32_t *len) {
+	uint8_t b;
+	do {
+		if (p == end) {
+			return false;
+		}
+		b = *p++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+bool Archive::decompress(const uint8_t *src, uint32_t srcSize, uint8_t *dst, uint32_t dstSize) {
+	const uint8_t *p = src;
+	const uint8_t *end = src + srcSize;
+	uint8_t *q = dst;
+	uint8_t *const qEnd = dst + dstSize;
+	while (p < end) {
+		const uint8_t token = *p++;
+		uint32_t count = token >> 4;
+		if (count == 15 && !readLength(p, end, &count)) {
+			return false;
+		}
+		if ((uint32_t)(end - p) < count || (uint32_t)(qEnd - q) < count) {
+			return false;
+		}
+		memcpy(q, p, count);
+		p += count;
+		q += count;
+		if (p == end) {
+			break;
+		}
+		if (end - p < 2) {
+			return false;
+		}
+		const uint32_t offset = READ_BE_UINT16(p); p += 2;
+		uint32_t len = token & 15;
+		if (len == 15 && !readLength(p, end, &len)) {
+			return false;
+		}
+		len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (uint32_t)(q - dst) || (uint32_t)(qEnd - q) < len) {
+			return false;
+		}
+		const uint8_t *m = q - offset;
+		if (offset >= len) {
+			memcpy(q, m, len);
+			q += len;
+		} else {
+			while (len--) {
+				*q++ = *m++;
+			}
+		}
+	}
+	return q == qEnd;
+}
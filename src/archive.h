@@ -0,0 +1,83 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include "intern.h"
+
+struct File;
+
+/*
+	Archive of the pre-unpacked resources, written by another-world-pack.bin
+	from memlist.bin and the bank files. It is mapped in memory, the entries
+	are then copied or decoded straight from the mapped file.
+
+	All the fields are big endian:
+
+	  header, HEADER_SIZE bytes
+	    0x00  magic 'AWPK'
+	    0x04  version
+	    0x08  number of entries, the memlist terminator included
+	    0x0C  checksum, crc32 of the header with this field zeroed and the index
+
+	  index, ENTRY_SIZE bytes per entry
+	    0x00  memlist.bin record, MEMLIST_ENTRY_SIZE bytes
+	    0x14  payload offset, aligned on ALIGN bytes
+	    0x18  payload size
+	    0x1C  payload codec, 3 padding bytes
+
+	  payloads
+*/
+struct Archive {
+	enum {
+		MAGIC = 0x4157504B, // 'AWPK'
+		VERSION = 1,
+		HEADER_SIZE = 16,
+		ENTRY_SIZE = 32,
+		MEMLIST_ENTRY_SIZE = 20,
+		ALIGN = 16
+	};
+
+	enum Codec {
+		CODEC_RAW, // stored unpacked
+		CODEC_LZ   // lz77 sequences, see compress()
+	};
+
+	File *_file;
+	const uint8_t *_data;
+	uint32_t _size;
+	uint32_t _numEntries;
+
+	Archive();
+	~Archive();
+
+	bool open(const char *filename, const char *directory);
+	void close();
+	bool isOpen() const { return _data != 0; }
+
+	const uint8_t *getRecord(uint32_t num) const;
+	bool read(uint32_t num, uint8_t *dst, uint32_t size) const;
+
+	static uint32_t checksum(const uint8_t *header, const uint8_t *index, uint32_t indexSize);
+	static uint32_t compress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t dstSize);
+	static bool decompress(const uint8_t *src, uint32_t srcSize, uint8_t *dst, uint32_t dstSize);
+};
+
+#endif
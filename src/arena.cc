@@ -0,0 +1,63 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "arena.h"
+
+
+MemArena::MemArena()
+	: _base(0), _size(0), _partEnd(0), _cur(0), _vidPtr(0), _generation(0), _partHighWater(0), _highWater(0) {
+}
+
+bool MemArena::init(uint32_t size) {
+	if (size <= VIDEO_SIZE) {
+		return false;
+	}
+	_base = (uint8_t *)malloc(size);
+	if (!_base) {
+		return false;
+	}
+	_size = size;
+	_vidPtr = _base + size - VIDEO_SIZE;
+	_partHighWater = _highWater = 0;
+	resetAll();
+	return true;
+}
+
+void MemArena::free() {
+	::free(_base);
+	_base = _partEnd = _cur = _vidPtr = 0;
+	_size = 0;
+}
+
+uint8_t *MemArena::alloc(uint32_t size) {
+	if (size > (uint32_t)(_vidPtr - _cur)) {
+		return 0;
+	}
+	uint8_t *p = _cur;
+	_cur += size;
+	++_generation;
+	_highWater = MAX(_highWater, getUsed());
+	return p;
+}
+
+// the data allocated so far belongs to the part, the next one to the scene
+void MemArena::commitPart() {
+	_partEnd = _cur;
+	_partHighWater = MAX(_partHighWater, getPartSize());
+}
@@ -0,0 +1,69 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "intern.h"
+
+/*
+	The memory of the game resources, a single block split in three regions,
+	each of them bump allocated:
+
+	  [_base, _partEnd)   persistent data of the current part (palette,
+	                      bytecode and polygons), loaded by setupPart()
+	  [_partEnd, _cur)    transient data of the current scene (sounds and
+	                      music), loaded by op_updateMemList()
+	  [_vidPtr, end)      full screen bitmap, unpacked then copied to a page
+
+	The resets only move _cur and _partEnd back, they are O(1). The pointers
+	are saved relative to _base by the Serializer, as they always were.
+*/
+struct MemArena {
+	enum {
+		VIDEO_SIZE = 0x800 * 16
+	};
+
+	uint8_t *_base;
+	uint32_t _size;
+	uint8_t *_partEnd, *_cur, *_vidPtr;
+
+	// incremented by each alloc(), the content is unchanged while it is the same
+	uint32_t _generation;
+
+	// high water marks, in bytes from _base
+	uint32_t _partHighWater;
+	uint32_t _highWater;
+
+	MemArena();
+
+	bool init(uint32_t size);
+	void free();
+
+	uint8_t *alloc(uint32_t size); // 0 when the block is full
+	void commitPart();
+	void resetScene() { _cur = _partEnd; }
+	void resetAll() { _cur = _partEnd = _base; }
+
+	uint32_t getCapacity() const { return _vidPtr - _base; }
+	uint32_t getUsed() const { return _cur - _base; }
+	uint32_t getPartSize() const { return _partEnd - _base; }
+};
+
+#endif
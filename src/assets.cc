@@ -0,0 +1,69 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "assets.h"
+
+
+AssetStore::AssetStore()
+	: _numMemList(0) {
+	memset(_offsets, 0xFF, sizeof(_offsets));
+}
+
+/*
+	The entries are read with a Resource of their own, without any cache nor
+	prefetch, into a single buffer.
+*/
+bool AssetStore::load(const char *dataDir, const char *archiveName) {
+	Resource res(0, dataDir);
+#ifdef ENABLE_PROFILER
+	Profiler profiler;
+	res._profiler = &profiler;
+#endif
+	if (archiveName != 0 && !res._archive.open(archiveName, dataDir)) {
+		warning("AssetStore::load() unable to load archive '%s'", archiveName);
+		return false;
+	}
+	res.readEntries();
+	_numMemList = res._numMemList;
+	memcpy(_memList, res._memList, sizeof(_memList));
+	uint32_t size = 0;
+	for (uint16_t i = 0; i < _numMemList; ++i) {
+		const MemEntry *me = &_memList[i];
+		if (me->bankId != 0 && me->size != 0) {
+			_offsets[i] = size;
+			size += me->size;
+		}
+	}
+	_data.resize(size);
+	for (uint16_t i = 0; i < _numMemList; ++i) {
+		if (_offsets[i] != NO_OFFSET) {
+			res.readBank(&res._memList[i], &_data[_offsets[i]]);
+		}
+	}
+	debug(DBG_RES, "AssetStore::load() %d entries, %d bytes", _numMemList, size);
+	return true;
+}
+
+bool AssetStore::read(uint16_t num, uint8_t *dst, uint32_t size) const {
+	if (num >= _numMemList || _offsets[num] == NO_OFFSET || _memList[num].size != size) {
+		return false;
+	}
+	memcpy(dst, &_data[_offsets[num]], size);
+	return true;
+}
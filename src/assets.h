@@ -0,0 +1,49 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __ASSETS_H__
+#define __ASSETS_H__
+
+#include <vector>
+#include "intern.h"
+#include "resource.h"
+
+/*
+	The memlist and the unpacked data of all its entries, read once from the
+	banks (or an archive) and shared by the engines running in the same
+	process, see BatchRunner. Nothing is modified after load(), the engines
+	copy from it without any lock.
+*/
+struct AssetStore {
+	enum {
+		NO_OFFSET = 0xFFFFFFFF
+	};
+
+	MemEntry _memList[Resource::MAX_MEM_ENTRIES];
+	uint16_t _numMemList;
+	uint32_t _offsets[Resource::MAX_MEM_ENTRIES]; // in _data, NO_OFFSET when not stored
+	std::vector<uint8_t> _data;
+
+	AssetStore();
+
+	bool load(const char *dataDir, const char *archiveName);
+	bool read(uint16_t num, uint8_t *dst, uint32_t size) const;
+};
+
+#endif
@@ -21,12 +21,49 @@
 #include "resource.h"
 
 
-Bank::Bank(const char *dataDir)
+BankFiles::BankFiles(const char *dataDir)
 	: _dataDir(dataDir) {
+	memset(_files, 0, sizeof(_files));
+}
+
+BankFiles::~BankFiles() {
+	for (int i = 0; i < MAX_BANKS; ++i) {
+		delete _files[i];
+	}
+}
+
+const uint8_t *BankFiles::getData(uint8_t bankId, uint32_t *size) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_files[bankId]) {
+		char bankName[10];
+		sprintf(bankName, "bank%02x", bankId);
+		_files[bankId] = new File(File::BACKEND_MAPPED);
+		if (!_files[bankId]->open(bankName, _dataDir)) {
+			warning("BankFiles::getData() unable to map '%s'", bankName);
+		}
+	}
+	*size = _files[bankId]->getSize();
+	return _files[bankId]->getData();
+}
+
+Bank::Bank(const char *dataDir, BankFiles *files)
+	: _dataDir(dataDir), _files(files), _fastUnpack(true) {
 }
 
 bool Bank::read(const MemEntry *me, uint8_t *buf) {
 
+	if (_files) {
+		uint32_t size = 0;
+		const uint8_t *data = _files->getData(me->bankId, &size);
+		if (data && me->bankOffset + me->packedSize <= size) {
+			if (me->packedSize == me->size) {
+				memcpy(buf, data + me->bankOffset, me->packedSize);
+				return true;
+			}
+			return unpack(data + me->bankOffset, me->packedSize, buf);
+		}
+	}
+
 	bool ret = false;
 	char bankName[10];
 	sprintf(bankName, "bank%02x", me->bankId);
@@ -46,19 +83,28 @@ bool Bank::read(const MemEntry *me, uint8_t *buf) {
 	} else {
 		f.read(buf, me->packedSize);
 		_startBuf = buf;
+		_iStartBuf = buf;
 		_iBuf = buf + me->packedSize - 4;
-		ret = unpack();
+		ret = _fastUnpack ? unpackFast() : unpack();
 	}
 	
 	return ret;
 }
 
+// The packed data is read from src instead of being copied in dst first
+bool Bank::unpack(const uint8_t *src, uint32_t packedSize, uint8_t *dst) {
+	_startBuf = dst;
+	_iStartBuf = src;
+	_iBuf = src + packedSize - 4;
+	return _fastUnpack ? unpackFast() : unpack();
+}
+
 void Bank::decUnk1(uint8_t numChunks, uint8_t addCount) {
 	uint16_t count = getCode(numChunks) + addCount + 1;
 	debug(DBG_BANK, "Bank::decUnk1(%d, %d) count=%d", numChunks, addCount, count);
 	_unpCtx.datasize -= count;
 	while (count--) {
-		assert(_oBuf >= _iBuf && _oBuf >= _startBuf);
+		assert((_iStartBuf != _startBuf || _oBuf >= _iBuf) && _oBuf >= _startBuf);
 		*_oBuf = (uint8_t)getCode(8);
 		--_oBuf;
 	}
@@ -73,7 +119,7 @@ void Bank::decUnk2(uint8_t numChunks) {
 	debug(DBG_BANK, "Bank::decUnk2(%d) i=%d count=%d", numChunks, i, count);
 	_unpCtx.datasize -= count;
 	while (count--) {
-		assert(_oBuf >= _iBuf && _oBuf >= _startBuf);
+		assert((_iStartBuf != _startBuf || _oBuf >= _iBuf) && _oBuf >= _startBuf);
 		*_oBuf = *(_oBuf + i);
 		--_oBuf;
 	}
@@ -129,7 +175,7 @@ uint16_t Bank::getCode(uint8_t numChunks) {
 bool Bank::nextChunk() {
 	bool CF = rcr(false);
 	if (_unpCtx.chk == 0) {
-		assert(_iBuf >= _startBuf);
+		assert(_iBuf >= _iStartBuf);
 		_unpCtx.chk = READ_BE_UINT32(_iBuf); _iBuf -= 4;
 		_unpCtx.crc ^= _unpCtx.chk;
 		CF = rcr(true);
@@ -143,3 +189,203 @@ bool Bank::rcr(bool CF) {
 	if (CF) _unpCtx.chk |= 0x80000000;
 	return rCF;
 }
+
+/*
+	The packed stream is read backwards by 32 bits words, each word being
+	consumed from its lowest bit. The highest set bit of the first word ends
+	its data bits, the other words hold 32 data bits. Each code is read MSB
+	first, as getCode() does.
+
+	unpackFast() decodes the same stream as unpack(), with the bits kept in a
+	64 bits buffer refilled by whole words, the token prefixes decoded with a
+	32 entries table indexed by the next 5 bits, and the matches copied in
+	bulk when they do not overlap. The output bounds are checked once per
+	token instead of once per byte.
+*/
+namespace {
+
+enum {
+	TOKEN_LITERALS,  // count literal bytes
+	TOKEN_LITERALS8, // 8 bits count + 9 literal bytes
+	TOKEN_MATCH,     // count bytes at an offsetBits bits offset
+	TOKEN_MATCH8     // 8 bits count + 1 bytes at an offsetBits bits offset
+};
+
+struct UnpackToken {
+	uint8_t len; // prefix length in bits
+	uint8_t op;
+	uint8_t count;
+	uint8_t offsetBits;
+};
+
+struct UnpackTables {
+	uint8_t reverse[256];
+	UnpackToken tokens[32];
+
+	UnpackTables() {
+		for (int i = 0; i < 256; ++i) {
+			uint8_t r = 0;
+			for (int b = 0; b < 8; ++b) {
+				if (i & (1 << b)) {
+					r |= 0x80 >> b;
+				}
+			}
+			reverse[i] = r;
+		}
+		for (int i = 0; i < 32; ++i) {
+			UnpackToken &t = tokens[i];
+			if ((i & 1) == 0) {
+				if ((i & 2) == 0) {
+					t.len = 5;
+					t.op = TOKEN_LITERALS;
+					t.count = (reverse[(i >> 2) & 7] >> 5) + 1;
+					t.offsetBits = 0;
+				} else {
+					t.len = 2;
+					t.op = TOKEN_MATCH;
+					t.count = 2;
+					t.offsetBits = 8;
+				}
+			} else {
+				const int c = reverse[(i >> 1) & 3] >> 6;
+				t.len = 3;
+				switch (c) {
+				case 0:
+				case 1:
+					t.op = TOKEN_MATCH;
+					t.count = c + 3;
+					t.offsetBits = c + 9;
+					break;
+				case 2:
+					t.op = TOKEN_MATCH8;
+					t.count = 0;
+					t.offsetBits = 12;
+					break;
+				default:
+					t.op = TOKEN_LITERALS8;
+					t.count = 0;
+					t.offsetBits = 0;
+					break;
+				}
+			}
+		}
+	}
+};
+
+struct BitReader {
+	const uint8_t *iBuf, *iStartBuf;
+	const uint8_t *reverse;
+	uint64_t bits;
+	int count;
+	uint32_t crc;
+
+	void refill() {
+		while (count <= 32 && iBuf >= iStartBuf) {
+			const uint32_t w = READ_BE_UINT32(iBuf); iBuf -= 4;
+			crc ^= w;
+			bits |= (uint64_t)w << count;
+			count += 32;
+		}
+	}
+
+	// numBits up to 16, returns false if the stream is truncated
+	bool getCode(int numBits, uint16_t *code) {
+		if (count < numBits) {
+			refill();
+			if (count < numBits) {
+				return false;
+			}
+		}
+		const uint32_t v = (uint32_t)bits & ((1 << numBits) - 1);
+		bits >>= numBits;
+		count -= numBits;
+		*code = ((reverse[v & 0xFF] << 8) | reverse[v >> 8]) >> (16 - numBits);
+		return true;
+	}
+};
+
+}
+
+bool Bank::unpackFast() {
+	static const UnpackTables tables;
+
+	int32_t datasize = READ_BE_UINT32(_iBuf); _iBuf -= 4;
+	uint8_t *const end = _startBuf + datasize;
+	uint8_t *oBuf = end - 1;
+	BitReader br;
+	br.crc = READ_BE_UINT32(_iBuf); _iBuf -= 4;
+	const uint32_t chk = READ_BE_UINT32(_iBuf); _iBuf -= 4;
+	br.crc ^= chk;
+	br.iBuf = _iBuf;
+	br.iStartBuf = _iStartBuf;
+	br.reverse = tables.reverse;
+	br.bits = 0;
+	br.count = 0;
+	if (chk != 0) {
+		br.count = 31 - __builtin_clz(chk);
+		br.bits = chk & ((1u << br.count) - 1);
+	}
+	const bool inPlace = (_iStartBuf == _startBuf);
+
+	while (datasize > 0) {
+		if (br.count < 5) {
+			br.refill();
+		}
+		const UnpackToken &t = tables.tokens[br.bits & 31];
+		if (t.len > br.count) {
+			return false;
+		}
+		br.bits >>= t.len;
+		br.count -= t.len;
+		uint16_t count = t.count;
+		uint16_t offset = 0;
+		switch (t.op) {
+		case TOKEN_LITERALS8:
+		case TOKEN_MATCH8:
+			if (!br.getCode(8, &count)) {
+				return false;
+			}
+			count += (t.op == TOKEN_LITERALS8) ? 9 : 1;
+			break;
+		}
+		if (t.offsetBits != 0 && !br.getCode(t.offsetBits, &offset)) {
+			return false;
+		}
+		if (count > datasize) {
+			return false;
+		}
+		datasize -= count;
+		uint8_t *dst = oBuf - count + 1;
+		if (t.offsetBits == 0) {
+			for (; oBuf >= dst; --oBuf) {
+				uint16_t c;
+				if (!br.getCode(8, &c)) {
+					return false;
+				}
+				*oBuf = (uint8_t)c;
+			}
+		} else {
+			if (oBuf + offset >= end) {
+				return false;
+			}
+			if (offset >= count) {
+				memcpy(dst, dst + offset, count);
+			} else {
+				for (; count != 0; --count, --oBuf) {
+					*oBuf = *(oBuf + offset);
+				}
+			}
+			oBuf = dst - 1;
+		}
+		// unpacking in place, the output must not run into the packed input
+		if (inPlace && dst < br.iBuf) {
+			return false;
+		}
+	}
+	_iBuf = br.iBuf;
+	// the whole words read ahead were not read by unpack(), and not xored
+	for (int i = 1; i <= br.count / 32; ++i) {
+		br.crc ^= READ_BE_UINT32(br.iBuf + i * 4);
+	}
+	return (br.crc == 0);
+}
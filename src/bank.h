@@ -19,10 +19,32 @@
 #ifndef __BANK_H__
 #define __BANK_H__
 
+#include <mutex>
 #include "intern.h"
 
+struct File;
 struct MemEntry;
 
+/*
+	The bank files, mapped in memory on first use and kept until the end, so
+	reading an entry does not open nor seek any file. Shared by the main thread
+	and the Prefetcher worker.
+*/
+struct BankFiles {
+	enum {
+		MAX_BANKS = 256
+	};
+
+	const char *_dataDir;
+	std::mutex _mutex;
+	File *_files[MAX_BANKS];
+
+	BankFiles(const char *dataDir);
+	~BankFiles();
+
+	const uint8_t *getData(uint8_t bankId, uint32_t *size);
+};
+
 struct UnpackContext {
 	uint16_t size;
 	uint32_t crc;
@@ -33,14 +55,19 @@ struct UnpackContext {
 struct Bank {
 	UnpackContext _unpCtx;
 	const char *_dataDir;
-	uint8_t *_iBuf, *_oBuf, *_startBuf;
+	BankFiles *_files;
+	bool _fastUnpack; // unpackFast() instead of the bit by bit unpack()
+	const uint8_t *_iBuf, *_iStartBuf;
+	uint8_t *_oBuf, *_startBuf;
 
-	Bank(const char *dataDir);
+	Bank(const char *dataDir, BankFiles *files = 0);
 
 	bool read(const MemEntry *me, uint8_t *buf);
+	bool unpack(const uint8_t *src, uint32_t packedSize, uint8_t *dst);
 	void decUnk1(uint8_t numChunks, uint8_t addCount);
 	void decUnk2(uint8_t numChunks);
 	bool unpack();
+	bool unpackFast();
 	uint16_t getCode(uint8_t numChunks);
 	bool nextChunk();
 	bool rcr(bool CF);
@@ -0,0 +1,103 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include "batch.h"
+#include "replay.h"
+#include "sys.h"
+#include "util.h"
+
+extern System *System_Headless_create(bool turbo);
+
+static uint32_t getMilliseconds() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+BatchRunner::BatchRunner(const char *dataDir, const char *saveDir, const EngineOptions &options)
+	: _dataDir(dataDir), _saveDir(saveDir), _options(options), _nextJob(0) {
+	_options.assets = &_assets;
+}
+
+void BatchRunner::addJob(const char *replayName) {
+	Job job;
+	job.replayName = replayName;
+	job.done = false;
+	job.frames = 0;
+	job.duration = 0;
+	_jobs.push_back(job);
+}
+
+bool BatchRunner::run(uint32_t numThreads) {
+	if (!_assets.load(_dataDir, _options.archive)) {
+		return false;
+	}
+	numThreads = MIN(numThreads, (uint32_t)_jobs.size());
+	const uint32_t start = getMilliseconds();
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < numThreads; ++i) {
+		threads.push_back(std::thread(&BatchRunner::worker, this));
+	}
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i].join();
+	}
+	uint32_t done = 0;
+	uint64_t frames = 0;
+	for (size_t i = 0; i < _jobs.size(); ++i) {
+		if (_jobs[i].done) {
+			++done;
+			frames += _jobs[i].frames;
+		}
+	}
+	const uint32_t duration = getMilliseconds() - start;
+	printf("Batch: %d of %d replays played on %d threads, %llu frames in %d ms\n", done, (int)_jobs.size(), numThreads, (unsigned long long)frames, duration);
+	return done == _jobs.size();
+}
+
+void BatchRunner::runJob(Job &job) {
+	const uint32_t start = getMilliseconds();
+	const std::unique_ptr<System> headless(System_Headless_create(true));
+	ReplayPlayer replay(headless.get());
+	if (!replay.open(job.replayName, _saveDir)) {
+		return;
+	}
+	EngineOptions options = _options;
+	options.randomSeed = replay._randomSeed;
+	{
+		const std::unique_ptr<Engine> engine(new Engine(&replay, _dataDir, _saveDir, options));
+		engine->run();
+	}
+	job.frames = replay._framesCount;
+	job.duration = getMilliseconds() - start;
+	job.done = true;
+	const std::lock_guard<std::mutex> lock(_outputMutex);
+	printf("Replay '%s': %d frames in %d ms\n", job.replayName, job.frames, job.duration);
+}
+
+// The jobs are taken in order by the first free thread
+void BatchRunner::worker() {
+	while (1) {
+		const uint32_t num = _nextJob.fetch_add(1);
+		if (num >= _jobs.size()) {
+			break;
+		}
+		runJob(_jobs[num]);
+	}
+}
@@ -0,0 +1,58 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "intern.h"
+#include "assets.h"
+#include "engine.h"
+
+/*
+	Plays a list of replay files, each one on its own engine with a headless
+	system on the virtual clock, on a pool of worker threads. The resources
+	are read and unpacked once, in an AssetStore shared by all the engines.
+*/
+struct BatchRunner {
+	struct Job {
+		const char *replayName;
+		bool done;
+		uint32_t frames;
+		uint32_t duration; // ms
+	};
+
+	const char *_dataDir, *_saveDir;
+	EngineOptions _options;
+	AssetStore _assets;
+	std::vector<Job> _jobs;
+	std::atomic<uint32_t> _nextJob;
+	std::mutex _outputMutex;
+
+	BatchRunner(const char *dataDir, const char *saveDir, const EngineOptions &options);
+
+	void addJob(const char *replayName);
+	bool run(uint32_t numThreads); // false when a replay could not be played
+	void runJob(Job &job);
+	void worker();
+};
+
+#endif
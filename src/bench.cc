@@ -0,0 +1,515 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/*
+	Benchmark of the hot kernels (rasterizer, banded and high resolution
+	rasterizers, text, planar conversion, frame hash, mixer and unpacker),
+	run in isolation on the game data files.
+
+	Each benchmark is repeated until it ran for at least --time milliseconds,
+	the results are reported in nanoseconds per operation and megabytes per
+	second of output data.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "bank.h"
+#include "file.h"
+#include "framehash.h"
+#include "mixer.h"
+#include "parts.h"
+#include "profiler.h"
+#include "resource.h"
+#include "sys.h"
+#include "util.h"
+#include "video.h"
+
+extern System *System_Headless_create(bool turbo);
+
+static const char *USAGE =
+	"Raw - Another World Interpreter - Benchmarks\n"
+	"Usage: another-world-bench [OPTIONS]...\n"
+	"  --datapath=PATH   Path to where the game is installed (default './assets')\n"
+	"  --time=MS         Minimum duration of each benchmark (default 500)\n";
+
+static bool parseOption(const char *arg, const char *longCmd, const char **opt) {
+	bool ret = false;
+	if (arg[0] == '-' && arg[1] == '-') {
+		if (strncmp(arg + 2, longCmd, strlen(longCmd)) == 0) {
+			*opt = arg + 2 + strlen(longCmd);
+			ret = true;
+		}
+	}
+	return ret;
+}
+
+static uint64_t getNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t _minDuration = 500;
+
+#ifdef ENABLE_PROFILER
+// the kernels expect a profiler to be attached in the profiler builds
+static Profiler _profiler;
+#endif
+
+/*
+	Run f() until the minimum duration is reached, doubling the number of
+	iterations at each round. bytesPerOp is the amount of output data written
+	by one call, 0 if not meaningful.
+*/
+template <typename F>
+static void bench(const char *name, uint64_t bytesPerOp, F f) {
+	f(); // warm up
+	uint64_t iterations = 1;
+	uint64_t elapsed = 0;
+	while (1) {
+		const uint64_t start = getNanoseconds();
+		for (uint64_t i = 0; i < iterations; ++i) {
+			f();
+		}
+		elapsed = getNanoseconds() - start;
+		if (elapsed >= _minDuration * 1000000ULL || iterations >= (1ULL << 40)) {
+			break;
+		}
+		iterations *= 2;
+	}
+	const double nsPerOp = (double)elapsed / iterations;
+	if (bytesPerOp != 0) {
+		const double mbPerSec = (bytesPerOp * iterations / (1024. * 1024.)) / (elapsed / 1000000000.);
+		printf("%-48s %12llu %14.1f %10.1f\n", name, (unsigned long long)iterations, nsPerOp, mbPerSec);
+	} else {
+		printf("%-48s %12llu %14.1f %10s\n", name, (unsigned long long)iterations, nsPerOp, "-");
+	}
+	fflush(stdout);
+}
+
+struct DrawCall {
+	uint8_t *seg;
+	uint16_t off;
+	uint16_t zoom;
+	Point pt;
+};
+
+/*
+	Walk the bytecode of a part linearly and collect every polygon opcode,
+	variable operands are replaced by the center of the screen.
+*/
+static void collectDrawCalls(const Resource &res, uint16_t size, std::vector<DrawCall> &calls) {
+	static const uint8_t opcodeSizes[] = {
+		4, 3, 3, 4, 3, 1, 1, 3, 4, 4, 0, 3, 4, 2, 3, 3, 2, 1, 6, 3, 4, 4, 4, 4, 6, 3, 6
+	};
+	const uint8_t *code = res.segBytecode;
+	uint32_t pc = 0;
+	while (pc < size) {
+		const uint8_t opcode = code[pc];
+		DrawCall dc;
+		if (opcode & 0x80) {
+			if (pc + 4 > size) {
+				break;
+			}
+			dc.seg = res.segCinematic;
+			dc.off = (((opcode << 8) | code[pc + 1]) * 2) & 0xFFFF;
+			dc.zoom = 0x40;
+			dc.pt.x = code[pc + 2];
+			dc.pt.y = code[pc + 3];
+			if (dc.pt.y > 199) {
+				dc.pt.x += dc.pt.y - 199;
+				dc.pt.y = 199;
+			}
+			calls.push_back(dc);
+			pc += 4;
+		} else if (opcode & 0x40) {
+			uint32_t p = pc + 1;
+			dc.seg = res.segCinematic;
+			dc.off = READ_BE_UINT16(code + p) * 2; p += 2;
+			if (!(opcode & 0x20)) {
+				if (!(opcode & 0x10)) {
+					dc.pt.x = (int16_t)READ_BE_UINT16(code + p); p += 2;
+				} else {
+					dc.pt.x = 160; p += 1;
+				}
+			} else {
+				dc.pt.x = code[p] + ((opcode & 0x10) ? 0x100 : 0); p += 1;
+			}
+			if (!(opcode & 8)) {
+				if (!(opcode & 4)) {
+					dc.pt.y = (int16_t)READ_BE_UINT16(code + p); p += 2;
+				} else {
+					dc.pt.y = 100; p += 1;
+				}
+			} else {
+				dc.pt.y = code[p]; p += 1;
+			}
+			dc.zoom = 0x40;
+			if (!(opcode & 2)) {
+				if (opcode & 1) {
+					p += 1;
+				}
+			} else if (opcode & 1) {
+				dc.seg = res._segVideo2;
+			} else {
+				dc.zoom = code[p]; p += 1;
+			}
+			if (p > size) {
+				break;
+			}
+			if (dc.seg) {
+				calls.push_back(dc);
+			}
+			pc = p;
+		} else if (opcode == 0x0A) {
+			const uint8_t op = code[pc + 1];
+			pc += 3 + ((op & 0x80) ? 1 : (op & 0x40) ? 2 : 1) + 2;
+		} else if (opcode < sizeof(opcodeSizes)) {
+			pc += opcodeSizes[opcode];
+		} else {
+			break;
+		}
+	}
+}
+
+static void benchPolygons(Video &video, Resource &res) {
+	for (int i = 0; i < GAME_NUM_PARTS; ++i) {
+		const uint16_t partId = GAME_PART_FIRST + i;
+		const uint8_t codeIndex = memListParts[i][MEMLIST_PART_CODE];
+		const uint8_t cinematicIndex = memListParts[i][MEMLIST_PART_POLY_CINEMATIC];
+		if (codeIndex >= res._numMemList || res._memList[codeIndex].bankId == 0 || res._memList[cinematicIndex].bankId == 0) {
+			continue;
+		}
+		res._segVideo2 = 0;
+		res.setupPart(partId);
+		std::vector<DrawCall> calls;
+		collectDrawCalls(res, res._memList[codeIndex].size, calls);
+		if (calls.empty()) {
+			continue;
+		}
+		video.changePagePtr1(1);
+		for (int cached = 0; cached < 2; ++cached) {
+			char name[64];
+			snprintf(name, sizeof(name), "fillPolygon part 0x%04X (%d calls%s)", partId, (int)calls.size(), cached ? ", cached" : "");
+			video._cachePolygons = (cached != 0);
+			size_t n = 0;
+			bench(name, 0, [&]() {
+				const DrawCall &dc = calls[n];
+				video.setDataBuffer(dc.seg, dc.off);
+				video.readAndDrawPolygon(0xFF, dc.zoom, dc.pt);
+				if (++n == calls.size()) {
+					n = 0;
+				}
+			});
+		}
+		// the whole draw list of the part, as a frame of the deferred mode
+		static const uint32_t rasterThreads[] = { 0, 1, 2, 4 };
+		for (size_t t = 0; t < ARRAYSIZE(rasterThreads); ++t) {
+			char name[64];
+			snprintf(name, sizeof(name), "draw list part 0x%04X (%d raster threads)", partId, rasterThreads[t]);
+			video.setRasterThreads(rasterThreads[t]);
+			bench(name, 0, [&]() {
+				for (size_t n = 0; n < calls.size(); ++n) {
+					video.setDataBuffer(calls[n].seg, calls[n].off);
+					video.readAndDrawPolygon(0xFF, calls[n].zoom, calls[n].pt);
+				}
+				video.flush();
+			});
+		}
+		video.setRasterThreads(0);
+		// the same list drawn a second time into the high resolution pages
+		for (uint8_t scale = 2; scale <= HiresRenderer::MAX_SCALE; scale *= 2) {
+			char name[64];
+			snprintf(name, sizeof(name), "draw list part 0x%04X (hires x%d)", partId, scale);
+			video.setHiresScale(scale);
+			bench(name, 0, [&]() {
+				for (size_t n = 0; n < calls.size(); ++n) {
+					video.setDataBuffer(calls[n].seg, calls[n].off);
+					video.readAndDrawPolygon(0xFF, calls[n].zoom, calls[n].pt);
+				}
+			});
+		}
+		video.setHiresScale(0);
+	}
+}
+
+struct Span {
+	int16_t y, x1, x2;
+};
+
+static void benchSpans(Video &video) {
+	// spans width distribution is roughly the one of the game polygons,
+	// most of them are narrow and a few are full screen
+	std::vector<Span> spans(4096);
+	uint32_t rnd = 0x12345678;
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < spans.size(); ++i) {
+		rnd = rnd * 1103515245 + 12345;
+		const int w = ((rnd >> 16) % 8 == 0) ? 320 : ((rnd >> 8) % 80) + 1;
+		rnd = rnd * 1103515245 + 12345;
+		Span &s = spans[i];
+		s.y = (rnd >> 16) % 200;
+		s.x1 = (w == 320) ? 0 : ((rnd >> 4) % (320 - w));
+		s.x2 = s.x1 + w - 1;
+		bytes += s.x2 / 2 - s.x1 / 2 + 1;
+	}
+	video.changePagePtr1(1);
+	static const struct {
+		const char *name;
+		Video::drawLine fct;
+		uint8_t color;
+	} kernels[] = {
+		{ "drawLineN (4096 spans)", &Video::drawLineN, 0x05 },
+		{ "drawLineP (4096 spans)", &Video::drawLineP, 0x11 },
+		{ "drawLineBlend (4096 spans)", &Video::drawLineBlend, 0x10 },
+	};
+	for (size_t k = 0; k < ARRAYSIZE(kernels); ++k) {
+		const Video::drawLine fct = kernels[k].fct;
+		const uint8_t color = kernels[k].color;
+		bench(kernels[k].name, bytes, [&]() {
+			for (size_t i = 0; i < spans.size(); ++i) {
+				video._hliney = spans[i].y;
+				(video.*fct)(spans[i].x1, spans[i].x2, color);
+			}
+		});
+	}
+}
+
+static bool readEntry(Resource &res, const MemEntry *me, std::vector<uint8_t> &buf) {
+	buf.resize(MAX(me->size, me->packedSize));
+	Bank bk(res._dataDir, &res._bankFiles);
+	return bk.read(me, buf.data());
+}
+
+static void benchCopyPage(Video &video, Resource &res) {
+	int count = 0;
+	for (int i = 0; i < res._numMemList; ++i) {
+		const MemEntry *me = &res._memList[i];
+		if (me->type != Resource::RT_POLY_ANIM || me->bankId == 0 || me->size < Video::VID_PAGE_SIZE) {
+			continue;
+		}
+		std::vector<uint8_t> buf;
+		if (!readEntry(res, me, buf)) {
+			continue;
+		}
+		char name[64];
+		snprintf(name, sizeof(name), "copyPage planar entry 0x%02X", i);
+		bench(name, Video::VID_PAGE_SIZE, [&]() {
+			video.copyPage(buf.data(), Video::NO_SCREEN);
+		});
+		++count;
+	}
+	if (count == 0) {
+		printf("%-48s no RT_POLY_ANIM entry\n", "copyPage planar");
+	}
+}
+
+// the longest string of the English table, with its line breaks
+static void benchDrawString(Video &video) {
+	const StrEntry *longest = &Video::_stringsTableEng[0];
+	for (const StrEntry *se = Video::_stringsTableEng; se->id != END_OF_STRING_DICTIONARY; ++se) {
+		if (strlen(se->str) > strlen(longest->str)) {
+			longest = se;
+		}
+	}
+	char name[64];
+	snprintf(name, sizeof(name), "drawString 0x%03X (%d chars)", longest->id, (int)strlen(longest->str));
+	video.changePagePtr1(1);
+	bench(name, 0, [&]() {
+		video.drawString(0x0F, 0, 0, longest->id);
+	});
+}
+
+// the page drawn by the spans benchmark, so that it is not blank
+static void benchFrameHash(Video &video) {
+	volatile uint64_t h = 0;
+	bench("FrameHasher::hashPage", Video::VID_PAGE_SIZE, [&]() {
+		h = FrameHasher::hashPage(video._curPagePtr1, 0);
+	});
+}
+
+static void benchMixer(System *sys, Resource &res) {
+	enum {
+		SAMPLES_PER_CALL = 1024
+	};
+	// pick the largest sound entries
+	std::vector<int> sounds;
+	for (int i = 0; i < res._numMemList; ++i) {
+		const MemEntry *me = &res._memList[i];
+		if (me->type == Resource::RT_SOUND && me->bankId != 0 && me->size > 8) {
+			sounds.push_back(i);
+		}
+	}
+	std::sort(sounds.begin(), sounds.end(), [&](int a, int b) {
+		return res._memList[a].size > res._memList[b].size;
+	});
+	if (sounds.empty()) {
+		printf("%-48s no RT_SOUND entry\n", "Mixer::mix");
+		return;
+	}
+	std::vector<uint8_t> bufs[AUDIO_NUM_CHANNELS];
+	MixerChunk chunks[AUDIO_NUM_CHANNELS];
+	for (int ch = 0; ch < AUDIO_NUM_CHANNELS; ++ch) {
+		const MemEntry *me = &res._memList[sounds[ch % sounds.size()]];
+		memset(&chunks[ch], 0, sizeof(MixerChunk));
+		if (!readEntry(res, me, bufs[ch])) {
+			continue;
+		}
+		MixerChunk *mc = &chunks[ch];
+		mc->data = bufs[ch].data() + 8;
+		mc->len = MIN(READ_BE_UINT16(bufs[ch].data()) * 2, me->size - 8);
+		mc->loopPos = 0;
+		mc->loopLen = mc->len;
+	}
+	static const struct {
+		uint32_t rate;
+		uint8_t bits;
+		const char *name;
+	} formats[] = {
+		{ 22050, 8, "Mixer::mix 4 looping channels 22kHz 8-bit (1024)" },
+		{ 48000, 16, "Mixer::mix 4 looping channels 48kHz 16-bit (1024)" }
+	};
+	for (size_t i = 0; i < ARRAYSIZE(formats); ++i) {
+		Mixer mixer(sys);
+		mixer._sampleRate = formats[i].rate;
+		mixer._sampleBits = formats[i].bits;
+#ifdef ENABLE_PROFILER
+		mixer._profiler = &_profiler;
+#endif
+		mixer.init();
+		for (int ch = 0; ch < AUDIO_NUM_CHANNELS; ++ch) {
+			if (chunks[ch].data != 0) {
+				mixer.playChannel(ch, &chunks[ch], 8000 + ch * 2000, 0x3F);
+			}
+		}
+		uint8_t out[SAMPLES_PER_CALL * 2];
+		const int len = SAMPLES_PER_CALL * formats[i].bits / 8;
+		bench(formats[i].name, SAMPLES_PER_CALL, [&]() {
+			mixer.mix(out, len);
+		});
+		mixer.free();
+	}
+}
+
+static void benchUnpack(Resource &res) {
+	struct Packed {
+		const MemEntry *me;
+		std::vector<uint8_t> data;
+	};
+	std::vector<Packed> entries;
+	uint64_t bytes = 0;
+	for (int i = 0; i < res._numMemList; ++i) {
+		const MemEntry *me = &res._memList[i];
+		if (me->bankId == 0 || me->packedSize == me->size) {
+			continue;
+		}
+		char bankName[10];
+		sprintf(bankName, "bank%02x", me->bankId);
+		File f;
+		if (!f.open(bankName, res._dataDir)) {
+			continue;
+		}
+		Packed p;
+		p.me = me;
+		p.data.resize(me->packedSize);
+		f.seek(me->bankOffset);
+		f.read(p.data.data(), me->packedSize);
+		entries.push_back(p);
+		bytes += me->size;
+	}
+	if (entries.empty()) {
+		printf("%-48s no packed entry\n", "Bank::unpack");
+		return;
+	}
+	// both decoders must produce the same output
+	std::vector<uint8_t> buf(0x10000), ref(0x10000);
+	Bank bk(res._dataDir);
+	for (size_t i = 0; i < entries.size(); ++i) {
+		const Packed &p = entries[i];
+		bk._fastUnpack = false;
+		const bool refOk = bk.unpack(p.data.data(), p.data.size(), ref.data());
+		bk._fastUnpack = true;
+		const bool ok = bk.unpack(p.data.data(), p.data.size(), buf.data());
+		if (!refOk || !ok || memcmp(buf.data(), ref.data(), p.me->size) != 0) {
+			error("Bank::unpackFast() mismatch for entry %d", (int)(p.me - res._memList));
+		}
+	}
+	static const struct {
+		bool fast;
+		const char *name;
+	} decoders[] = {
+		{ false, "bit by bit" },
+		{ true, "table" }
+	};
+	for (size_t d = 0; d < ARRAYSIZE(decoders); ++d) {
+		bk._fastUnpack = decoders[d].fast;
+		char name[64];
+		snprintf(name, sizeof(name), "Bank::unpack all (%d entries, %s)", (int)entries.size(), decoders[d].name);
+		bench(name, bytes, [&]() {
+			for (size_t i = 0; i < entries.size(); ++i) {
+				const Packed &p = entries[i];
+				if (!bk.unpack(p.data.data(), p.data.size(), buf.data())) {
+					error("Bank::unpack() failed for entry %d", (int)(p.me - res._memList));
+				}
+			}
+		});
+	}
+}
+
+int main(int argc, char *argv[]) {
+	const char *dataPath = "./assets";
+	const char *minDuration = 0;
+	for (int i = 1; i < argc; ++i) {
+		bool opt = false;
+		if (strlen(argv[i]) >= 2) {
+			opt |= parseOption(argv[i], "datapath=", &dataPath);
+			opt |= parseOption(argv[i], "time=", &minDuration);
+		}
+		if (!opt) {
+			printf("%s", USAGE);
+			return 0;
+		}
+	}
+	if (minDuration) {
+		_minDuration = MAX(atoi(minDuration), 1);
+	}
+
+	const std::unique_ptr<System> sys(System_Headless_create(true));
+	Video video(0, sys.get());
+	Resource res(&video, dataPath);
+	video.res = &res;
+#ifdef ENABLE_PROFILER
+	video._profiler = &_profiler;
+	res._profiler = &_profiler;
+#endif
+	video.init();
+	res.allocMemBlock();
+	res.readEntries();
+
+	printf("%-48s %12s %14s %10s\n", "benchmark", "ops", "ns/op", "MB/s");
+	benchPolygons(video, res);
+	benchSpans(video);
+	benchDrawString(video);
+	benchCopyPage(video, res);
+	benchFrameHash(video);
+	benchMixer(sys.get(), res);
+	benchUnpack(res);
+
+	res.freeMemBlock();
+	return 0;
+}
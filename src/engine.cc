@@ -25,14 +25,16 @@
 #include "sys.h"
 #include "parts.h"
 
-static constexpr uint32_t AWSV = (static_cast<uint32_t>('A') << 24)
-		                       | (static_cast<uint32_t>('W') << 16)
-		                       | (static_cast<uint32_t>('S') <<  8)
-		                       | (static_cast<uint32_t>('V') <<  0)
-		                       ;
-
 static void engineMainLoop(Engine* engine) {
 
+	if (engine->sys->input.rewind) {
+		engine->rewindSnapshot();
+		return;
+	}
+	engine->captureSnapshot();
+
+	PROFILE_START(frameStart);
+
 	engine->vm.checkThreadRequests();
 
 	engine->vm.inp_updatePlayer();
@@ -41,6 +43,8 @@ static void engineMainLoop(Engine* engine) {
 
 	engine->vm.hostFrame();
 
+	PROFILE_FRAME(&engine->profiler, frameStart);
+
 #ifdef __EMSCRIPTEN__
 	if (engine->sys->input.quit) {
 		engine = (delete engine, nullptr);
@@ -51,9 +55,15 @@ static void engineMainLoop(Engine* engine) {
 
 }
 
-Engine::Engine(System *paramSys, const char *dataDir, const char *saveDir)
+Engine::Engine(System *paramSys, const char *dataDir, const char *saveDir, const EngineOptions &options)
 	: sys(paramSys), vm(&mixer, &res, &player, &video, sys), mixer(sys), res(&video, dataDir), 
-	player(&mixer, &res, sys), video(&res, sys), _dataDir(dataDir), _saveDir(saveDir), _stateSlot(0) {
+	player(&mixer, &res, sys), video(&res, sys), _dataDir(dataDir), _saveDir(saveDir), _options(options), _stateSlot(0), _snapshotTime(0) {
+#ifdef ENABLE_PROFILER
+	vm._profiler = &profiler;
+	video._profiler = &profiler;
+	mixer._profiler = &profiler;
+	res._profiler = &profiler;
+#endif
 	init();
 }
 
@@ -85,13 +95,44 @@ void Engine::init() {
 	sys->init("Out Of This World");
 
 	video.init();
-
-	res.allocMemBlock();
-
+	video._cachePolygons = _options.polygonCache;
+	video._frameHasher = _options.frameHasher;
+	if (_options.rasterThreads != 0) {
+		video.setRasterThreads(_options.rasterThreads);
+	}
+	if (_options.hiresScale != 0) {
+		video.setHiresScale(_options.hiresScale);
+	}
+	vm._scheduler._frameSkip = _options.frameSkip;
+
+	res.allocMemBlock(_options.memorySize);
+	res._decodeProgram = _options.threadedVm;
+	res._cache.setMaxSize(_options.resourceCacheSize);
+	if (_options.assets != 0) {
+		// already unpacked, from the archive too if any
+		res._assets = _options.assets;
+	} else {
+		if (_options.prefetch) {
+			res._prefetcher.init();
+		}
+		if (_options.archive != 0 && !res._archive.open(_options.archive, _dataDir)) {
+			error("Engine::init() unable to load archive '%s'", _options.archive);
+		}
+	}
 	res.readEntries();
 
-	vm.init();
+	vm.init(_options.randomSeed);
 
+	if (_options.rewindSeconds != 0 && !_snapshots.init(_options.rewindSeconds)) {
+		warning("Engine::init() unable to allocate %d seconds of snapshots, rewind disabled", _options.rewindSeconds);
+	}
+
+	if (_options.audioSequencer) {
+		player._audioSequencer = true;
+		mixer._sequencer = &player;
+	}
+	mixer._sampleRate = _options.audioSampleRate;
+	mixer._sampleBits = _options.audioSampleBits;
 	mixer.init();
 
 	player.init();
@@ -117,9 +158,16 @@ void Engine::init() {
 }
 
 void Engine::finish() {
+#ifdef ENABLE_PROFILER
+	profiler.dump();
+#endif
 	player.free();
 	mixer.free();
+	res._prefetcher.free();
+	_stateWriter.free();
+	video.free();
 	res.freeMemBlock();
+	_snapshots.free();
 	sys->destroy();
 }
 
@@ -140,67 +188,120 @@ void Engine::processInput() {
 		}
 		sys->input.stateSlot = 0;
 	}
+	if (sys->input.dumpStats) {
+#ifdef ENABLE_PROFILER
+		profiler.dump();
+#endif
+		sys->input.dumpStats = false;
+	}
+}
+
+/*
+	The snapshots are taken at the start of a frame, before the VM runs, at
+	most SNAPSHOTS_PER_SECOND times per second. Only memory copies are done,
+	the resources are shared with the running game.
+*/
+void Engine::captureSnapshot() {
+	if (_snapshots._size == 0) {
+		return;
+	}
+	const uint32_t now = sys->getTimeStamp();
+	if (!_snapshots.empty() && now - _snapshotTime < 1000 / SnapshotRing::SNAPSHOTS_PER_SECOND) {
+		return;
+	}
+	PROFILE_START(snapshotStart);
+	GameSnapshot *gs = _snapshots.push();
+	gs->timeStamp = now;
+	vm.captureState(gs->vm);
+	res.captureState(gs->res);
+	video.captureState(gs->video);
+	player.captureState(gs->player);
+	mixer.captureState(gs->mixer);
+	_snapshotTime = now;
+	PROFILE_SNAPSHOT(&profiler, snapshotStart);
+}
+
+// Goes back one snapshot per call, at the pace they were taken
+void Engine::rewindSnapshot() {
+	const GameSnapshot *gs = _snapshots.pop();
+	if (gs) {
+		res.restoreState(gs->res);
+		vm.restoreState(gs->vm);
+		video.restoreState(gs->video);
+		player.restoreState(gs->player);
+		mixer.restoreState(gs->mixer);
+		video.refreshDisplay();
+	}
+	sys->processEvents();
+	sys->sleep(1000 / SnapshotRing::SNAPSHOTS_PER_SECOND);
+	_snapshotTime = sys->getTimeStamp();
 }
 
 void Engine::makeGameStateName(uint8_t slot, char *buf) {
 	sprintf(buf, "raw.s%02d", slot);
 }
 
+void Engine::saveOrLoadState(Serializer &s) {
+	vm.saveOrLoad(s);
+	res.saveOrLoad(s);
+	video.saveOrLoad(s);
+	player.saveOrLoad(s);
+	mixer.saveOrLoad(s);
+}
+
+// The state is serialized in memory, then packed and written by _stateWriter
 void Engine::saveGameState(uint8_t slot, const char *desc) {
 	char stateFile[20];
 	makeGameStateName(slot, stateFile);
-	File f(true);
-	if (!f.open(stateFile, _saveDir, "wb")) {
-		warning("Unable to save state file '%s'", stateFile);
-	} else {
-		// header
-		f.writeUint32BE(AWSV);
-		f.writeUint16BE(Serializer::CUR_VER);
-		f.writeUint16BE(0);
-		char hdrdesc[32];
-		strncpy(hdrdesc, desc, sizeof(hdrdesc) - 1);
-		f.write(hdrdesc, sizeof(hdrdesc));
-		// contents
-		Serializer s(&f, Serializer::SM_SAVE, res._memPtrStart);
-		vm.saveOrLoad(s);
-		res.saveOrLoad(s);
-		video.saveOrLoad(s);
-		player.saveOrLoad(s);
-		mixer.saveOrLoad(s);
-		if (f.ioErr()) {
-			warning("I/O error when saving game state");
-		} else {
-			debug(DBG_INFO, "Saved state to slot %d", _stateSlot);
-		}
-	}
+	File f(File::BACKEND_MEMORY);
+	Serializer s(&f, Serializer::SM_SAVE, res._arena._base);
+	saveOrLoadState(s);
+	std::vector<uint8_t> state(f.getData(), f.getData() + f.getSize());
+	_stateWriter.write(stateFile, _saveDir, desc, state);
+	debug(DBG_INFO, "Saving state to slot %d", _stateSlot);
 }
 
 void Engine::loadGameState(uint8_t slot) {
 	char stateFile[20];
 	makeGameStateName(slot, stateFile);
+	// the state of this slot may still be written
+	_stateWriter.flush();
 	File f(true);
 	if (!f.open(stateFile, _saveDir, "rb")) {
 		warning("Unable to open state file '%s'", stateFile);
 	} else {
 		uint32_t id = f.readUint32BE();
-		if (id != AWSV) {
+		if (id != StateWriter::MAGIC) {
 			warning("Bad savegame format");
 		} else {
-			// mute
-			player.stop();
-			mixer.stopAll();
 			// header
 			uint16_t ver = f.readUint16BE();
 			f.readUint16BE();
-			char hdrdesc[32];
+			char hdrdesc[StateWriter::DESC_SIZE];
 			f.read(hdrdesc, sizeof(hdrdesc));
-			// contents
-			Serializer s(&f, Serializer::SM_LOAD, res._memPtrStart, ver);
-			vm.saveOrLoad(s);
-			res.saveOrLoad(s);
-			video.saveOrLoad(s);
-			player.saveOrLoad(s);
-			mixer.saveOrLoad(s);
+			if (ver > Serializer::CUR_VER) {
+				warning("Unsupported savegame version %d", ver);
+			} else if (ver >= 3) {
+				std::vector<uint8_t> state;
+				if (!StateWriter::readState(f, state)) {
+					warning("Corrupted savegame");
+				} else {
+					player.stop();
+					mixer.stopAll();
+					File mem(File::BACKEND_MEMORY);
+					mem.write(state.data(), state.size());
+					mem.seek(0);
+					Serializer s(&mem, Serializer::SM_LOAD, res._arena._base, ver);
+					saveOrLoadState(s);
+				}
+			} else {
+				// mute
+				player.stop();
+				mixer.stopAll();
+				// contents
+				Serializer s(&f, Serializer::SM_LOAD, res._arena._base, ver);
+				saveOrLoadState(s);
+			}
 		}
 		if (f.ioErr()) {
 			warning("I/O error when loading game state");
@@ -25,9 +25,38 @@
 #include "sfxplayer.h"
 #include "resource.h"
 #include "video.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "statewriter.h"
 
+struct AssetStore;
+struct Serializer;
+struct FrameHasher;
 struct System;
 
+struct EngineOptions {
+	uint16_t randomSeed;
+	bool threadedVm;
+	bool polygonCache;
+	bool audioSequencer;
+	uint32_t audioSampleRate;
+	uint8_t audioSampleBits;
+	uint32_t resourceCacheSize; // bytes
+	bool prefetch;
+	const char *archive; // file name in the data path, 0 to read memlist.bin and the banks
+	uint32_t memorySize; // bytes
+	uint32_t rewindSeconds; // 0 disables the snapshots
+	const AssetStore *assets; // shared resources, 0 to read the files
+	FrameHasher *frameHasher; // 0 to not hash the displayed frames
+	uint32_t rasterThreads; // 0 draws the polygons immediately
+	uint8_t hiresScale; // 0 displays the 4bpp pages
+	bool frameSkip;
+
+	EngineOptions()
+		: randomSeed(0), threadedVm(false), polygonCache(true), audioSequencer(false), audioSampleRate(22050), audioSampleBits(8), resourceCacheSize(4096 * 1024), prefetch(true), archive(0), memorySize(Resource::MEM_BLOCK_SIZE), rewindSeconds(0), assets(0), frameHasher(0), rasterThreads(0), hiresScale(0), frameSkip(false) {
+	}
+};
+
 struct Engine {
 	enum {
 		MAX_SAVE_SLOTS = 100
@@ -39,18 +68,28 @@ struct Engine {
 	Resource res;
 	SfxPlayer player;
 	Video video;
+#ifdef ENABLE_PROFILER
+	Profiler profiler;
+#endif
 	const char *_dataDir, *_saveDir;
+	EngineOptions _options;
 	uint8_t _stateSlot;
+	SnapshotRing _snapshots;
+	uint32_t _snapshotTime; // time stamp of the last capture
+	StateWriter _stateWriter;
 
-	Engine(System *stub, const char *dataDir, const char *saveDir);
+	Engine(System *stub, const char *dataDir, const char *saveDir, const EngineOptions &options);
 	~Engine();
 
 	void run();
 	void init();
 	void finish();
 	void processInput();
+	void captureSnapshot();
+	void rewindSnapshot();
 	
 	void makeGameStateName(uint8_t slot, char *buf);
+	void saveOrLoadState(Serializer &s);
 	void saveGameState(uint8_t slot, const char *desc);
 	void loadGameState(uint8_t slot);
 };
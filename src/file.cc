@@ -16,8 +16,15 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
+#include <vector>
 #include "zlib.h"
 #include "file.h"
+#if !defined(__EMSCRIPTEN__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 struct File_impl {
@@ -29,6 +36,8 @@ struct File_impl {
 	virtual void seek(int32_t off) = 0;
 	virtual void read(void *ptr, uint32_t size) = 0;
 	virtual void write(void *ptr, uint32_t size) = 0;
+	virtual const uint8_t *getData() const { return 0; }
+	virtual uint32_t getSize() const { return 0; }
 };
 
 struct stdFile : File_impl {
@@ -105,6 +114,143 @@ struct zlibFile : File_impl {
 	}
 };
 
+/*
+	The whole file is mapped in memory (or read at once under Emscripten, where
+	the files are preloaded anyway), read() and seek() are then plain copies.
+*/
+struct mappedFile : File_impl {
+	uint8_t *_data;
+	uint32_t _size;
+	uint32_t _pos;
+	mappedFile() : _data(0), _size(0), _pos(0) {}
+	bool open(const char *path, const char *mode) {
+		_ioErr = false;
+		_pos = 0;
+		if (strchr(mode, 'w') || strchr(mode, 'a')) {
+			return false;
+		}
+#if defined(__EMSCRIPTEN__)
+		FILE *fp = fopen(path, "rb");
+		if (!fp) {
+			return false;
+		}
+		fseek(fp, 0, SEEK_END);
+		_size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		_data = (uint8_t *)malloc(_size ? _size : 1);
+		if (fread(_data, 1, _size, fp) != _size) {
+			_ioErr = true;
+		}
+		fclose(fp);
+		return true;
+#else
+		const int fd = ::open(path, O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			::close(fd);
+			return false;
+		}
+		_size = st.st_size;
+		if (_size != 0) {
+			void *p = mmap(0, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) {
+				::close(fd);
+				_size = 0;
+				return false;
+			}
+			_data = (uint8_t *)p;
+		}
+		::close(fd);
+		return true;
+#endif
+	}
+	void close() {
+		if (_data) {
+#if defined(__EMSCRIPTEN__)
+			::free(_data);
+#else
+			munmap(_data, _size);
+#endif
+			_data = 0;
+		}
+		_size = 0;
+		_pos = 0;
+	}
+	void seek(int32_t off) {
+		_pos = MIN((uint32_t)off, _size);
+	}
+	void read(void *ptr, uint32_t size) {
+		if (size > _size - _pos) {
+			memset(ptr, 0, size);
+			size = _size - _pos;
+			_ioErr = true;
+		}
+		if (size != 0) {
+			memcpy(ptr, _data + _pos, size);
+			_pos += size;
+		}
+	}
+	void write(void *ptr, uint32_t size) {
+		_ioErr = true;
+	}
+	const uint8_t *getData() const {
+		return _data;
+	}
+	uint32_t getSize() const {
+		return _size;
+	}
+};
+
+/*
+	A buffer in memory, for the Serializer. It is open at construction and
+	open() is not needed, written bytes past the end extend the buffer.
+*/
+struct memoryFile : File_impl {
+	std::vector<uint8_t> _buf;
+	uint32_t _pos;
+	memoryFile() : _pos(0) {}
+	bool open(const char *path, const char *mode) {
+		_ioErr = false;
+		_buf.clear();
+		_pos = 0;
+		return true;
+	}
+	void close() {
+	}
+	void seek(int32_t off) {
+		_pos = MIN((uint32_t)off, (uint32_t)_buf.size());
+	}
+	void read(void *ptr, uint32_t size) {
+		if (size > _buf.size() - _pos) {
+			memset(ptr, 0, size);
+			size = _buf.size() - _pos;
+			_ioErr = true;
+		}
+		if (size != 0) {
+			memcpy(ptr, &_buf[_pos], size);
+			_pos += size;
+		}
+	}
+	void write(void *ptr, uint32_t size) {
+		if (_pos + size > _buf.size()) {
+			_buf.resize(_pos + size);
+		}
+		if (size != 0) {
+			memcpy(&_buf[_pos], ptr, size);
+			_pos += size;
+		}
+	}
+	const uint8_t *getData() const {
+		return _buf.data();
+	}
+	uint32_t getSize() const {
+		return _buf.size();
+	}
+};
+
 File::File(bool gzipped) {
 	if (gzipped) {
 		_impl = new zlibFile;
@@ -113,6 +259,23 @@ File::File(bool gzipped) {
 	}
 }
 
+File::File(Backend backend) {
+	switch (backend) {
+	case BACKEND_ZLIB:
+		_impl = new zlibFile;
+		break;
+	case BACKEND_MAPPED:
+		_impl = new mappedFile;
+		break;
+	case BACKEND_MEMORY:
+		_impl = new memoryFile;
+		break;
+	default:
+		_impl = new stdFile;
+		break;
+	}
+}
+
 File::~File() {
 	_impl->close();
 	delete _impl;
@@ -140,6 +303,14 @@ bool File::ioErr() const {
 	return _impl->_ioErr;
 }
 
+const uint8_t *File::getData() const {
+	return _impl->getData();
+}
+
+uint32_t File::getSize() const {
+	return _impl->getSize();
+}
+
 void File::seek(int32_t off) {
 	_impl->seek(off);
 }
@@ -183,3 +354,13 @@ void File::writeUint32BE(uint32_t n) {
 	writeUint16BE(n >> 16);
 	writeUint16BE(n & 0xFFFF);
 }
+
+void File::writeUint16LE(uint16_t n) {
+	writeByte(n & 0xFF);
+	writeByte(n >> 8);
+}
+
+void File::writeUint32LE(uint32_t n) {
+	writeUint16LE(n & 0xFFFF);
+	writeUint16LE(n >> 16);
+}
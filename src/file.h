@@ -24,9 +24,17 @@
 struct File_impl;
 
 struct File {
+	enum Backend {
+		BACKEND_STDIO,
+		BACKEND_ZLIB,
+		BACKEND_MAPPED, // read only, the whole file is accessible with getData()
+		BACKEND_MEMORY  // growable buffer, open at construction, accessible with getData()
+	};
+
 	File_impl *_impl;
 
 	File(bool gzipped = false);
+	File(Backend backend);
 	virtual ~File();
 
 	bool open(const char *filename, const char *directory, const char *mode="rb");
@@ -41,6 +49,10 @@ struct File {
 	void writeByte(uint8_t b);
 	void writeUint16BE(uint16_t n);
 	void writeUint32BE(uint32_t n);
+	void writeUint16LE(uint16_t n);
+	void writeUint32LE(uint32_t n);
+	const uint8_t *getData() const;
+	uint32_t getSize() const;
 };
 
 #endif
@@ -0,0 +1,143 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "framehash.h"
+#include "util.h"
+#include "video.h"
+
+static constexpr uint32_t AWFH = (static_cast<uint32_t>('A') << 24)
+		                       | (static_cast<uint32_t>('W') << 16)
+		                       | (static_cast<uint32_t>('F') <<  8)
+		                       | (static_cast<uint32_t>('H') <<  0)
+		                       ;
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hashRound(uint64_t acc, uint64_t w) {
+	return rotl(acc + w * PRIME2, 31) * PRIME1;
+}
+
+static inline uint64_t readWord(const uint8_t *p) {
+	return ((uint64_t)READ_BE_UINT32(p) << 32) | READ_BE_UINT32(p + 4);
+}
+
+FrameHasher::FrameHasher()
+	: _mode(MODE_RECORD), _framesCount(0), _firstMismatch(NO_FRAME) {
+}
+
+FrameHasher::~FrameHasher() {
+	close();
+}
+
+/*
+	Four independent lanes of 8 bytes words, so the multiplications of the
+	32000 bytes do not wait on each other, folded at the end.
+*/
+uint64_t FrameHasher::hashPage(const uint8_t *page, uint8_t paletteId) {
+	uint64_t acc[4] = { PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1 };
+	for (int i = 0; i < Video::VID_PAGE_SIZE; i += 32) {
+		acc[0] = hashRound(acc[0], readWord(page + i));
+		acc[1] = hashRound(acc[1], readWord(page + i + 8));
+		acc[2] = hashRound(acc[2], readWord(page + i + 16));
+		acc[3] = hashRound(acc[3], readWord(page + i + 24));
+	}
+	uint64_t h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+	h = hashRound(h, paletteId);
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	return h;
+}
+
+bool FrameHasher::open(const char *fileName, const char *dir, Mode mode) {
+	_mode = mode;
+	_framesCount = 0;
+	_firstMismatch = NO_FRAME;
+	if (mode == MODE_RECORD) {
+		if (!_f.open(fileName, dir, "wb")) {
+			warning("Unable to create frame hash file '%s'", fileName);
+			return false;
+		}
+		_f.writeUint32BE(AWFH);
+		_f.writeUint16BE(CUR_VER);
+		return true;
+	}
+	File f(File::BACKEND_MAPPED);
+	if (!f.open(fileName, dir)) {
+		warning("Unable to open frame hash file '%s'", fileName);
+		return false;
+	}
+	const uint8_t *p = f.getData();
+	const uint32_t size = f.getSize();
+	if (size < 6 || READ_BE_UINT32(p) != AWFH || READ_BE_UINT16(p + 4) > CUR_VER) {
+		warning("Bad frame hash file format");
+		return false;
+	}
+	_expected.clear();
+	for (uint32_t pos = 6; pos + 8 <= size; pos += 8) {
+		_expected.push_back(readWord(p + pos));
+	}
+	return true;
+}
+
+void FrameHasher::close() {
+	_f.close();
+}
+
+void FrameHasher::addFrame(const uint8_t *page, uint8_t paletteId) {
+	const uint64_t h = hashPage(page, paletteId);
+	if (_mode == MODE_RECORD) {
+		_f.writeUint32BE(h >> 32);
+		_f.writeUint32BE(h & 0xFFFFFFFF);
+	} else if (_firstMismatch == NO_FRAME) {
+		if (_framesCount >= _expected.size()) {
+			_firstMismatch = _framesCount;
+		} else if (_expected[_framesCount] != h) {
+			warning("Frame %d differs, hash %016llX instead of %016llX", _framesCount, (unsigned long long)h, (unsigned long long)_expected[_framesCount]);
+			_firstMismatch = _framesCount;
+		}
+	}
+	++_framesCount;
+}
+
+bool FrameHasher::finish() {
+	if (_mode == MODE_RECORD) {
+		const bool ok = !_f.ioErr();
+		if (!ok) {
+			warning("I/O error when writing the frame hashes");
+		}
+		debug(DBG_INFO, "FrameHasher::finish() %d frames recorded", _framesCount);
+		close();
+		return ok;
+	}
+	if (_firstMismatch == NO_FRAME && _framesCount != _expected.size()) {
+		_firstMismatch = MIN(_framesCount, (uint32_t)_expected.size());
+	}
+	if (_firstMismatch == NO_FRAME) {
+		printf("Frame hashes: all %d frames match\n", _framesCount);
+		return true;
+	}
+	printf("Frame hashes: first diverging frame %d, %d frames played, %d recorded\n", _firstMismatch, _framesCount, (int)_expected.size());
+	return false;
+}
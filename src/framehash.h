@@ -0,0 +1,64 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __FRAMEHASH_H__
+#define __FRAMEHASH_H__
+
+#include <vector>
+#include "intern.h"
+#include "file.h"
+
+/*
+	A frame hash file starts with a 'AWFH' tag and a version. It is followed
+	by one big endian uint64_t per call to Video::updateDisplay(), the hash of
+	the page displayed and of the current palette id.
+
+	In MODE_RECORD the hashes are written to the file, in MODE_CHECK they are
+	compared to the ones read from it and the first diverging frame is
+	reported.
+*/
+struct FrameHasher {
+	enum {
+		CUR_VER = 1,
+		NO_FRAME = 0xFFFFFFFF
+	};
+
+	enum Mode {
+		MODE_RECORD,
+		MODE_CHECK
+	};
+
+	Mode _mode;
+	File _f;
+	std::vector<uint64_t> _expected;
+	uint32_t _framesCount;
+	uint32_t _firstMismatch; // NO_FRAME as long as all the frames matched
+
+	FrameHasher();
+	~FrameHasher();
+
+	static uint64_t hashPage(const uint8_t *page, uint8_t paletteId);
+
+	bool open(const char *fileName, const char *dir, Mode mode);
+	void close();
+	void addFrame(const uint8_t *page, uint8_t paletteId);
+	bool finish(); // reports the result of MODE_CHECK, false on a mismatch
+};
+
+#endif
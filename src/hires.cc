@@ -0,0 +1,279 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "hires.h"
+#include "endian.h"
+#include "util.h"
+
+HiresRenderer::HiresRenderer()
+	: _scale(0), _w(0), _h(0), _deferred(false) {
+	memset(_pages, 0, sizeof(_pages));
+}
+
+// The four pages are allocated in a single block
+bool HiresRenderer::init(uint8_t scale) {
+	free();
+	if (scale == 0 || scale > MAX_SCALE) {
+		return false;
+	}
+	_w = 320 * scale;
+	_h = 200 * scale;
+	uint8_t *p = (uint8_t *)malloc(4 * _w * _h);
+	if (!p) {
+		return false;
+	}
+	memset(p, 0, 4 * _w * _h);
+	for (int i = 0; i < 4; ++i) {
+		_pages[i] = p + i * _w * _h;
+	}
+	_interpTable[0] = 1 << 24;
+	for (int i = 1; i < MAX_DY; ++i) {
+		_interpTable[i] = (1 << 24) / i;
+	}
+	_scale = scale;
+	return true;
+}
+
+void HiresRenderer::free() {
+	::free(_pages[0]);
+	memset(_pages, 0, sizeof(_pages));
+	_scale = 0;
+}
+
+/*
+	Same walk as Video::readAndDrawPolygon(), the position (x, y) and the
+	offsets of the children are in high resolution pixels.
+*/
+void HiresRenderer::drawShape(uint8_t page, const uint8_t *dataBuf, uint32_t offset, uint8_t color, uint16_t zoom, int32_t x, int32_t y) {
+	const uint8_t *p = dataBuf + offset;
+	const uint8_t i = *p++;
+	if (i >= 0xC0) {
+		if (color & 0x80) {
+			color = i & 0x3F;
+		}
+		fillPolygon(page, p, color, zoom, x, y);
+	} else if ((i & 0x3F) == 2) {
+		x -= p[0] * zoom * _scale / 64;
+		y -= p[1] * zoom * _scale / 64;
+		int16_t childs = p[2];
+		p += 3;
+		for (; childs >= 0; --childs) {
+			uint16_t off = READ_BE_UINT16(p);
+			const int32_t cx = x + p[2] * zoom * _scale / 64;
+			const int32_t cy = y + p[3] * zoom * _scale / 64;
+			p += 4;
+			uint8_t childColor = 0xFF;
+			if (off & 0x8000) {
+				childColor = *p & 0x7F;
+				p += 2;
+			}
+			off &= 0x7FFF;
+			drawShape(page, dataBuf, off * 2, childColor, zoom, cx, cy);
+		}
+	}
+}
+
+// The polygon is queued in the deferred mode, drawn at once otherwise
+void HiresRenderer::fillPolygon(uint8_t page, const uint8_t *p, uint8_t color, uint16_t zoom, int32_t x, int32_t y) {
+	const int32_t bbw = p[0] * zoom * _scale / 64;
+	const int32_t bbh = p[1] * zoom * _scale / 64;
+	const uint8_t numPoints = p[2];
+	if (numPoints >= MAX_POINTS || (numPoints & 1) != 0) {
+		return;
+	}
+
+	Polygon pg;
+	pg.page = page;
+	pg.color = color;
+	pg.firstPoint = _points.size();
+
+	// the points of the 4bpp renderer, one pixel wide at the original resolution
+	if (p[0] * zoom / 64 == 0 && p[1] * zoom / 64 == 1 && numPoints == 4) {
+		if (x < 0 || x + _scale > _w || y >= _h || y + _scale <= 0) {
+			return;
+		}
+		pg.numPoints = 0;
+		pg.x = x;
+		pg.y = y;
+		pg.height = _scale;
+	} else {
+		pg.x = x - bbw / 2;
+		pg.y = y - bbh / 2;
+		if (numPoints < 2 || pg.x >= _w || x + bbw / 2 < 0 || pg.y >= _h || y + bbh / 2 < 0) {
+			return;
+		}
+		pg.numPoints = numPoints;
+		p += 3;
+		for (int i = 0; i < numPoints; ++i) {
+			_points.push_back((*p++) * zoom * _scale / 64);
+			_points.push_back((*p++) * zoom * _scale / 64);
+		}
+		// the rows stepped by the edges of the second half, see scanPolygon()
+		const int32_t *pt = &_points[pg.firstPoint];
+		pg.height = 0;
+		for (int i = 1; i <= (numPoints - 2) / 2; ++i) {
+			pg.height += (uint16_t)(pt[2 * i + 1] - pt[2 * i - 1]);
+		}
+	}
+
+	if (_deferred) {
+		_polygons.push_back(pg);
+	} else {
+		scanPolygon(pg, 0, _h);
+		_points.resize(pg.firstPoint);
+	}
+}
+
+// Draws the rows [clipY1, clipY2[ of the polygon, within [0, _h[
+void HiresRenderer::scanPolygon(const Polygon &pg, int32_t clipY1, int32_t clipY2) const {
+	if (pg.numPoints == 0) {
+		const int32_t y2 = MIN(pg.y + _scale, clipY2);
+		for (int32_t y = MAX(pg.y, clipY1); y < y2; ++y) {
+			drawSpan(pg.page, y, pg.x, pg.x + _scale - 1, pg.color);
+		}
+		return;
+	}
+
+	const int32_t *pt = &_points[pg.firstPoint];
+	const uint8_t numPoints = pg.numPoints;
+	int32_t hliney = pg.y;
+	uint32_t cpt1 = (uint32_t)(pt[2 * (numPoints - 1)] + pg.x) << 16;
+	uint32_t cpt2 = (uint32_t)(pt[0] + pg.x) << 16;
+
+	uint16_t i = 1;
+	uint16_t j = numPoints - 2;
+	for (int n = numPoints - 2; n != 0; n -= 2) {
+		uint16_t h;
+		const int32_t step1 = calcStep(pt[2 * (j + 1)], pt[2 * (j + 1) + 1], pt[2 * j], pt[2 * j + 1], h);
+		const int32_t step2 = calcStep(pt[2 * (i - 1)], pt[2 * (i - 1) + 1], pt[2 * i], pt[2 * i + 1], h);
+		++i;
+		--j;
+
+		cpt1 = (cpt1 & 0xFFFF0000) | 0x7FFF;
+		cpt2 = (cpt2 & 0xFFFF0000) | 0x8000;
+
+		if (h == 0) {
+			cpt1 += step1;
+			cpt2 += step2;
+			continue;
+		}
+		for (; h != 0; --h) {
+			if (hliney >= clipY1) {
+				int32_t x1 = (int32_t)cpt1 >> 16;
+				int32_t x2 = (int32_t)cpt2 >> 16;
+				if (x1 < _w && x2 >= 0) {
+					if (x1 < 0) x1 = 0;
+					if (x2 > _w - 1) x2 = _w - 1;
+					drawSpan(pg.page, hliney, x1, x2, pg.color);
+				}
+			}
+			cpt1 += step1;
+			cpt2 += step2;
+			++hliney;
+			if (hliney >= clipY2) {
+				return;
+			}
+		}
+	}
+}
+
+void HiresRenderer::clearPolygons() {
+	_polygons.clear();
+	_points.clear();
+}
+
+// 16.16 step of x per row, as Video::calcStep()
+int32_t HiresRenderer::calcStep(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t &dy) const {
+	dy = y2 - y1;
+	return ((int64_t)(x2 - x1) * _interpTable[MIN((int)dy, MAX_DY - 1)]) >> 8;
+}
+
+// Same color modes as Video::drawLineN(), drawLineBlend() and drawLineP()
+void HiresRenderer::drawSpan(uint8_t page, int32_t y, int32_t x1, int32_t x2, uint8_t color) const {
+	const int32_t xmin = MIN(x1, x2);
+	const int32_t w = MAX(x1, x2) - xmin + 1;
+	uint8_t *dst = _pages[page] + y * _w + xmin;
+	if (color < 0x10) {
+		memset(dst, color, w);
+	} else if (color == 0x10) {
+		for (int32_t i = 0; i < w; ++i) {
+			dst[i] |= 0x08;
+		}
+	} else if (page != 0) {
+		memcpy(dst, _pages[0] + y * _w + xmin, w);
+	}
+}
+
+// x is in 8 pixels columns, as Video::drawChar(), which checks the bounds
+void HiresRenderer::drawChar(uint8_t page, const uint8_t *glyph, uint16_t x, uint16_t y, uint8_t color) {
+	for (int j = 0; j < 8; ++j) {
+		const uint8_t ch = glyph[j];
+		for (int i = 0; i < 8; ++i) {
+			if (ch & (0x80 >> i)) {
+				const int32_t px = (x * 8 + i) * _scale;
+				for (int k = 0; k < _scale; ++k) {
+					memset(_pages[page] + ((y + j) * _scale + k) * _w + px, color & 0xF, _scale);
+				}
+			}
+		}
+	}
+}
+
+void HiresRenderer::fillPage(uint8_t page, uint8_t color) {
+	memset(_pages[page], color & 0xF, _w * _h);
+}
+
+void HiresRenderer::fillRows(uint8_t page, uint8_t color, int32_t y1, int32_t y2) {
+	memset(_pages[page] + y1 * _w, color & 0xF, (y2 - y1) * _w);
+}
+
+void HiresRenderer::copyPage(uint8_t src, uint8_t dst, int16_t vscroll) {
+	const uint8_t *p = _pages[src];
+	uint8_t *q = _pages[dst];
+	const int32_t dy = vscroll * _scale;
+	int32_t h = _h;
+	if (dy < 0) {
+		h += dy;
+		p += -dy * _w;
+	} else {
+		h -= dy;
+		q += dy * _w;
+	}
+	memmove(q, p, h * _w);
+}
+
+void HiresRenderer::copyRows(uint8_t src, uint8_t dst, int32_t y1, int32_t y2) {
+	memcpy(_pages[dst] + y1 * _w, _pages[src] + y1 * _w, (y2 - y1) * _w);
+}
+
+// Nearest neighbour upscaling of a 4bpp page
+void HiresRenderer::upscalePage(uint8_t page, const uint8_t *src) {
+	uint8_t *dst = _pages[page];
+	for (int y = 0; y < 200; ++y) {
+		for (int x = 0; x < 320; ++x) {
+			const uint8_t b = src[x / 2];
+			memset(dst + x * _scale, (x & 1) ? (b & 0xF) : (b >> 4), _scale);
+		}
+		for (int k = 1; k < _scale; ++k) {
+			memcpy(dst + k * _w, dst, _w);
+		}
+		src += 160;
+		dst += _scale * _w;
+	}
+}
@@ -0,0 +1,88 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __HIRES_H__
+#define __HIRES_H__
+
+#include <vector>
+#include "intern.h"
+
+/*
+	Optional high resolution renderer, see Video::setHiresScale(). It does
+	the same drawing operations as the 4bpp pages, at _scale times their
+	resolution, into 8bpp pages holding one color index per pixel. The
+	polygons are read again from the shape data, with their vertices zoomed
+	at the higher resolution, and their edges are stepped with a reciprocal
+	table of 24 fractional bits instead of 14.
+
+	The 4bpp pages remain the reference for the game states, the snapshots
+	and the frame hashes, the high resolution pages are only displayed. They
+	are upscaled from the 4bpp pages whenever these are restored.
+
+	In the deferred mode of the Video, the polygons of drawShape() are queued
+	in _polygons instead, then scanned by Video::rasterizeRows() on the rows
+	of each band, like the 4bpp ones.
+*/
+struct HiresRenderer {
+	enum {
+		MAX_SCALE = 4,
+		MAX_POINTS = 50,
+		MAX_DY = 0x400 * MAX_SCALE
+	};
+
+	// A polygon of drawShape(), its points are in _points
+	struct Polygon {
+		uint8_t page;
+		uint8_t color;
+		uint8_t numPoints; // 0 for a point of the 4bpp renderer, _scale pixels wide
+		int32_t x, y;      // top left corner of the bounding box
+		int32_t height;    // rows scanned from y
+		uint32_t firstPoint;
+	};
+
+	uint8_t _scale; // 0 when disabled
+	uint16_t _w, _h;
+	uint8_t *_pages[4];
+	uint32_t _interpTable[MAX_DY];
+
+	bool _deferred;
+	std::vector<Polygon> _polygons;
+	std::vector<int32_t> _points; // x, y pairs
+
+	HiresRenderer();
+
+	bool init(uint8_t scale);
+	void free();
+	bool enabled() const { return _scale != 0; }
+
+	void drawShape(uint8_t page, const uint8_t *dataBuf, uint32_t offset, uint8_t color, uint16_t zoom, int32_t x, int32_t y);
+	void fillPolygon(uint8_t page, const uint8_t *p, uint8_t color, uint16_t zoom, int32_t x, int32_t y);
+	void scanPolygon(const Polygon &pg, int32_t clipY1, int32_t clipY2) const;
+	void clearPolygons();
+	int32_t calcStep(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t &dy) const;
+	void drawSpan(uint8_t page, int32_t y, int32_t x1, int32_t x2, uint8_t color) const;
+	void drawChar(uint8_t page, const uint8_t *glyph, uint16_t x, uint16_t y, uint8_t color);
+	void fillPage(uint8_t page, uint8_t color);
+	void fillRows(uint8_t page, uint8_t color, int32_t y1, int32_t y2);
+	void copyPage(uint8_t src, uint8_t dst, int16_t vscroll);
+	void copyRows(uint8_t src, uint8_t dst, int32_t y1, int32_t y2);
+	void upscalePage(uint8_t page, const uint8_t *src);
+};
+
+#endif
@@ -16,17 +16,47 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
+#include <cerrno>
+#include <ctime>
 #include <memory>
+#include <thread>
+#include <vector>
+#include "batch.h"
 #include "engine.h"
+#include "framehash.h"
+#include "replay.h"
 #include "sys.h"
 #include "util.h"
+#include "wav.h"
 
 
 static const char *USAGE = 
 	"Raw - Another World Interpreter\n"
 	"Usage: raw [OPTIONS]...\n"
 	"  --datapath=PATH   Path to where the game is installed (default './assets')\n"
-	"  --savepath=PATH   Path to where the save files are stored (default './assets')\n";
+	"  --savepath=PATH   Path to where the save files are stored (default './assets')\n"
+	"  --headless        Run without display nor sound device, on a virtual clock\n"
+	"  --turbo           Do not wait between frames (implies --headless)\n"
+	"  --seed=N          Initial value of the random seed (default current time)\n"
+	"  --record=NAME     Record the player inputs to file NAME in the save path\n"
+	"  --replay=NAME     Play back the player inputs from file NAME in the save path\n"
+	"  --hash-record=NAME Write the hash of each displayed frame to file NAME in the save path\n"
+	"  --hash-check=NAME Compare the hash of each displayed frame to file NAME, report the first diverging one\n"
+	"  --batch=N         Play all the --replay files at once on N threads, 0 for one per core (implies --turbo)\n"
+	"  --threaded-vm     Run the bytecode pre-decoded, with threaded dispatch\n"
+	"  --no-polycache    Do not cache the flattened polygon shapes\n"
+	"  --raster-threads=N Draw each frame at once, split in bands of rows, on N threads (default 0, drawn inline)\n"
+	"  --hires=N         Draw and display the frames at N times their resolution, 1 to 4 (default 0, off)\n"
+	"  --frame-skip      Do not display the frames which are late by a whole frame, to catch up on slow hosts\n"
+	"  --audio-sequencer Play the music rows from the mixer, on the audio clock\n"
+	"  --audio-rate=N    Output sample rate, 22050, 44100 or 48000 (default 22050)\n"
+	"  --audio-bits=N    Output sample size, 8 or 16 (default 8)\n"
+	"  --rescache=KB     Size of the unpacked resources cache, 0 to disable (default 4096)\n"
+	"  --no-prefetch     Do not unpack the resources of the current and next game parts on a worker thread\n"
+	"  --archive=NAME    Read the resources from archive NAME in the data path\n"
+	"  --memsize=KB      Size of the memory block of the game resources (default 600)\n"
+	"  --rewind=SECONDS  Length of the game history kept for the rewind key, about 3 MB per second, 0 to disable (default 0)\n"
+	"  --wav=NAME        Write the sound output to file NAME in the save path (implies --headless)\n";
 
 static bool parseOption(const char *arg, const char *longCmd, const char **opt) {
 	bool ret = false;
@@ -39,8 +69,27 @@ static bool parseOption(const char *arg, const char *longCmd, const char **opt)
 	return ret;
 }
 
-static int run(System *system, const char *dataPath, const char *savePath) {
-	const std::unique_ptr<Engine> engine(new Engine(system, dataPath, savePath));
+static bool parseFlag(const char *arg, const char *longCmd) {
+	return (arg[0] == '-' && arg[1] == '-' && strcmp(arg + 2, longCmd) == 0);
+}
+
+// A size in KB, without a sign and small enough to be stored in bytes in 32 bits
+static bool parseKilobytes(const char *str, uint32_t *bytes) {
+	if (str[0] < '0' || str[0] > '9') {
+		return false;
+	}
+	char *end;
+	errno = 0;
+	const unsigned long kb = strtoul(str, &end, 10);
+	if (errno != 0 || *end != '\0' || kb > 0xFFFFFFFF / 1024) {
+		return false;
+	}
+	*bytes = kb * 1024;
+	return true;
+}
+
+static int run(System *system, const char *dataPath, const char *savePath, const EngineOptions &options) {
+	const std::unique_ptr<Engine> engine(new Engine(system, dataPath, savePath, options));
 	if(engine) {
 		engine->run();
 	}
@@ -51,8 +100,8 @@ static int run(System *system, const char *dataPath, const char *savePath) {
 	We use here a design pattern found in Doom3:
 	An Abstract Class pointer pointing to the implementation on the Heap.
 */
-//extern System *System_SDL_create();
-extern System *stub ;//= System_SDL_create();
+extern System *System_SDL_create();
+extern System *System_Headless_create(bool turbo);
 
 #ifdef main
 #undef main
@@ -61,12 +110,85 @@ extern System *stub ;//= System_SDL_create();
 int main(int argc, char *argv[]) {
 	const char *dataPath = "./assets";
 	const char *savePath = "./assets";
+	const char *seed = 0;
+	const char *recordName = 0;
+	const char *replayName = 0;
+	std::vector<const char *> replayNames;
+	const char *batchThreads = 0;
+	const char *hashRecordName = 0;
+	const char *hashCheckName = 0;
+	const char *audioRate = 0;
+	const char *audioBits = 0;
+	const char *wavName = 0;
+	const char *resCacheSize = 0;
+#ifdef DEFAULT_ARCHIVE
+	const char *archiveName = DEFAULT_ARCHIVE;
+#else
+	const char *archiveName = 0;
+#endif
+	const char *memorySize = 0;
+	const char *rewindSeconds = 0;
+	const char *rasterThreads = 0;
+	const char *hiresScale = 0;
+	bool headless = false;
+	bool turbo = false;
+	bool threadedVm = false;
+	bool frameSkip = false;
+	bool polygonCache = true;
+#ifdef DEFAULT_AUDIO_SEQUENCER
+	bool audioSequencer = true;
+#else
+	bool audioSequencer = false;
+#endif
+	bool prefetch = true;
 	for (int i = 1; i < argc; ++i) {
 		bool opt = false;
 		if (strlen(argv[i]) >= 2) {
 			opt |= parseOption(argv[i], "datapath=", &dataPath);
 			opt |= parseOption(argv[i], "savepath=", &savePath);
-
+			opt |= parseOption(argv[i], "seed=", &seed);
+			opt |= parseOption(argv[i], "record=", &recordName);
+			if (parseOption(argv[i], "replay=", &replayName)) {
+				replayNames.push_back(replayName);
+				opt = true;
+			}
+			opt |= parseOption(argv[i], "batch=", &batchThreads);
+			opt |= parseOption(argv[i], "hash-record=", &hashRecordName);
+			opt |= parseOption(argv[i], "hash-check=", &hashCheckName);
+			opt |= parseOption(argv[i], "audio-rate=", &audioRate);
+			opt |= parseOption(argv[i], "audio-bits=", &audioBits);
+			opt |= parseOption(argv[i], "rescache=", &resCacheSize);
+			opt |= parseOption(argv[i], "archive=", &archiveName);
+			opt |= parseOption(argv[i], "memsize=", &memorySize);
+			opt |= parseOption(argv[i], "rewind=", &rewindSeconds);
+			opt |= parseOption(argv[i], "raster-threads=", &rasterThreads);
+			opt |= parseOption(argv[i], "hires=", &hiresScale);
+			if (parseOption(argv[i], "wav=", &wavName)) {
+				headless = opt = true;
+			}
+			if (parseFlag(argv[i], "headless")) {
+				headless = opt = true;
+			}
+			if (parseFlag(argv[i], "turbo")) {
+				headless = turbo = opt = true;
+			}
+			if (parseFlag(argv[i], "threaded-vm")) {
+				threadedVm = opt = true;
+			}
+			if (parseFlag(argv[i], "frame-skip")) {
+				frameSkip = opt = true;
+			}
+			if (parseFlag(argv[i], "no-polycache")) {
+				polygonCache = false;
+				opt = true;
+			}
+			if (parseFlag(argv[i], "no-prefetch")) {
+				prefetch = false;
+				opt = true;
+			}
+			if (parseFlag(argv[i], "audio-sequencer")) {
+				audioSequencer = opt = true;
+			}
 		}
 		if (!opt) {
 			printf("%s",USAGE);
@@ -77,7 +199,124 @@ int main(int argc, char *argv[]) {
 	//g_debugMask = DBG_INFO; // DBG_VM | DBG_BANK | DBG_VIDEO | DBG_SER | DBG_SND
 	//g_debugMask = 0 ;//DBG_INFO |  DBG_VM | DBG_BANK | DBG_VIDEO | DBG_SER | DBG_SND ;
 
-	return run(stub, dataPath, savePath);
+	EngineOptions options;
+	options.randomSeed = (seed != 0) ? atoi(seed) : time(0);
+	options.threadedVm = threadedVm;
+	options.frameSkip = frameSkip;
+	options.polygonCache = polygonCache;
+	options.audioSequencer = audioSequencer;
+	options.prefetch = prefetch;
+	options.archive = archiveName;
+	if (audioRate != 0) {
+		options.audioSampleRate = atoi(audioRate);
+		if (options.audioSampleRate != 22050 && options.audioSampleRate != 44100 && options.audioSampleRate != 48000) {
+			printf("%s",USAGE);
+			return 0;
+		}
+	}
+	if (audioBits != 0) {
+		options.audioSampleBits = atoi(audioBits);
+		if (options.audioSampleBits != 8 && options.audioSampleBits != 16) {
+			printf("%s",USAGE);
+			return 0;
+		}
+	}
+	if (resCacheSize != 0) {
+		if (!parseKilobytes(resCacheSize, &options.resourceCacheSize)) {
+			printf("%s",USAGE);
+			return 0;
+		}
+	}
+	if (memorySize != 0) {
+		if (!parseKilobytes(memorySize, &options.memorySize) || options.memorySize <= MemArena::VIDEO_SIZE) {
+			printf("%s",USAGE);
+			return 0;
+		}
+	}
+	if (rewindSeconds != 0) {
+		options.rewindSeconds = atoi(rewindSeconds);
+	}
+	if (rasterThreads != 0) {
+		options.rasterThreads = atoi(rasterThreads);
+	}
+	if (hiresScale != 0) {
+		const int scale = atoi(hiresScale);
+		if (scale < 0 || scale > HiresRenderer::MAX_SCALE) {
+			printf("%s",USAGE);
+			return 0;
+		}
+		options.hiresScale = scale;
+	}
+
+	if (batchThreads != 0) {
+		if (replayNames.empty() || recordName || wavName || hashRecordName || hashCheckName) {
+			printf("%s",USAGE);
+			return 0;
+		}
+		uint32_t numThreads = atoi(batchThreads);
+		if (numThreads == 0) {
+			numThreads = MAX(std::thread::hardware_concurrency(), 1u);
+		}
+		BatchRunner batch(dataPath, savePath, options);
+		for (size_t i = 0; i < replayNames.size(); ++i) {
+			batch.addJob(replayNames[i]);
+		}
+		return batch.run(numThreads) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// the hashes are only meaningful for a replayed session
+	FrameHasher frameHasher;
+	if (hashRecordName || hashCheckName) {
+		if (hashRecordName && hashCheckName) {
+			printf("%s",USAGE);
+			return 0;
+		}
+		if (hashRecordName && !frameHasher.open(hashRecordName, savePath, FrameHasher::MODE_RECORD)) {
+			return 1;
+		}
+		if (hashCheckName && !frameHasher.open(hashCheckName, savePath, FrameHasher::MODE_CHECK)) {
+			return 1;
+		}
+		options.frameHasher = &frameHasher;
+	}
+
+	const std::unique_ptr<System> baseSystem(headless ? System_Headless_create(turbo) : System_SDL_create());
+	System *system = baseSystem.get();
+
+	std::unique_ptr<WavRecorder> wavRecorder;
+	if (wavName) {
+		wavRecorder.reset(new WavRecorder(system));
+		if (!wavRecorder->open(wavName, savePath)) {
+			return 1;
+		}
+		system = wavRecorder.get();
+	}
+
+	// the replayed session seed overrides the one from the command line
+	std::unique_ptr<ReplayPlayer> replayPlayer;
+	if (replayName) {
+		replayPlayer.reset(new ReplayPlayer(system));
+		if (!replayPlayer->open(replayName, savePath)) {
+			return 1;
+		}
+		options.randomSeed = replayPlayer->_randomSeed;
+		system = replayPlayer.get();
+	}
+
+	std::unique_ptr<ReplayRecorder> replayRecorder;
+	if (recordName) {
+		replayRecorder.reset(new ReplayRecorder(system));
+		if (!replayRecorder->open(recordName, savePath, options.randomSeed)) {
+			return 1;
+		}
+		system = replayRecorder.get();
+	}
+
+	const int ret = run(system, dataPath, savePath, options);
+	if (options.frameHasher && !frameHasher.finish()) {
+		return EXIT_FAILURE;
+	}
+	return ret;
 }
 
 
@@ -18,145 +18,404 @@
 
 #include "mixer.h"
 #include "serializer.h"
+#include "sfxplayer.h"
 #include "sys.h"
 
 
-static int8_t addclamp(int a, int b) {
-	int add = a + b;
-	if (add < -128) {
-		add = -128;
+static inline int32_t clip(int32_t x, int32_t lo, int32_t hi) {
+	return (x < lo) ? lo : (x > hi) ? hi : x;
+}
+
+
+void MixerCommandQueue::reset() {
+	for (uint32_t i = 0; i < SIZE; ++i) {
+		_slots[i].seq.store(i, std::memory_order_relaxed);
 	}
-	else if (add > 127) {
-		add = 127;
+	_pushPos.store(0, std::memory_order_relaxed);
+	_popPos = 0;
+}
+
+/*
+	Each slot holds a sequence number: pos when it is free for the push at pos,
+	pos + 1 once the command is written, pos + SIZE once it has been popped.
+*/
+bool MixerCommandQueue::push(const MixerCommand &cmd) {
+	uint32_t pos = _pushPos.load(std::memory_order_relaxed);
+	Slot *slot;
+	while (1) {
+		slot = &_slots[pos & (SIZE - 1)];
+		const uint32_t seq = slot->seq.load(std::memory_order_acquire);
+		const int32_t diff = (int32_t)(seq - pos);
+		if (diff == 0) {
+			if (_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = _pushPos.load(std::memory_order_relaxed);
+		}
 	}
-	return (int8_t)add;
+	slot->cmd = cmd;
+	slot->seq.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+bool MixerCommandQueue::pop(MixerCommand &cmd) {
+	Slot *slot = &_slots[_popPos & (SIZE - 1)];
+	const uint32_t seq = slot->seq.load(std::memory_order_acquire);
+	if ((int32_t)(seq - (_popPos + 1)) < 0) {
+		return false;
+	}
+	cmd = slot->cmd;
+	slot->seq.store(_popPos + SIZE, std::memory_order_release);
+	++_popPos;
+	return true;
 }
 
 Mixer::Mixer(System *stub) 
-	: sys(stub) {
+	: sys(stub), _sampleRate(22050), _sampleBits(8), _overflowed(false), _snapshotSeq(0), _sequencer(0) {
+#ifdef ENABLE_PROFILER
+	_profiler = 0;
+#endif
 }
 
 void Mixer::init() {
 	memset(_channels, 0, sizeof(_channels));
-	_mutex = sys->createMutex();
-	sys->startAudio(Mixer::mixCallback, this);
+	memset(_snapshot, 0, sizeof(_snapshot));
+	_queue.reset();
+	_overflow.clear();
+	_overflowed = false;
+	sys->startAudio(Mixer::mixCallback, this, _sampleRate, _sampleBits);
 }
 
 void Mixer::free() {
 	stopAll();
 	sys->stopAudio();
-	sys->destroyMutex(_mutex);
 }
 
 void Mixer::playChannel(uint8_t channel, const MixerChunk *mc, uint16_t freq, uint8_t volume) {
 	debug(DBG_SND, "Mixer::playChannel(%d, %d, %d)", channel, freq, volume);
 	assert(channel < AUDIO_NUM_CHANNELS);
 
-	// The mutex is acquired in the constructor
-	const MutexStack lock(sys, _mutex);
-	MixerChannel *ch = &_channels[channel];
+	MixerCommand cmd;
+	cmd.type = MixerCommand::CMD_PLAY;
+	cmd.channel = channel;
+	MixerChannel *ch = &cmd.state;
 	ch->active = true;
 	ch->volume = volume;
 	ch->chunk = *mc;
 	ch->chunkPos = 0;
-	ch->chunkInc = (freq << 8) / sys->getOutputSampleRate();
-
-	//At the end of the scope the MutexStack destructor is called and the mutex is released. 
+	ch->chunkInc = ((uint64_t)freq << FRAC_BITS) / sys->getOutputSampleRate();
+	sendCommand(cmd);
 }
 
 void Mixer::stopChannel(uint8_t channel) {
 	debug(DBG_SND, "Mixer::stopChannel(%d)", channel);
 	assert(channel < AUDIO_NUM_CHANNELS);
-	const MutexStack lock(sys, _mutex);	
-	_channels[channel].active = false;
+	MixerCommand cmd;
+	cmd.type = MixerCommand::CMD_STOP;
+	cmd.channel = channel;
+	sendCommand(cmd);
 }
 
 void Mixer::setChannelVolume(uint8_t channel, uint8_t volume) {
 	debug(DBG_SND, "Mixer::setChannelVolume(%d, %d)", channel, volume);
 	assert(channel < AUDIO_NUM_CHANNELS);
-	const MutexStack lock(sys, _mutex);
-	_channels[channel].volume = volume;
+	MixerCommand cmd;
+	cmd.type = MixerCommand::CMD_SET_VOLUME;
+	cmd.channel = channel;
+	cmd.state.volume = volume;
+	sendCommand(cmd);
 }
 
 void Mixer::stopAll() {
 	debug(DBG_SND, "Mixer::stopAll()");
-	const MutexStack lock(sys, _mutex);
-	for (uint8_t i = 0; i < AUDIO_NUM_CHANNELS; ++i) {
-		_channels[i].active = false;		
+	MixerCommand cmd;
+	cmd.type = MixerCommand::CMD_STOP_ALL;
+	cmd.channel = 0;
+	sendCommand(cmd);
+}
+
+// Once a command went to the overflow, the next ones follow it there to keep their order
+void Mixer::sendCommand(const MixerCommand &cmd) {
+	if (_overflowed.load(std::memory_order_acquire) || !_queue.push(cmd)) {
+		sendOverflowCommand(cmd);
 	}
 }
 
-// This is SDL callback. Called in order to populate the buf with len bytes.  
-// The mixer iterates through all active channels and combine all sounds.
+static bool isChannelCommand(const MixerCommand &cmd) {
+	return cmd.type <= MixerCommand::CMD_RESTORE;
+}
 
-// Since there is no way to know when SDL will ask for a buffer fill, we need
-// to synchronize with a mutex so the channels remain stable during the execution
-// of this method.
-void Mixer::mix(int8_t *buf, int len) {
-	int8_t *pBuf;
+/*
+	The overflow only keeps the last state of each channel, so that its size
+	stays bounded however long the audio device is stalled. CMD_STOP_ALL
+	replaces all the channel commands, CMD_PLAY, CMD_STOP and CMD_RESTORE the
+	ones of their channel, and CMD_SET_VOLUME is merged into the CMD_PLAY or
+	CMD_RESTORE of its channel. CMD_MUSIC_RESTORE replaces all the music
+	commands and CMD_MUSIC_DELAY a CMD_MUSIC_DELAY just before it.
+*/
+void Mixer::sendOverflowCommand(const MixerCommand &cmd) {
+	std::lock_guard<std::mutex> lock(_overflowMutex);
+	if (_overflow.empty()) {
+		debug(DBG_SND, "Mixer::sendCommand() queue full, the commands are coalesced");
+	}
+	if (isChannelCommand(cmd)) {
+		for (size_t i = 0; i < _overflow.size(); ) {
+			MixerCommand &prev = _overflow[i];
+			if (isChannelCommand(prev) && (cmd.type == MixerCommand::CMD_STOP_ALL || (prev.type != MixerCommand::CMD_STOP_ALL && prev.channel == cmd.channel))) {
+				if (cmd.type == MixerCommand::CMD_SET_VOLUME && (prev.type == MixerCommand::CMD_PLAY || prev.type == MixerCommand::CMD_RESTORE)) {
+					prev.state.volume = cmd.state.volume;
+					return;
+				}
+				if (cmd.type != MixerCommand::CMD_SET_VOLUME || prev.type == MixerCommand::CMD_SET_VOLUME) {
+					_overflow.erase(_overflow.begin() + i);
+					continue;
+				}
+			}
+			++i;
+		}
+	} else if (cmd.type == MixerCommand::CMD_MUSIC_RESTORE) {
+		for (size_t i = 0; i < _overflow.size(); ) {
+			if (!isChannelCommand(_overflow[i])) {
+				_overflow.erase(_overflow.begin() + i);
+			} else {
+				++i;
+			}
+		}
+	} else if (cmd.type == MixerCommand::CMD_MUSIC_DELAY && !_overflow.empty() && _overflow.back().type == MixerCommand::CMD_MUSIC_DELAY) {
+		_overflow.back() = cmd;
+		return;
+	}
+	_overflow.push_back(cmd);
+	_overflowed.store(true, std::memory_order_release);
+}
+
+void Mixer::applyCommand(const MixerCommand &cmd) {
+	switch (cmd.type) {
+	case MixerCommand::CMD_PLAY:
+	case MixerCommand::CMD_RESTORE:
+		_channels[cmd.channel] = cmd.state;
+		break;
+	case MixerCommand::CMD_STOP:
+		_channels[cmd.channel].active = false;
+		break;
+	case MixerCommand::CMD_SET_VOLUME:
+		_channels[cmd.channel].volume = cmd.state.volume;
+		break;
+	case MixerCommand::CMD_STOP_ALL:
+		for (uint8_t i = 0; i < AUDIO_NUM_CHANNELS; ++i) {
+			_channels[i].active = false;
+		}
+		break;
+	case MixerCommand::CMD_MUSIC_LOAD:
+	case MixerCommand::CMD_MUSIC_START:
+	case MixerCommand::CMD_MUSIC_STOP:
+	case MixerCommand::CMD_MUSIC_DELAY:
+	case MixerCommand::CMD_MUSIC_RESTORE:
+		if (_sequencer) {
+			_sequencer->processCommand(cmd);
+		}
+		break;
+	}
+}
+
+// Called from the audio thread only
+void Mixer::processCommands() {
+	MixerCommand cmd;
+	while (_queue.pop(cmd)) {
+		applyCommand(cmd);
+	}
+	if (_overflowed.load(std::memory_order_acquire)) {
+		std::vector<MixerCommand> overflow;
+		{
+			std::lock_guard<std::mutex> lock(_overflowMutex);
+			overflow.swap(_overflow);
+			_overflowed.store(false, std::memory_order_release);
+		}
+		for (size_t i = 0; i < overflow.size(); ++i) {
+			applyCommand(overflow[i]);
+		}
+	}
+}
+
+/*
+	Mixes the channel until the end of the buffer or of its chunk, returns the
+	number of samples done. The samples before the loop or end boundary are run
+	without any test, the boundary one is handled on its own.
+*/
+int Mixer::mixChannel(MixerChannel *ch, int32_t *buf, int len) {
+	const MixerChunk *chunk = &ch->chunk;
+	const bool loop = (chunk->loopLen != 0);
+	if (!loop && chunk->len < 2) {
+		ch->active = false;
+		return len;
+	}
+	const uint32_t last = loop ? chunk->loopPos + chunk->loopLen - 1 : chunk->len - 1;
+	const uint32_t lastPos = last << FRAC_BITS;
+	const uint32_t inc = ch->chunkInc;
+	int count = len;
+	if (ch->chunkPos >= lastPos) {
+		count = 0;
+	} else if (inc != 0) {
+		count = (int)MIN((uint64_t)len, ((uint64_t)lastPos - ch->chunkPos + inc - 1) / inc);
+	}
 
-	const MutexStack lock(sys, _mutex);
+	const int8_t *data = (const int8_t *)chunk->data;
+	const int32_t volume = ch->volume;
+	uint32_t pos = ch->chunkPos;
+	for (int j = 0; j < count; ++j) {
+		const uint32_t p = pos >> FRAC_BITS;
+		const int32_t ilc = (pos >> (FRAC_BITS - 8)) & 0xFF;
+		const int32_t b1 = data[p];
+		const int32_t b2 = data[p + 1];
+		// interpolate and set the volume, 0x40 being the max
+		buf[j] += (((b1 << 8) + (b2 - b1) * ilc) * volume) >> 6;
+		pos += inc;
+	}
+	ch->chunkPos = pos;
+	if (count == len) {
+		return count;
+	}
 
-	//Clear the buffer since nothing garanty we are receiving clean memory.
-	memset(buf, 0, len);
+	if (loop) {
+		debug(DBG_SND, "Looping sample on channel %d", (int)(ch - _channels));
+		const int32_t ilc = (pos >> (FRAC_BITS - 8)) & 0xFF;
+		const int32_t b1 = data[last];
+		const int32_t b2 = data[chunk->loopPos];
+		buf[count] += (((b1 << 8) + (b2 - b1) * ilc) * volume) >> 6;
+		ch->chunkPos = chunk->loopPos << FRAC_BITS;
+		return count + 1;
+	}
+	debug(DBG_SND, "Stopping sample on channel %d", (int)(ch - _channels));
+	ch->active = false;
+	return len;
+}
 
+void Mixer::mixChannels(int32_t *buf, int len) {
 	for (uint8_t i = 0; i < AUDIO_NUM_CHANNELS; ++i) {
 		MixerChannel *ch = &_channels[i];
-		if (!ch->active) 
-			continue;
+		int pos = 0;
+		while (ch->active && pos < len) {
+			pos += mixChannel(ch, buf + pos, len - pos);
+		}
+	}
+}
 
-		pBuf = buf;
-		for (int j = 0; j < len; ++j, ++pBuf) {
+// With the audio sequencer, the block is mixed in segments ending on the music
+// rows, the notes of a row hence start on the exact sample whatever the latency
+// of the audio device or the load of the host.
+void Mixer::mixBlock(int len) {
+	memset(_mixBuf, 0, len * sizeof(int32_t));
+	if (_sequencer) {
+		int pos = 0;
+		while (pos < len) {
+			const int count = _sequencer->processRows(len - pos);
+			processCommands();
+			mixChannels(_mixBuf + pos, count);
+			_sequencer->consumeSamples(count);
+			pos += count;
+		}
+	} else {
+		mixChannels(_mixBuf, len);
+	}
+}
 
-			uint16_t p1, p2;
-			uint16_t ilc = (ch->chunkPos & 0xFF);
-			p1 = ch->chunkPos >> 8;
-			ch->chunkPos += ch->chunkInc;
+// This is SDL callback. Called in order to populate the buf with len bytes.  
+// The mixer iterates through all active channels and combine all sounds.
 
-			if (ch->chunk.loopLen != 0) {
-				if (p1 == ch->chunk.loopPos + ch->chunk.loopLen - 1) {
-					debug(DBG_SND, "Looping sample on channel %d", i);
-					ch->chunkPos = p2 = ch->chunk.loopPos;
-				} else {
-					p2 = p1 + 1;
-				}
-			} else {
-				if (p1 == ch->chunk.len - 1) {
-					debug(DBG_SND, "Stopping sample on channel %d", i);
-					ch->active = false;
-					break;
-				} else {
-					p2 = p1 + 1;
-				}
-			}
-			// interpolate
-			int8_t b1 = *(int8_t *)(ch->chunk.data + p1);
-			int8_t b2 = *(int8_t *)(ch->chunk.data + p2);
-			int8_t b = (int8_t)((b1 * (0xFF - ilc) + b2 * ilc) >> 8);
+// Since there is no way to know when SDL will ask for a buffer fill, the
+// channels are only updated here, from the commands queued since the last call.
+
+// The samples are clamped and converted to the output format once all the
+// channels are summed, in _mixBuf sized blocks.
+void Mixer::mix(uint8_t *buf, int len) {
+	PROFILE_START(mixStart);
+
+	processCommands();
 
-			// set volume and clamp
-			*pBuf = addclamp(*pBuf, (int)b * ch->volume / 0x40);  //0x40=64
+	const int samples = (_sampleBits == 16) ? len / 2 : len;
+	for (int pos = 0; pos < samples; ) {
+		const int count = MIN(samples - pos, (int)MIX_BUFFER_SIZE);
+		mixBlock(count);
+		if (_sampleBits == 16) {
+			int16_t *out = (int16_t *)buf + pos;
+			for (int j = 0; j < count; ++j) {
+				out[j] = (int16_t)clip(_mixBuf[j], -32768, 32767);
+			}
+		} else {
+			// Unsigned 8-bit PCM, the current version of SDL hangs when using
+			// signed 8-bit PCM in combination with the PulseAudio driver.
+			uint8_t *out = buf + pos;
+			for (int j = 0; j < count; ++j) {
+				out[j] = (uint8_t)(clip(_mixBuf[j] >> 8, -128, 127) + 128);
+			}
 		}
-		
+		pos += count;
 	}
-
-	// Convert signed 8-bit PCM to unsigned 8-bit PCM. The
-	// current version of SDL hangs when using signed 8-bit
-	// PCM in combination with the PulseAudio driver.
-	pBuf = buf;
-	for (int j = 0; j < len; ++j, ++pBuf) {
-		*(uint8_t *)pBuf = (*pBuf + 128);
+	if (_sequencer) {
+		_sequencer->publishSnapshot();
 	}
+
+	_snapshotSeq.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(_snapshot, _channels, sizeof(_snapshot));
+	_snapshotSeq.fetch_add(1, std::memory_order_release);
+
+	PROFILE_MIX(_profiler, samples, mixStart);
 }
 
 void Mixer::mixCallback(void *param, uint8_t *buf, int len) {
-	((Mixer *)param)->mix((int8_t *)buf, len);
+	((Mixer *)param)->mix(buf, len);
+}
+
+/*
+	The channels saved are the ones of the last mixed buffer, the loaded ones
+	are sent to the audio thread like the other commands.
+
+	The positions are kept in the 8.8 fixed point of the first versions, and
+	the increments for an output at SAVE_SAMPLE_RATE, so the savegames do not
+	depend on the output format.
+*/
+void Mixer::captureState(State &st) {
+	while (1) {
+		const uint32_t seq = _snapshotSeq.load(std::memory_order_acquire);
+		if (seq & 1) {
+			continue;
+		}
+		memcpy(st.channels, _snapshot, sizeof(st.channels));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (_snapshotSeq.load(std::memory_order_relaxed) == seq) {
+			break;
+		}
+	}
+}
+
+void Mixer::restoreState(const State &st) {
+	for (int i = 0; i < AUDIO_NUM_CHANNELS; ++i) {
+		MixerCommand cmd;
+		cmd.type = MixerCommand::CMD_RESTORE;
+		cmd.channel = i;
+		cmd.state = st.channels[i];
+		sendCommand(cmd);
+	}
 }
 
 void Mixer::saveOrLoad(Serializer &ser) {
-	const MutexStack lock(sys, _mutex);
+	State st;
+	MixerChannel *channels = st.channels;
+	if (ser._mode == Serializer::SM_SAVE) {
+		captureState(st);
+		for (int i = 0; i < AUDIO_NUM_CHANNELS; ++i) {
+			channels[i].chunkPos >>= FRAC_BITS - 8;
+			channels[i].chunkInc = ((uint64_t)channels[i].chunkInc * sys->getOutputSampleRate() / SAVE_SAMPLE_RATE) >> (FRAC_BITS - 8);
+		}
+	} else {
+		memset(channels, 0, sizeof(st.channels));
+	}
 	for (int i = 0; i < AUDIO_NUM_CHANNELS; ++i) {
-		MixerChannel *ch = &_channels[i];
+		MixerChannel *ch = &channels[i];
 		Serializer::Entry entries[] = {
 			SE_INT(&ch->active, Serializer::SES_BOOL, VER(2)),
 			SE_INT(&ch->volume, Serializer::SES_INT8, VER(2)),
@@ -170,4 +429,11 @@ void Mixer::saveOrLoad(Serializer &ser) {
 		};
 		ser.saveOrLoadEntries(entries);
 	}
-};
+	if (ser._mode == Serializer::SM_LOAD) {
+		for (int i = 0; i < AUDIO_NUM_CHANNELS; ++i) {
+			channels[i].chunkPos <<= FRAC_BITS - 8;
+			channels[i].chunkInc = ((uint64_t)channels[i].chunkInc << (FRAC_BITS - 8)) * SAVE_SAMPLE_RATE / sys->getOutputSampleRate();
+		}
+		restoreState(st);
+	}
+}
@@ -19,7 +19,12 @@
 #ifndef __MIXER_H__
 #define __MIXER_H__
 
+#include <atomic>
+#include <mutex>
+#include <vector>
 #include "intern.h"
+#include "profiler.h"
+#include "sfxplayer.h"
 
 struct MixerChunk {
 	const uint8_t *data;
@@ -28,6 +33,7 @@ struct MixerChunk {
 	uint16_t loopLen;
 };
 
+// chunkPos and chunkInc are 16.16 fixed point sample offsets in chunk.data
 struct MixerChannel {
 	uint8_t active;
 	uint8_t volume;
@@ -36,21 +42,104 @@ struct MixerChannel {
 	uint32_t chunkInc;
 };
 
+struct MixerCommand {
+	enum {
+		CMD_PLAY,
+		CMD_STOP,
+		CMD_SET_VOLUME,
+		CMD_STOP_ALL,
+		CMD_RESTORE,
+		CMD_MUSIC_LOAD,    // the CMD_MUSIC ones are forwarded to Mixer::_sequencer
+		CMD_MUSIC_START,
+		CMD_MUSIC_STOP,
+		CMD_MUSIC_DELAY,
+		CMD_MUSIC_RESTORE
+	};
+
+	uint8_t type;
+	uint8_t channel;
+	MixerChannel state; // CMD_PLAY, CMD_SET_VOLUME (volume only) and CMD_RESTORE
+	uint16_t resNum;    // CMD_MUSIC_LOAD and CMD_MUSIC_RESTORE
+	uint16_t delay;     // CMD_MUSIC_LOAD, CMD_MUSIC_DELAY and CMD_MUSIC_RESTORE, in ms
+	SfxModule module;   // CMD_MUSIC_LOAD and CMD_MUSIC_RESTORE, resolved by SfxPlayer::loadModule()
+};
+
+/*
+	Bounded multiple producers, single consumer (MPSC) queue. The virtual
+	machine and the SfxPlayer push the commands, Mixer::mix() pops them from
+	the audio thread. No lock is taken on either side, a full queue returns
+	false.
+*/
+struct MixerCommandQueue {
+	enum {
+		SIZE = 256 // power of 2
+	};
+
+	struct Slot {
+		std::atomic<uint32_t> seq;
+		MixerCommand cmd;
+	};
+
+	Slot _slots[SIZE];
+	std::atomic<uint32_t> _pushPos;
+	uint32_t _popPos;
+
+	void reset();
+	bool push(const MixerCommand &cmd);
+	bool pop(MixerCommand &cmd);
+};
+
 struct Serializer;
+struct SfxPlayer;
 struct System;
 
 #define AUDIO_NUM_CHANNELS 4
 
 struct Mixer {
+	enum {
+		FRAC_BITS = 16,
+		MIX_BUFFER_SIZE = 1024, // samples
+		SAVE_SAMPLE_RATE = 22050 // output rate of the savegames channels
+	};
 
+	// Channels at the output rate, converted to SAVE_SAMPLE_RATE in the savegames only
+	struct State {
+		MixerChannel channels[AUDIO_NUM_CHANNELS];
+	};
 
-	void *_mutex;
 	System *sys;
 
-	// Since the virtal machine and SDL are running simultaneously in two different threads
-	// any read or write to an elements of the sound channels MUST be synchronized with a 
-	// mutex.
+	// Output format requested to the audio device, 8 (unsigned) or 16 (signed) bits
+	uint32_t _sampleRate;
+	uint8_t _sampleBits;
+
+	// Channels are summed here before the clamping and the conversion to the output
+	// format, the samples are scaled by 256 to keep the interpolation fraction.
+	int32_t _mixBuf[MIX_BUFFER_SIZE];
+
+	// Since the virtal machine and SDL are running simultaneously in two different threads,
+	// the sound channels are only accessed from the audio thread. The other threads send
+	// commands through _queue, applied at the start of each mix() call.
 	MixerChannel _channels[AUDIO_NUM_CHANNELS];
+	MixerCommandQueue _queue;
+
+	// Commands sent while _queue is full, when the audio device is not pulling
+	// any data. They are coalesced per channel, and applied after _queue.
+	std::mutex _overflowMutex;
+	std::vector<MixerCommand> _overflow;
+	std::atomic<bool> _overflowed;
+
+	// Copy of the channels published at the end of each mix() call for the savegames,
+	// _snapshotSeq is odd while the copy is being written.
+	MixerChannel _snapshot[AUDIO_NUM_CHANNELS];
+	std::atomic<uint32_t> _snapshotSeq;
+
+	// Music sequencer run from mix(), 0 when the SfxPlayer uses a timer
+	SfxPlayer *_sequencer;
+
+#ifdef ENABLE_PROFILER
+	Profiler *_profiler;
+#endif
 
 	Mixer(System *stub);
 	void init();
@@ -60,10 +149,19 @@ struct Mixer {
 	void stopChannel(uint8_t channel);
 	void setChannelVolume(uint8_t channel, uint8_t volume);
 	void stopAll();
-	void mix(int8_t *buf, int len);
+	void sendCommand(const MixerCommand &cmd);
+	void sendOverflowCommand(const MixerCommand &cmd);
+	void applyCommand(const MixerCommand &cmd);
+	void processCommands();
+	int mixChannel(MixerChannel *ch, int32_t *buf, int len);
+	void mixChannels(int32_t *buf, int len);
+	void mixBlock(int len);
+	void mix(uint8_t *buf, int len);
 
 	static void mixCallback(void *param, uint8_t *buf, int len);
 
+	void captureState(State &st);
+	void restoreState(const State &st);
 	void saveOrLoad(Serializer &ser);
 };
 
@@ -0,0 +1,164 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+/*
+	Converts memlist.bin and the bank files to a single Archive, with the
+	resources already unpacked, to be loaded with --archive=NAME.
+*/
+
+#include <vector>
+#include "archive.h"
+#include "bank.h"
+#include "file.h"
+#include "resource.h"
+#include "util.h"
+
+static const char *USAGE =
+	"Raw - Another World Interpreter - Archive converter\n"
+	"Usage: another-world-pack [OPTIONS]...\n"
+	"  --datapath=PATH   Path to where the game is installed (default './assets')\n"
+	"  --output=NAME     Archive file name in the data path (default 'another-world.pak')\n"
+	"  --lz              Compress the resources, instead of storing them unpacked\n";
+
+static bool parseOption(const char *arg, const char *longCmd, const char **opt) {
+	bool ret = false;
+	if (arg[0] == '-' && arg[1] == '-') {
+		if (strncmp(arg + 2, longCmd, strlen(longCmd)) == 0) {
+			*opt = arg + 2 + strlen(longCmd);
+			ret = true;
+		}
+	}
+	return ret;
+}
+
+static bool parseFlag(const char *arg, const char *longCmd) {
+	return (arg[0] == '-' && arg[1] == '-' && strcmp(arg + 2, longCmd) == 0);
+}
+
+static void writeUint16BE(uint8_t *p, uint16_t n) {
+	p[0] = n >> 8;
+	p[1] = n & 255;
+}
+
+static void writeUint32BE(uint8_t *p, uint32_t n) {
+	writeUint16BE(p, n >> 16);
+	writeUint16BE(p + 2, n & 0xFFFF);
+}
+
+// the memlist.bin record, read back by Resource::readEntries()
+static void writeRecord(uint8_t *p, const MemEntry *me) {
+	p[0] = me->state;
+	p[1] = me->type;
+	writeUint16BE(p + 2, 0);
+	writeUint16BE(p + 4, me->unk4);
+	p[6] = me->rankNum;
+	p[7] = me->bankId;
+	writeUint32BE(p + 8, me->bankOffset);
+	writeUint16BE(p + 12, me->unkC);
+	writeUint16BE(p + 14, me->packedSize);
+	writeUint16BE(p + 16, me->unk10);
+	writeUint16BE(p + 18, me->size);
+}
+
+static uint32_t align(uint32_t offset) {
+	return (offset + Archive::ALIGN - 1) & ~(Archive::ALIGN - 1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *dataPath = "./assets";
+	const char *outputName = "another-world.pak";
+	bool lz = false;
+	for (int i = 1; i < argc; ++i) {
+		bool opt = false;
+		if (strlen(argv[i]) >= 2) {
+			opt |= parseOption(argv[i], "datapath=", &dataPath);
+			opt |= parseOption(argv[i], "output=", &outputName);
+			if (parseFlag(argv[i], "lz")) {
+				lz = opt = true;
+			}
+		}
+		if (!opt) {
+			printf("%s", USAGE);
+			return 0;
+		}
+	}
+
+	Resource res(0, dataPath);
+	res.readEntries();
+
+	// the memlist terminator is kept, readEntries() stops on it
+	const uint32_t numEntries = res._numMemList + 1;
+	std::vector<uint8_t> out(align(Archive::HEADER_SIZE + numEntries * Archive::ENTRY_SIZE), 0);
+	uint32_t rawSize = 0;
+	for (uint32_t i = 0; i < numEntries; ++i) {
+		MemEntry me;
+		if (i < res._numMemList) {
+			me = res._memList[i];
+		} else {
+			memset(&me, 0, sizeof(me));
+			me.state = MEMENTRY_STATE_END_OF_MEMLIST;
+		}
+		std::vector<uint8_t> data;
+		uint8_t codec = Archive::CODEC_RAW;
+		uint32_t bankSize = 0;
+		if (i < res._numMemList && me.size != 0) {
+			if (!res._bankFiles.getData(me.bankId, &bankSize) || me.bankOffset + me.packedSize > bankSize) {
+				warning("Entry %d skipped, bank%02x is missing or too short", i, me.bankId);
+			} else {
+				data.resize(me.size);
+				Bank bk(dataPath, &res._bankFiles);
+				if (!bk.read(&me, data.data())) {
+					error("Unable to unpack entry %d", i);
+				}
+				rawSize += me.size;
+				if (lz) {
+					std::vector<uint8_t> packed(me.size);
+					const uint32_t packedSize = Archive::compress(data.data(), me.size, packed.data(), packed.size());
+					if (packedSize != 0 && packedSize < me.size) {
+						packed.resize(packedSize);
+						data.swap(packed);
+						codec = Archive::CODEC_LZ;
+					}
+				}
+			}
+		}
+		uint8_t *p = &out[Archive::HEADER_SIZE + i * Archive::ENTRY_SIZE];
+		writeRecord(p, &me);
+		writeUint32BE(p + 0x14, out.size());
+		writeUint32BE(p + 0x18, data.size());
+		p[0x1C] = codec;
+		out.insert(out.end(), data.begin(), data.end());
+		out.resize(align(out.size()), 0);
+	}
+	writeUint32BE(&out[0], Archive::MAGIC);
+	writeUint32BE(&out[4], Archive::VERSION);
+	writeUint32BE(&out[8], numEntries);
+	writeUint32BE(&out[12], Archive::checksum(&out[0], &out[Archive::HEADER_SIZE], numEntries * Archive::ENTRY_SIZE));
+
+	File f;
+	if (!f.open(outputName, dataPath, "wb")) {
+		error("Unable to create '%s'", outputName);
+	}
+	f.write(out.data(), out.size());
+	if (f.ioErr()) {
+		error("I/O error when writing '%s'", outputName);
+	}
+	printf("%s: %d entries, %d KB of resources, %d KB archive\n", outputName, numEntries, rawSize / 1024, (int)out.size() / 1024);
+	return 0;
+}
@@ -0,0 +1,73 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "polycache.h"
+
+PolygonCache::PolygonCache() {
+	clear();
+}
+
+void PolygonCache::clear() {
+	_shapes.clear();
+	_polygons.clear();
+	_edges.clear();
+	memset(_buckets, 0xFF, sizeof(_buckets));
+	_firstPolygon = 0;
+}
+
+const PolygonCache::Shape *PolygonCache::find(const uint8_t *dataBuf, uint16_t offset, uint16_t zoom, uint8_t color) const {
+	int32_t i = _buckets[hash(dataBuf, offset, zoom, color)];
+	while (i >= 0) {
+		const Shape *s = &_shapes[i];
+		if (s->dataBuf == dataBuf && s->offset == offset && s->zoom == zoom && s->color == color) {
+			return s;
+		}
+		i = s->next;
+	}
+	return 0;
+}
+
+void PolygonCache::beginShape() {
+	if (_shapes.size() >= MAX_SHAPES || _polygons.size() >= MAX_POLYGONS || _edges.size() >= MAX_EDGES) {
+		debug(DBG_VIDEO, "PolygonCache::beginShape() cache full, %d shapes", (int)_shapes.size());
+		clear();
+	}
+	_firstPolygon = _polygons.size();
+}
+
+void PolygonCache::addPolygon(const CachedPolygon &poly, const PolygonEdge *edges) {
+	CachedPolygon cp(poly);
+	cp.firstEdge = _edges.size();
+	_edges.insert(_edges.end(), edges, edges + poly.numEdges);
+	_polygons.push_back(cp);
+}
+
+const PolygonCache::Shape *PolygonCache::endShape(const uint8_t *dataBuf, uint16_t offset, uint16_t zoom, uint8_t color) {
+	const uint32_t h = hash(dataBuf, offset, zoom, color);
+	Shape s;
+	s.dataBuf = dataBuf;
+	s.offset = offset;
+	s.zoom = zoom;
+	s.color = color;
+	s.firstPolygon = _firstPolygon;
+	s.numPolygons = _polygons.size() - _firstPolygon;
+	s.next = _buckets[h];
+	_buckets[h] = _shapes.size();
+	_shapes.push_back(s);
+	return &_shapes.back();
+}
@@ -0,0 +1,92 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __POLYCACHE_H__
+#define __POLYCACHE_H__
+
+#include <vector>
+#include "intern.h"
+
+/*
+	The edge-step data of one pair of polygon edges, as computed by
+	Video::calcStep().
+*/
+struct PolygonEdge {
+	int32_t step1, step2;
+	uint16_t h;
+};
+
+/*
+	A polygon ready to be rasterized. x, y are relative to the origin of the
+	shape, firstX and lastX are the abscissas of the first and last vertices.
+	The scanlines drawn are within [y - bbh / 2, y - bbh / 2 + height[.
+*/
+struct CachedPolygon {
+	int16_t x, y;
+	uint16_t bbw, bbh;
+	uint8_t color;
+	uint8_t numPoints;
+	int16_t firstX, lastX;
+	uint32_t firstEdge;
+	uint16_t numEdges;
+	uint32_t height; // sum of the edges heights
+};
+
+/*
+	Shape hierarchies flattened at a given zoom, keyed by (segment, offset,
+	zoom, color). The cache is cleared when the segments are swapped, or when
+	it grows over its limits.
+*/
+struct PolygonCache {
+	enum {
+		HASH_SIZE = 1024,
+		MAX_SHAPES = 4096,
+		MAX_POLYGONS = 32768,
+		MAX_EDGES = 65536
+	};
+
+	struct Shape {
+		const uint8_t *dataBuf;
+		uint16_t offset;
+		uint16_t zoom;
+		uint8_t color;
+		uint32_t firstPolygon;
+		uint32_t numPolygons;
+		int32_t next;
+	};
+
+	std::vector<Shape> _shapes;
+	std::vector<CachedPolygon> _polygons;
+	std::vector<PolygonEdge> _edges;
+	int32_t _buckets[HASH_SIZE];
+	uint32_t _firstPolygon;
+
+	PolygonCache();
+
+	void clear();
+	const Shape *find(const uint8_t *dataBuf, uint16_t offset, uint16_t zoom, uint8_t color) const;
+	void beginShape();
+	void addPolygon(const CachedPolygon &poly, const PolygonEdge *edges);
+	const Shape *endShape(const uint8_t *dataBuf, uint16_t offset, uint16_t zoom, uint8_t color);
+
+	static uint32_t hash(const uint8_t *dataBuf, uint16_t offset, uint16_t zoom, uint8_t color) {
+		return ((uint32_t)((uintptr_t)dataBuf >> 4) ^ (offset * 31) ^ (zoom * 0x9E5) ^ color) & (HASH_SIZE - 1);
+	}
+};
+
+#endif
@@ -0,0 +1,142 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "prefetch.h"
+#include "bank.h"
+#include "resource.h"
+
+Prefetcher::Prefetcher(const char *dataDir, const MemEntry *memList, BankFiles *bankFiles)
+	: _dataDir(dataDir), _memList(memList), _bankFiles(bankFiles), _quit(false), _pending(false), _numRequested(0), _current(0xFFFF), _numEntries(0) {
+}
+
+void Prefetcher::init() {
+	_quit = false;
+	_thread = std::thread(&Prefetcher::run, this);
+}
+
+void Prefetcher::free() {
+	if (_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_quit = true;
+		}
+		_cond.notify_all();
+		_thread.join();
+	}
+}
+
+/*
+	Replaces the staged entries with the ones of partId. The entries of the
+	previous request are kept when requested again, the others are dropped.
+	The same list requested twice in a row is only staged once, even when
+	some of its entries were taken meanwhile.
+*/
+void Prefetcher::request(uint16_t partId, const uint16_t *nums, int count) {
+	if (!_thread.joinable()) {
+		return;
+	}
+	count = MIN(count, (int)MAX_ENTRIES);
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (count == _numRequested && memcmp(nums, _requested, count * sizeof(uint16_t)) == 0) {
+		return;
+	}
+	debug(DBG_RES, "Prefetcher::request(0x%X) %d entries", partId, count);
+	memcpy(_requested, nums, count * sizeof(uint16_t));
+	_numRequested = count;
+	Entry entries[MAX_ENTRIES];
+	for (int i = 0; i < count; ++i) {
+		entries[i].num = nums[i];
+		entries[i].ready = false;
+		for (int j = 0; j < _numEntries; ++j) {
+			if (_entries[j].num == nums[i]) {
+				entries[i].ready = _entries[j].ready;
+				entries[i].data.swap(_entries[j].data);
+				break;
+			}
+		}
+	}
+	_pending = false;
+	for (int i = 0; i < MAX_ENTRIES; ++i) {
+		_entries[i].num = (i < count) ? entries[i].num : 0xFFFF;
+		_entries[i].ready = (i < count) && entries[i].ready;
+		_entries[i].data.swap(entries[i].data);
+		if (i < count && !_entries[i].ready) {
+			_pending = true;
+		}
+	}
+	_numEntries = count;
+	_cond.notify_all();
+}
+
+bool Prefetcher::take(uint16_t num, uint8_t *dst, uint32_t size) {
+	std::unique_lock<std::mutex> lock(_mutex);
+	for (int i = 0; i < _numEntries; ++i) {
+		Entry *e = &_entries[i];
+		if (e->num == num) {
+			if (!e->ready && _current != num) {
+				e->num = 0xFFFF;
+				return false;
+			}
+			_cond.wait(lock, [e, this] { return e->ready || _quit; });
+			const bool ret = (e->ready && e->data.size() == size);
+			if (ret) {
+				memcpy(dst, e->data.data(), size);
+			}
+			// the entry is going to be cached by the caller
+			e->num = 0xFFFF;
+			std::vector<uint8_t>().swap(e->data);
+			return ret;
+		}
+	}
+	return false;
+}
+
+void Prefetcher::run() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (1) {
+		_cond.wait(lock, [this] { return _pending || _quit; });
+		if (_quit) {
+			break;
+		}
+		_pending = false;
+		for (int i = 0; i < _numEntries && !_pending && !_quit; ++i) {
+			Entry *e = &_entries[i];
+			if (e->ready || e->num == 0xFFFF) {
+				continue;
+			}
+			const MemEntry *me = &_memList[e->num];
+			std::vector<uint8_t> data(MAX(me->size, me->packedSize));
+			_current = e->num;
+			lock.unlock();
+			Bank bk(_dataDir, _bankFiles);
+			const bool ok = bk.read(me, data.data());
+			lock.lock();
+			_current = 0xFFFF;
+			// a new request may have replaced the entry meanwhile
+			if (!_pending && e->num == (uint16_t)(me - _memList)) {
+				if (ok) {
+					data.resize(me->size);
+					e->data.swap(data);
+				}
+				e->ready = true;
+				_cond.notify_all();
+			}
+		}
+	}
+}
@@ -0,0 +1,77 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "intern.h"
+
+struct BankFiles;
+struct MemEntry;
+
+/*
+	Unpacks the resources the current game part may load and the segments of
+	the next one on a worker thread, while the current one is still running.
+	Resource::readBank() takes the staged data instead of reading the bank,
+	waiting for the worker if it is busy on that entry. An entry the worker
+	did not start yet is dropped, the caller unpacks it itself.
+
+	The worker only accesses the constant fields of the memlist entries (bank,
+	offset and sizes), everything else is protected by _mutex.
+*/
+struct Prefetcher {
+	enum {
+		MAX_ENTRIES = 64 // the ScriptAnalysis resources of a part, then the MEMLIST_PART_* of the next one
+	};
+
+	struct Entry {
+		uint16_t num;
+		bool ready;
+		std::vector<uint8_t> data;
+	};
+
+	const char *_dataDir;
+	const MemEntry *_memList;
+	BankFiles *_bankFiles;
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _quit;
+	bool _pending;          // a request is waiting for the worker
+	uint16_t _requested[MAX_ENTRIES]; // entries of the last request, even once taken
+	int _numRequested;
+	uint16_t _current;      // entry being unpacked by the worker, 0xFFFF if none
+	Entry _entries[MAX_ENTRIES];
+	int _numEntries;
+
+	Prefetcher(const char *dataDir, const MemEntry *memList, BankFiles *bankFiles);
+
+	void init();
+	void free();
+	void request(uint16_t partId, const uint16_t *nums, int count);
+	bool take(uint16_t num, uint8_t *dst, uint32_t size);
+
+	void run();
+};
+
+#endif
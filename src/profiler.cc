@@ -0,0 +1,149 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "profiler.h"
+
+#ifdef ENABLE_PROFILER
+
+#include <chrono>
+#include "parts.h"
+
+static const char *opcodeNames[] = {
+	/* 0x00 */
+	"movConst", "mov", "add", "addConst",
+	/* 0x04 */
+	"call", "ret", "pauseThread", "jmp",
+	/* 0x08 */
+	"setSetVect", "jnz", "condJmp", "setPalette",
+	/* 0x0C */
+	"resetThread", "selectVideoPage", "fillVideoPage", "copyVideoPage",
+	/* 0x10 */
+	"blitFramebuffer", "killThread", "drawString", "sub",
+	/* 0x14 */
+	"and", "or", "shl", "shr",
+	/* 0x18 */
+	"playSound", "updateMemList", "playMusic",
+	/* draw opcodes */
+	"polyCinematic", "polySprite"
+};
+
+static double toMs(uint64_t ns) {
+	return ns / 1000000.;
+}
+
+Profiler::Profiler() {
+	reset();
+}
+
+uint64_t Profiler::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::reset() {
+	memset(_parts, 0, sizeof(_parts));
+	_cur = &_parts[0];
+}
+
+void Profiler::setPart(uint16_t partId) {
+	const int num = partId - GAME_PART_FIRST;
+	if (num >= 0 && num < NUM_PARTS) {
+		_cur = &_parts[num];
+	}
+}
+
+// whole ms of the bucket holding the given percentile of the frame intervals
+static int getIntervalPercentile(const uint32_t *intervals, uint32_t count, int percentile) {
+	const uint32_t rank = (count * percentile + 99) / 100;
+	uint32_t sum = 0;
+	for (int i = 0; i < Profiler::NUM_INTERVALS; ++i) {
+		sum += intervals[i];
+		if (sum >= rank) {
+			return i;
+		}
+	}
+	return Profiler::NUM_INTERVALS - 1;
+}
+
+void Profiler::dump() {
+	printf("\n");
+	printf("Profiler statistics\n");
+	printf("-------------------\n");
+	for (int num = 0; num < NUM_PARTS; ++num) {
+		const PartStats *ps = &_parts[num];
+		if (ps->frames == 0 && ps->mixCalls == 0 && ps->resourceHits + ps->resourceMisses + ps->resourcePrefetched == 0) {
+			continue;
+		}
+		const uint32_t frames = ps->frames ? ps->frames : 1;
+		uint64_t threadTime = 0;
+		for (int i = 0; i < NUM_THREADS; ++i) {
+			threadTime += ps->threadTime[i];
+		}
+		printf("\n");
+		printf("Part 0x%04X : %d frames\n", GAME_PART_FIRST + num, ps->frames);
+		printf("  frame avg  : %8.3f ms\n", toMs(ps->frameTime) / frames);
+		printf("    threads  : %8.3f ms\n", toMs(threadTime) / frames);
+		printf("    polygons : %8.3f ms (%.1f polygons, %.1f spans, %.0f pixels)\n",
+			toMs(ps->polygonTime) / frames, (double)ps->polygons / frames, (double)ps->spans / frames, (double)ps->pixels / frames);
+		if (ps->rasterFlushes != 0) {
+			printf("    raster   : %8.3f ms (%.1f flushes, %.1f commands)\n",
+				toMs(ps->rasterTime) / frames, (double)ps->rasterFlushes / frames, (double)ps->rasterCommands / frames);
+		}
+		printf("    display  : %8.3f ms\n", toMs(ps->displayTime) / frames);
+		printf("    sleep    : %8.3f ms\n", toMs(ps->sleepTime) / frames);
+		uint32_t intervals = 0;
+		for (int i = 0; i < NUM_INTERVALS; ++i) {
+			intervals += ps->frameIntervals[i];
+		}
+		if (intervals != 0) {
+			printf("  pacing     : p50 %d ms, p90 %d ms, p99 %d ms, %d frames skipped\n",
+				getIntervalPercentile(ps->frameIntervals, intervals, 50), getIntervalPercentile(ps->frameIntervals, intervals, 90),
+				getIntervalPercentile(ps->frameIntervals, intervals, 99), ps->skippedFrames);
+		}
+		if (ps->mixCalls != 0) {
+			printf("  mixer      : %d calls, %.1f samples per call, %.3f us per call\n",
+				(int)ps->mixCalls, (double)ps->mixSamples / ps->mixCalls, ps->mixTime / 1000. / ps->mixCalls);
+		}
+		if (ps->resourceHits + ps->resourceMisses + ps->resourcePrefetched != 0) {
+			printf("  resources  : %d cache hits, %d prefetched, %d misses, %.1f KB loaded in %.3f ms\n",
+				ps->resourceHits, ps->resourcePrefetched, ps->resourceMisses, ps->resourceBytes / 1024., toMs(ps->resourceTime));
+		}
+		if (ps->memoryHighWater != 0) {
+			printf("  memory     : %.1f KB of part data, %.1f KB high water mark\n", ps->memoryPart / 1024., ps->memoryHighWater / 1024.);
+		}
+		if (ps->snapshots != 0) {
+			printf("  snapshots  : %d captures, %.3f us per capture\n", ps->snapshots, ps->snapshotTime / 1000. / ps->snapshots);
+		}
+		printf("  opcodes    :\n");
+		for (int i = 0; i < NUM_COUNTERS; ++i) {
+			if (ps->opcodes[i] != 0) {
+				printf("    0x%02X %-16s %12llu (%.1f per frame)\n", i, opcodeNames[i], (unsigned long long)ps->opcodes[i], (double)ps->opcodes[i] / frames);
+			}
+		}
+		printf("  threads    :\n");
+		for (int i = 0; i < NUM_THREADS; ++i) {
+			if (ps->threadRuns[i] != 0) {
+				printf("    %2d %10llu runs %10.3f ms total %8.3f us per run\n", i, (unsigned long long)ps->threadRuns[i],
+					toMs(ps->threadTime[i]), ps->threadTime[i] / 1000. / ps->threadRuns[i]);
+			}
+		}
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,202 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include "intern.h"
+
+/*
+	Low overhead counters and timers, bucketed per game part. Everything is
+	compiled out unless ENABLE_PROFILER is defined (make PROFILER=1), the
+	PROFILE_* macros below are the only entry points used by the engine.
+
+	The mixer statistics are updated from the audio thread, they are only
+	meant to be read with a grain of salt while the game is running. The
+	spans are not counted by the banded rasterizer threads, only the time
+	taken by the flushes of the deferred mode is.
+*/
+#ifdef ENABLE_PROFILER
+
+#define PROFILE_START(t)                  const uint64_t t = Profiler::now()
+#define PROFILE_PART(p, partId)           (p)->setPart(partId)
+#define PROFILE_OPCODE(p, opcode)         (p)->countOpcode(opcode)
+#define PROFILE_THREAD(p, threadId, t)    (p)->addThreadTime(threadId, Profiler::now() - (t))
+#define PROFILE_FRAME(p, t)               (p)->addFrameTime(Profiler::now() - (t))
+#define PROFILE_SLEEP(p, t)               (p)->addSleepTime(Profiler::now() - (t))
+#define PROFILE_DISPLAY(p, t)             (p)->addDisplayTime(Profiler::now() - (t))
+#define PROFILE_POLYGON(p, t)             (p)->addPolygonTime(Profiler::now() - (t))
+#define PROFILE_SPAN(p, x1, x2)           (p)->countSpan(x1, x2)
+#define PROFILE_MIX(p, len, t)            (p)->addMixTime(len, Profiler::now() - (t))
+#define PROFILE_RESOURCE(p, src, size, t) (p)->addResourceLoad(Profiler::src, size, Profiler::now() - (t))
+#define PROFILE_MEMORY(p, part, used)     (p)->setMemoryUsage(part, used)
+#define PROFILE_SNAPSHOT(p, t)            (p)->addSnapshotTime(Profiler::now() - (t))
+#define PROFILE_RASTER(p, commands, t)    (p)->addRasterTime(commands, Profiler::now() - (t))
+#define PROFILE_PACING(p, interval, skip) (p)->addFrameInterval(interval, skip)
+
+struct Profiler {
+	enum {
+		NUM_PARTS = 10,
+		NUM_THREADS = 64,
+		NUM_OPCODES = 0x1B,
+		OPCODE_POLY_CINEMATIC = NUM_OPCODES,     // opcode & 0x80
+		OPCODE_POLY_SPRITE = NUM_OPCODES + 1,    // opcode & 0x40
+		NUM_COUNTERS = NUM_OPCODES + 2,
+		NUM_INTERVALS = 256                      // 1 ms buckets, the last one is open
+	};
+
+	enum {
+		RES_BANK,     // read and unpacked from the bank file
+		RES_CACHE,    // copied from the ResourceCache
+		RES_PREFETCH, // unpacked by the Prefetcher
+		RES_ARCHIVE,  // copied or decoded from the Archive
+		RES_SHARED    // copied from the AssetStore
+	};
+
+	struct PartStats {
+		uint32_t frames;
+		uint64_t frameTime;
+		uint64_t sleepTime;
+		uint64_t displayTime;
+		uint64_t opcodes[NUM_COUNTERS];
+		uint64_t threadRuns[NUM_THREADS];
+		uint64_t threadTime[NUM_THREADS];
+		uint64_t polygons;
+		uint64_t polygonTime;
+		uint64_t spans;
+		uint64_t pixels;
+		uint64_t mixCalls;
+		uint64_t mixSamples;
+		uint64_t mixTime;
+		uint32_t resourceHits;    // resource cache
+		uint32_t resourceMisses;
+		uint32_t resourcePrefetched;
+		uint64_t resourceBytes;
+		uint64_t resourceTime;
+		uint32_t memoryPart;      // MemArena high water marks
+		uint32_t memoryHighWater;
+		uint32_t snapshots;       // rewind captures
+		uint64_t snapshotTime;
+		uint32_t rasterFlushes;   // deferred mode
+		uint64_t rasterCommands;
+		uint64_t rasterTime;
+		uint32_t frameIntervals[NUM_INTERVALS]; // FrameScheduler
+		uint32_t skippedFrames;
+	};
+
+	PartStats _parts[NUM_PARTS];
+	PartStats *_cur;
+
+	Profiler();
+
+	static uint64_t now(); // nanoseconds
+
+	void reset();
+	void setPart(uint16_t partId);
+
+	void countOpcode(uint8_t opcode) {
+		if (opcode & 0x80) {
+			++_cur->opcodes[OPCODE_POLY_CINEMATIC];
+		} else if (opcode & 0x40) {
+			++_cur->opcodes[OPCODE_POLY_SPRITE];
+		} else if (opcode < NUM_OPCODES) {
+			++_cur->opcodes[opcode];
+		}
+	}
+	void addThreadTime(int threadId, uint64_t t) {
+		++_cur->threadRuns[threadId];
+		_cur->threadTime[threadId] += t;
+	}
+	void addFrameTime(uint64_t t) {
+		++_cur->frames;
+		_cur->frameTime += t;
+	}
+	void addSleepTime(uint64_t t) {
+		_cur->sleepTime += t;
+	}
+	void addDisplayTime(uint64_t t) {
+		_cur->displayTime += t;
+	}
+	void addPolygonTime(uint64_t t) {
+		++_cur->polygons;
+		_cur->polygonTime += t;
+	}
+	void countSpan(int16_t x1, int16_t x2) {
+		++_cur->spans;
+		_cur->pixels += x2 - x1 + 1;
+	}
+	void addMixTime(int len, uint64_t t) {
+		++_cur->mixCalls;
+		_cur->mixSamples += len;
+		_cur->mixTime += t;
+	}
+	void addResourceLoad(int src, uint32_t size, uint64_t t) {
+		if (src == RES_CACHE || src == RES_SHARED) {
+			++_cur->resourceHits;
+		} else if (src == RES_PREFETCH) {
+			++_cur->resourcePrefetched;
+		} else {
+			++_cur->resourceMisses;
+		}
+		_cur->resourceBytes += size;
+		_cur->resourceTime += t;
+	}
+	void setMemoryUsage(uint32_t part, uint32_t used) {
+		_cur->memoryPart = MAX(_cur->memoryPart, part);
+		_cur->memoryHighWater = MAX(_cur->memoryHighWater, used);
+	}
+	void addSnapshotTime(uint64_t t) {
+		++_cur->snapshots;
+		_cur->snapshotTime += t;
+	}
+	void addRasterTime(uint32_t commands, uint64_t t) {
+		++_cur->rasterFlushes;
+		_cur->rasterCommands += commands;
+		_cur->rasterTime += t;
+	}
+	void addFrameInterval(uint32_t us, bool skipped) {
+		++_cur->frameIntervals[MIN(us / 1000, (uint32_t)NUM_INTERVALS - 1)];
+		if (skipped) {
+			++_cur->skippedFrames;
+		}
+	}
+
+	void dump();
+};
+
+#else
+
+#define PROFILE_START(t)
+#define PROFILE_PART(p, partId)
+#define PROFILE_OPCODE(p, opcode)
+#define PROFILE_THREAD(p, threadId, t)
+#define PROFILE_FRAME(p, t)
+#define PROFILE_SLEEP(p, t)
+#define PROFILE_DISPLAY(p, t)
+#define PROFILE_POLYGON(p, t)
+#define PROFILE_SPAN(p, x1, x2)
+#define PROFILE_MIX(p, len, t)
+#define PROFILE_RESOURCE(p, src, size, t)
+#define PROFILE_MEMORY(p, part, used)
+#define PROFILE_SNAPSHOT(p, t)
+#define PROFILE_RASTER(p, commands, t)
+#define PROFILE_PACING(p, interval, skip)
+
+#endif
+
+#endif
@@ -0,0 +1,309 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "analyzer.h"
+#include "program.h"
+#include "parts.h"
+
+Program::Program() {
+	clear();
+}
+
+void Program::clear() {
+	_code.clear();
+	memset(_index, 0xFF, sizeof(_index));
+}
+
+/*
+	Decode the instruction at offset, returns its size in bytes or 0 if the
+	opcode is invalid or truncated.
+*/
+uint32_t Program::decodeInstruction(const uint8_t *bytecode, uint32_t size, uint32_t offset, uint16_t partId, Instruction &ins) {
+	static const uint8_t opcodeSizes[] = {
+		4, 3, 3, 4, 3, 1, 1, 3, 4, 4, 0, 3, 4, 2, 3, 3, 2, 1, 6, 3, 4, 4, 4, 4, 6, 3, 6
+	};
+	const uint8_t *p = bytecode + offset;
+	const uint8_t opcode = p[0];
+	uint32_t len = 0;
+
+	memset(&ins, 0, sizeof(ins));
+	ins.opcode = opcode;
+	ins.pc = offset;
+	ins.target = NO_INDEX;
+
+	if (opcode & 0x80) {
+		len = 4;
+		if (offset + len > size) {
+			return 0;
+		}
+		ins.handler = OP_POLY_CINEMATIC;
+		ins.addr = ((opcode << 8) | p[1]) * 2;
+		int16_t x = p[2];
+		int16_t y = p[3];
+		int16_t h = y - 199;
+		if (h > 0) {
+			y = 199;
+			x += h;
+		}
+		ins.x = x;
+		ins.y = y;
+		return len;
+	}
+	if (opcode & 0x40) {
+		len = 3;
+		if (!(opcode & 0x20)) {
+			len += (opcode & 0x10) ? 1 : 2;
+		} else {
+			len += 1;
+		}
+		if (!(opcode & 8)) {
+			len += (opcode & 4) ? 1 : 2;
+		} else {
+			len += 1;
+		}
+		if ((opcode & 3) == 1 || (opcode & 3) == 2) {
+			len += 1;
+		}
+		if (offset + len > size) {
+			return 0;
+		}
+		ins.handler = OP_POLY_SPRITE;
+		ins.addr = READ_BE_UINT16(p + 1) * 2;
+		p += 3;
+		if (!(opcode & 0x20)) {
+			if (!(opcode & 0x10)) {
+				ins.x = (int16_t)READ_BE_UINT16(p); p += 2;
+			} else {
+				ins.x = *p++;
+				ins.c |= POLY_X_VAR;
+			}
+		} else {
+			ins.x = *p++;
+			if (opcode & 0x10) {
+				ins.x += 0x100;
+			}
+		}
+		if (!(opcode & 8)) {
+			if (!(opcode & 4)) {
+				ins.y = (int16_t)READ_BE_UINT16(p); p += 2;
+			} else {
+				ins.y = *p++;
+				ins.c |= POLY_Y_VAR;
+			}
+		} else {
+			ins.y = *p++;
+		}
+		ins.b = 0x40;
+		switch (opcode & 3) {
+		case 1:
+			ins.b = *p++;
+			ins.c |= POLY_ZOOM_VAR;
+			break;
+		case 2:
+			ins.b = *p++;
+			break;
+		case 3:
+			ins.c |= POLY_VIDEO2;
+			break;
+		}
+		return len;
+	}
+	if (opcode >= ARRAYSIZE(opcodeSizes)) {
+		return 0;
+	}
+	if (opcode == 0x0A) {
+		if (offset + 2 > size) {
+			return 0;
+		}
+		len = 3 + ((p[1] & 0x80) ? 1 : (p[1] & 0x40) ? 2 : 1) + 2;
+	} else {
+		len = opcodeSizes[opcode];
+	}
+	if (offset + len > size) {
+		return 0;
+	}
+
+	switch (opcode) {
+	case 0x00:
+		ins.handler = OP_MOV_CONST;
+		ins.a = p[1];
+		ins.x = READ_BE_UINT16(p + 2);
+		break;
+	case 0x01:
+	case 0x02:
+	case 0x13:
+		ins.handler = (opcode == 0x01) ? OP_MOV : (opcode == 0x02) ? OP_ADD : OP_SUB;
+		ins.a = p[1];
+		ins.b = p[2];
+		break;
+	case 0x03:
+		// the gun sound hack of op_addConst() is kept on the bytecode interpreter, it
+		// checks the pc after the opcode fetch, the instruction starts at 0x6D47
+		if (partId == 0x3E86 && offset == 0x6D47) {
+			ins.handler = OP_LEGACY;
+		} else {
+			ins.handler = OP_ADD_CONST;
+			ins.a = p[1];
+			ins.x = READ_BE_UINT16(p + 2);
+		}
+		break;
+	case 0x04:
+		ins.handler = OP_CALL;
+		ins.addr = READ_BE_UINT16(p + 1);
+		break;
+	case 0x05:
+		ins.handler = OP_RET;
+		break;
+	case 0x06:
+		ins.handler = OP_BREAK;
+		break;
+	case 0x07:
+		ins.handler = OP_JMP;
+		ins.addr = READ_BE_UINT16(p + 1);
+		break;
+	case 0x08:
+		ins.handler = OP_SET_VEC;
+		ins.a = p[1];
+		ins.addr = READ_BE_UINT16(p + 2);
+		break;
+	case 0x09:
+		ins.handler = OP_JNZ;
+		ins.a = p[1];
+		ins.addr = READ_BE_UINT16(p + 2);
+		break;
+	case 0x0A: {
+			const uint8_t cond = p[1];
+			ins.a = p[2];
+			const uint8_t *q = p + 3;
+			bool var = false;
+			if (cond & 0x80) {
+				ins.x = *q++;
+				var = true;
+			} else if (cond & 0x40) {
+				ins.x = READ_BE_UINT16(q); q += 2;
+			} else {
+				ins.x = *q++;
+			}
+			ins.addr = READ_BE_UINT16(q);
+#ifdef BYPASS_PROTECTION
+			const bool protection = (partId == GAME_PART1 && var && (cond & 7) == 0);
+#else
+			const bool protection = false;
+#endif
+			if ((cond & 7) > 5 || protection) {
+				ins.handler = OP_LEGACY;
+			} else {
+				ins.handler = (var ? OP_JZ_VAR : OP_JZ_IMM) + (cond & 7);
+			}
+		}
+		break;
+	case 0x11:
+		ins.handler = OP_KILL;
+		break;
+	case 0x14:
+	case 0x15:
+	case 0x16:
+	case 0x17:
+		ins.handler = OP_AND + (opcode - 0x14);
+		ins.a = p[1];
+		ins.x = READ_BE_UINT16(p + 2);
+		break;
+	default:
+		ins.handler = OP_LEGACY;
+		break;
+	}
+	return len;
+}
+
+/*
+	The bytecode is decoded linearly from the start of the segment, then from
+	every jump target which does not fall on an instruction boundary. A chain
+	ends with OP_LINK when it runs into an already decoded instruction, or with
+	OP_END which hands the thread back to the bytecode interpreter.
+
+	With the ScriptAnalysis of the segment, a chain also ends with OP_END on
+	the code which cannot be reached, such as the data or the dead code after
+	an unconditional jump, which is then not decoded.
+*/
+bool Program::decode(const uint8_t *bytecode, uint32_t size, uint16_t partId, const ScriptAnalysis *analysis) {
+	clear();
+	if (bytecode == 0 || size == 0) {
+		return false;
+	}
+	size = MIN(size, 0xFFFFu);
+	std::vector<uint16_t> pending;
+	pending.push_back(0);
+	while (!pending.empty()) {
+		uint32_t offset = pending.back();
+		pending.pop_back();
+		if (offset >= size || _index[offset] != NO_INDEX) {
+			continue;
+		}
+		while (1) {
+			if (_code.size() >= MAX_INSTRUCTIONS) {
+				warning("Program::decode() too many instructions");
+				clear();
+				return false;
+			}
+			Instruction ins;
+			if (offset < size && _index[offset] != NO_INDEX) {
+				memset(&ins, 0, sizeof(ins));
+				ins.handler = OP_LINK;
+				ins.pc = offset;
+				ins.addr = offset;
+				ins.target = NO_INDEX;
+				_code.push_back(ins);
+				break;
+			}
+			const bool reachable = (offset < size) && (!analysis || analysis->empty() || analysis->isReachable(offset));
+			const uint32_t len = reachable ? decodeInstruction(bytecode, size, offset, partId, ins) : 0;
+			if (len == 0) {
+				memset(&ins, 0, sizeof(ins));
+				ins.handler = OP_END;
+				ins.pc = offset;
+				ins.target = NO_INDEX;
+				_code.push_back(ins);
+				break;
+			}
+			_index[offset] = _code.size();
+			_code.push_back(ins);
+			switch (ins.handler) {
+			case OP_CALL:
+			case OP_JMP:
+			case OP_SET_VEC:
+			case OP_JNZ:
+				pending.push_back(ins.addr);
+				break;
+			default:
+				if (ins.handler >= OP_JZ_VAR && ins.handler <= OP_JLE_IMM) {
+					pending.push_back(ins.addr);
+				}
+				break;
+			}
+			offset += len;
+		}
+	}
+	for (size_t i = 0; i < _code.size(); ++i) {
+		Instruction &ins = _code[i];
+		if (ins.handler == OP_CALL || ins.handler == OP_JMP || ins.handler == OP_LINK || ins.handler == OP_JNZ || (ins.handler >= OP_JZ_VAR && ins.handler <= OP_JLE_IMM)) {
+			ins.target = _index[ins.addr];
+		}
+	}
+	debug(DBG_VM, "Program::decode() part 0x%X, %d bytes, %d instructions", partId, size, (int)_code.size());
+	return true;
+}
@@ -0,0 +1,112 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __PROGRAM_H__
+#define __PROGRAM_H__
+
+#include <vector>
+#include "intern.h"
+
+struct ScriptAnalysis;
+
+/*
+	A decoded instruction. The operands are extracted once, the operand modes
+	(variable or immediate) are folded in the handler and the jump targets are
+	resolved to instruction indexes.
+
+	pc is the offset of the instruction in the bytecode. The thread program
+	counters and the call stack still hold bytecode offsets, so the savegames
+	do not depend on the execution mode.
+*/
+struct Instruction {
+	uint8_t handler;   // Program::Handler
+	uint8_t opcode;    // original opcode
+	uint8_t a, b;
+	int16_t x, y;
+	uint16_t addr;     // bytecode offset operand (jump target, polygon data offset)
+	uint16_t target;   // instruction index of addr for the jumps, Program::NO_INDEX if unknown
+	uint16_t pc;
+	uint8_t c;
+	uint8_t pad;
+};
+
+struct Program {
+	enum {
+		NO_INDEX = 0xFFFF,
+		MAX_INSTRUCTIONS = 0xFFFE
+	};
+
+	enum Handler {
+		OP_MOV_CONST,
+		OP_MOV,
+		OP_ADD,
+		OP_ADD_CONST,
+		OP_CALL,
+		OP_RET,
+		OP_BREAK,
+		OP_JMP,
+		OP_SET_VEC,
+		OP_JNZ,
+		OP_JZ_VAR,  // condJmp, one handler per condition and operand mode
+		OP_JNZ_VAR,
+		OP_JG_VAR,
+		OP_JGE_VAR,
+		OP_JL_VAR,
+		OP_JLE_VAR,
+		OP_JZ_IMM,
+		OP_JNZ_IMM,
+		OP_JG_IMM,
+		OP_JGE_IMM,
+		OP_JL_IMM,
+		OP_JLE_IMM,
+		OP_KILL,
+		OP_SUB,
+		OP_AND,
+		OP_OR,
+		OP_SHL,
+		OP_SHR,
+		OP_POLY_CINEMATIC,
+		OP_POLY_SPRITE,
+		OP_LEGACY,  // executed with VirtualMachine::opcodeTable
+		OP_LINK,    // end of a decoded chain, continue on an already decoded instruction
+		OP_END,     // end of a decoded chain, switch back to the bytecode interpreter
+		NUM_HANDLERS
+	};
+
+	enum {
+		POLY_X_VAR = 1 << 0,
+		POLY_Y_VAR = 1 << 1,
+		POLY_ZOOM_VAR = 1 << 2,
+		POLY_VIDEO2 = 1 << 3
+	};
+
+	std::vector<Instruction> _code;
+	uint16_t _index[0x10000]; // bytecode offset to instruction index
+
+	Program();
+
+	void clear();
+	bool decode(const uint8_t *bytecode, uint32_t size, uint16_t partId, const ScriptAnalysis *analysis);
+
+	bool empty() const { return _code.empty(); }
+	uint16_t lookup(uint16_t offset) const { return _index[offset]; }
+
+	static uint32_t decodeInstruction(const uint8_t *bytecode, uint32_t size, uint32_t offset, uint16_t partId, Instruction &ins);
+};
+
+#endif
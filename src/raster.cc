@@ -0,0 +1,93 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "raster.h"
+
+RasterPool::RasterPool()
+	: _quit(false), _proc(0), _param(0), _numJobs(0), _nextJob(0), _doneJobs(0) {
+}
+
+void RasterPool::init(uint32_t numWorkers) {
+	free();
+	_quit = false;
+	for (uint32_t i = 0; i < numWorkers; ++i) {
+		_threads.push_back(std::thread(&RasterPool::worker, this));
+	}
+}
+
+void RasterPool::free() {
+	if (!_threads.empty()) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_quit = true;
+		}
+		_cond.notify_all();
+		for (size_t i = 0; i < _threads.size(); ++i) {
+			_threads[i].join();
+		}
+		_threads.clear();
+	}
+}
+
+void RasterPool::run(JobProc proc, void *param, uint32_t numJobs) {
+	if (_threads.empty()) {
+		for (uint32_t i = 0; i < numJobs; ++i) {
+			proc(param, i);
+		}
+		return;
+	}
+	std::unique_lock<std::mutex> lock(_mutex);
+	_proc = proc;
+	_param = param;
+	_numJobs = numJobs;
+	_nextJob = 0;
+	_doneJobs = 0;
+	_cond.notify_all();
+	while (runNextJob(lock)) {
+	}
+	_doneCond.wait(lock, [this] { return _doneJobs == _numJobs; });
+}
+
+// Called with the lock held, which is released while the job runs
+bool RasterPool::runNextJob(std::unique_lock<std::mutex> &lock) {
+	if (_nextJob >= _numJobs) {
+		return false;
+	}
+	const uint32_t job = _nextJob++;
+	const JobProc proc = _proc;
+	void *param = _param;
+	lock.unlock();
+	proc(param, job);
+	lock.lock();
+	if (++_doneJobs == _numJobs) {
+		_doneCond.notify_all();
+	}
+	return true;
+}
+
+void RasterPool::worker() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (1) {
+		_cond.wait(lock, [this] { return _quit || _nextJob < _numJobs; });
+		if (_quit) {
+			break;
+		}
+		runNextJob(lock);
+	}
+}
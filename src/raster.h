@@ -0,0 +1,60 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "intern.h"
+
+/*
+	A pool of worker threads for the banded rasterizer, see Video::flush().
+	run() hands out the jobs one at a time to the workers and to the calling
+	thread, and returns once they are all done. Without any worker, the jobs
+	are run in order on the calling thread.
+*/
+struct RasterPool {
+	typedef void (*JobProc)(void *param, uint32_t job);
+
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _cond;     // wakes up the workers
+	std::condition_variable _doneCond; // wakes up run()
+	bool _quit;
+	JobProc _proc;
+	void *_param;
+	uint32_t _numJobs;
+	uint32_t _nextJob;
+	uint32_t _doneJobs;
+
+	RasterPool();
+
+	void init(uint32_t numWorkers);
+	void free();
+	uint32_t size() const { return _threads.size() + 1; } // including the calling thread
+	void run(JobProc proc, void *param, uint32_t numJobs);
+
+	bool runNextJob(std::unique_lock<std::mutex> &lock);
+	void worker();
+};
+
+#endif
@@ -0,0 +1,192 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "replay.h"
+#include "util.h"
+
+static constexpr uint32_t AWRP = (static_cast<uint32_t>('A') << 24)
+		                       | (static_cast<uint32_t>('W') << 16)
+		                       | (static_cast<uint32_t>('R') <<  8)
+		                       | (static_cast<uint32_t>('P') <<  0)
+		                       ;
+
+void Replay::encode(const PlayerInput &pi, Entry &e) {
+	e.dirMask = pi.dirMask;
+	e.flags = 0;
+	if (pi.button) e.flags |= FLAG_BUTTON;
+	if (pi.code)   e.flags |= FLAG_CODE;
+	if (pi.pause)  e.flags |= FLAG_PAUSE;
+	if (pi.quit)   e.flags |= FLAG_QUIT;
+	if (pi.save)   e.flags |= FLAG_SAVE;
+	if (pi.load)   e.flags |= FLAG_LOAD;
+	if (pi.rewind) e.flags |= FLAG_REWIND;
+	e.lastChar = pi.lastChar;
+	e.stateSlot = pi.stateSlot;
+}
+
+void Replay::decode(const Entry &e, PlayerInput &pi) {
+	pi.dirMask = e.dirMask;
+	pi.button = (e.flags & FLAG_BUTTON) != 0;
+	pi.code   = (e.flags & FLAG_CODE) != 0;
+	pi.pause  = (e.flags & FLAG_PAUSE) != 0;
+	pi.quit   = (e.flags & FLAG_QUIT) != 0;
+	pi.save   = (e.flags & FLAG_SAVE) != 0;
+	pi.load   = (e.flags & FLAG_LOAD) != 0;
+	pi.rewind = (e.flags & FLAG_REWIND) != 0;
+	pi.lastChar = e.lastChar;
+	pi.stateSlot = e.stateSlot;
+}
+
+ReplayRecorder::ReplayRecorder(System *sys)
+	: SystemProxy(sys), _count(0), _framesCount(0) {
+	memset(&input, 0, sizeof(input));
+}
+
+ReplayRecorder::~ReplayRecorder() {
+	close();
+}
+
+bool ReplayRecorder::open(const char *fileName, const char *dir, uint16_t randomSeed) {
+	if (!_f.open(fileName, dir, "wb")) {
+		warning("Unable to create replay file '%s'", fileName);
+		return false;
+	}
+	_f.writeUint32BE(AWRP);
+	_f.writeUint16BE(Replay::CUR_VER);
+	_f.writeUint16BE(randomSeed);
+	_count = 0;
+	_framesCount = 0;
+	return true;
+}
+
+void ReplayRecorder::close() {
+	flush();
+	_f.close();
+}
+
+void ReplayRecorder::flush() {
+	if (_count != 0) {
+		_f.writeUint16BE(_count);
+		_f.writeByte(_last.dirMask);
+		_f.writeByte(_last.flags);
+		_f.writeByte(_last.lastChar);
+		_f.writeByte(_last.stateSlot);
+		if (_f.ioErr()) {
+			warning("I/O error when writing replay file");
+		}
+		_count = 0;
+	}
+}
+
+void ReplayRecorder::destroy() {
+	close();
+	debug(DBG_INFO, "ReplayRecorder::destroy() %d frames recorded", _framesCount);
+	SystemProxy::destroy();
+}
+
+void ReplayRecorder::processEvents() {
+	// the engine and the VM clear some of the input fields once handled,
+	// the wrapped system has to see these changes
+	_sys->input = input;
+	_sys->processEvents();
+	input = _sys->input;
+
+	Replay::Entry e;
+	Replay::encode(input, e);
+	if (_count != 0 && (_count == Replay::MAX_RUN || memcmp(&e, &_last, sizeof(e)) != 0)) {
+		flush();
+	}
+	_last = e;
+	++_count;
+	++_framesCount;
+}
+
+ReplayPlayer::ReplayPlayer(System *sys)
+	: SystemProxy(sys), _randomSeed(0), _count(0), _framesCount(0), _finished(true) {
+	memset(&input, 0, sizeof(input));
+}
+
+ReplayPlayer::~ReplayPlayer() {
+	close();
+}
+
+bool ReplayPlayer::open(const char *fileName, const char *dir) {
+	if (!_f.open(fileName, dir, "rb")) {
+		warning("Unable to open replay file '%s'", fileName);
+		return false;
+	}
+	const uint32_t id = _f.readUint32BE();
+	const uint16_t ver = _f.readUint16BE();
+	if (id != AWRP || ver > Replay::CUR_VER || _f.ioErr()) {
+		warning("Bad replay file format");
+		_f.close();
+		return false;
+	}
+	_randomSeed = _f.readUint16BE();
+	_count = 0;
+	_framesCount = 0;
+	_finished = false;
+	return true;
+}
+
+void ReplayPlayer::close() {
+	_f.close();
+	_finished = true;
+}
+
+bool ReplayPlayer::nextEntry() {
+	if (_count == 0) {
+		_count = _f.readUint16BE();
+		_cur.dirMask = _f.readByte();
+		_cur.flags = _f.readByte();
+		_cur.lastChar = _f.readByte();
+		_cur.stateSlot = _f.readByte();
+		if (_f.ioErr() || _count == 0) {
+			return false;
+		}
+	}
+	--_count;
+	return true;
+}
+
+void ReplayPlayer::destroy() {
+	close();
+	debug(DBG_INFO, "ReplayPlayer::destroy() %d frames played", _framesCount);
+	SystemProxy::destroy();
+}
+
+void ReplayPlayer::processEvents() {
+	// keep the wrapped system alive (window events, etc.) but ignore its input
+	_sys->processEvents();
+
+	if (!_finished && !nextEntry()) {
+		debug(DBG_INFO, "End of replay after %d frames", _framesCount);
+		_finished = true;
+	}
+	if (_finished) {
+		// also unblock the VM if it is waiting in the pause loop
+		input.quit = true;
+		input.pause = true;
+		return;
+	}
+	Replay::decode(_cur, input);
+	if (_sys->input.quit) {
+		input.quit = true;
+	}
+	++_framesCount;
+}
@@ -0,0 +1,130 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "intern.h"
+#include "file.h"
+#include "sys.h"
+
+/*
+	A System forwarding every call to another one. Used as a base for the
+	replay recorder and player which only hook processEvents().
+*/
+struct SystemProxy : System {
+	System *_sys;
+
+	SystemProxy(System *sys) : _sys(sys) {}
+	virtual ~SystemProxy() {}
+
+	virtual void init(const char *title) { _sys->init(title); }
+	virtual void destroy() { _sys->destroy(); }
+	virtual void setPalette(const uint8_t *buf) { _sys->setPalette(buf); }
+	virtual void updateDisplay(const uint8_t *buf, uint16_t y, uint16_t h) { _sys->updateDisplay(buf, y, h); }
+	virtual void updateDisplayHires(const uint8_t *buf, uint16_t w, uint16_t h) { _sys->updateDisplayHires(buf, w, h); }
+	virtual void processEvents() { _sys->processEvents(); }
+	virtual void sleep(uint32_t duration) { _sys->sleep(duration); }
+	virtual uint32_t getTimeStamp() { return _sys->getTimeStamp(); }
+	virtual uint64_t getHighResTimeStamp() { return _sys->getHighResTimeStamp(); }
+	virtual void startAudio(AudioCallback callback, void *param, uint32_t sampleRate, uint8_t sampleBits) { _sys->startAudio(callback, param, sampleRate, sampleBits); }
+	virtual void stopAudio() { _sys->stopAudio(); }
+	virtual uint32_t getOutputSampleRate() { return _sys->getOutputSampleRate(); }
+	virtual int addTimer(uint32_t delay, TimerCallback callback, void *param) { return _sys->addTimer(delay, callback, param); }
+	virtual void removeTimer(int timerId) { _sys->removeTimer(timerId); }
+	virtual void *createMutex() { return _sys->createMutex(); }
+	virtual void destroyMutex(void *mutex) { _sys->destroyMutex(mutex); }
+	virtual void lockMutex(void *mutex) { _sys->lockMutex(mutex); }
+	virtual void unlockMutex(void *mutex) { _sys->unlockMutex(mutex); }
+};
+
+/*
+	A replay file starts with a 'AWRP' tag, a version and the random seed the
+	session was started with. It is followed by the PlayerInput states, as seen
+	by the VM after each call to processEvents(), run length encoded :
+
+		uint16_t count
+		uint8_t  dirMask
+		uint8_t  flags (Replay::FLAG_*)
+		uint8_t  lastChar
+		int8_t   stateSlot
+*/
+struct Replay {
+	enum {
+		CUR_VER = 1,
+		MAX_RUN = 0xFFFF
+	};
+
+	enum {
+		FLAG_BUTTON = 1 << 0,
+		FLAG_CODE   = 1 << 1,
+		FLAG_PAUSE  = 1 << 2,
+		FLAG_QUIT   = 1 << 3,
+		FLAG_SAVE   = 1 << 4,
+		FLAG_LOAD   = 1 << 5,
+		FLAG_REWIND = 1 << 6
+	};
+
+	struct Entry {
+		uint8_t dirMask;
+		uint8_t flags;
+		uint8_t lastChar;
+		int8_t stateSlot;
+	};
+
+	static void encode(const PlayerInput &pi, Entry &e);
+	static void decode(const Entry &e, PlayerInput &pi);
+};
+
+struct ReplayRecorder : SystemProxy {
+	File _f;
+	Replay::Entry _last;
+	uint16_t _count;
+	uint32_t _framesCount;
+
+	ReplayRecorder(System *sys);
+	virtual ~ReplayRecorder();
+
+	bool open(const char *fileName, const char *dir, uint16_t randomSeed);
+	void close();
+	void flush();
+
+	virtual void destroy();
+	virtual void processEvents();
+};
+
+struct ReplayPlayer : SystemProxy {
+	File _f;
+	uint16_t _randomSeed;
+	Replay::Entry _cur;
+	uint16_t _count;
+	uint32_t _framesCount;
+	bool _finished;
+
+	ReplayPlayer(System *sys);
+	virtual ~ReplayPlayer();
+
+	bool open(const char *fileName, const char *dir);
+	void close();
+	bool nextEntry();
+
+	virtual void destroy();
+	virtual void processEvents();
+};
+
+#endif
@@ -0,0 +1,126 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "rescache.h"
+
+ResourceCache::ResourceCache()
+	: _maxSize(0), _totalSize(0), _useCounter(0) {
+}
+
+void ResourceCache::clear() {
+	for (int i = 0; i < NUM_SLOTS; ++i) {
+		std::vector<uint8_t>().swap(_entries[i].data);
+		_entries[i].lastUse = 0;
+	}
+	_totalSize = 0;
+}
+
+void ResourceCache::setMaxSize(uint32_t size) {
+	_maxSize = size;
+	while (_totalSize > _maxSize) {
+		evictLeastRecentlyUsed();
+	}
+}
+
+bool ResourceCache::contains(uint16_t num) const {
+	return num < MAX_ENTRIES && !_entries[num].data.empty();
+}
+
+bool ResourceCache::containsScreen(uint16_t num) const {
+	return num < MAX_ENTRIES && !_entries[MAX_ENTRIES + num].data.empty();
+}
+
+bool ResourceCache::lookup(uint16_t num, uint8_t *dst, uint32_t size) {
+	if (num >= MAX_ENTRIES) {
+		return false;
+	}
+	const Entry *e = lookupSlot(num, size);
+	if (!e) {
+		return false;
+	}
+	memcpy(dst, e->data.data(), size);
+	return true;
+}
+
+void ResourceCache::insert(uint16_t num, const uint8_t *src, uint32_t size) {
+	if (num < MAX_ENTRIES) {
+		insertSlot(num, src, size);
+	}
+}
+
+// The converted page stays valid until the next insertion
+const uint8_t *ResourceCache::lookupScreen(uint16_t num, uint32_t size) {
+	if (num >= MAX_ENTRIES) {
+		return 0;
+	}
+	const Entry *e = lookupSlot(MAX_ENTRIES + num, size);
+	return e ? e->data.data() : 0;
+}
+
+void ResourceCache::insertScreen(uint16_t num, const uint8_t *src, uint32_t size) {
+	if (num < MAX_ENTRIES) {
+		insertSlot(MAX_ENTRIES + num, src, size);
+	}
+}
+
+ResourceCache::Entry *ResourceCache::lookupSlot(uint16_t slot, uint32_t size) {
+	Entry *e = &_entries[slot];
+	if (e->data.empty() || e->data.size() != size) {
+		return 0;
+	}
+	e->lastUse = ++_useCounter;
+	return e;
+}
+
+void ResourceCache::insertSlot(uint16_t slot, const uint8_t *src, uint32_t size) {
+	if (size == 0 || size > _maxSize) {
+		return;
+	}
+	evict(slot);
+	while (_totalSize + size > _maxSize) {
+		evictLeastRecentlyUsed();
+	}
+	Entry *e = &_entries[slot];
+	e->data.assign(src, src + size);
+	e->lastUse = ++_useCounter;
+	_totalSize += size;
+	debug(DBG_RES, "ResourceCache::insertSlot(%d) size=%d total=%d", slot, size, _totalSize);
+}
+
+void ResourceCache::evict(uint16_t slot) {
+	Entry *e = &_entries[slot];
+	if (!e->data.empty()) {
+		_totalSize -= e->data.size();
+		std::vector<uint8_t>().swap(e->data);
+	}
+}
+
+void ResourceCache::evictLeastRecentlyUsed() {
+	int lru = -1;
+	for (int i = 0; i < NUM_SLOTS; ++i) {
+		const Entry *e = &_entries[i];
+		if (!e->data.empty() && (lru < 0 || (int32_t)(e->lastUse - _entries[lru].lastUse) < 0)) {
+			lru = i;
+		}
+	}
+	if (lru >= 0) {
+		debug(DBG_RES, "ResourceCache::evictLeastRecentlyUsed() entry %d", lru);
+		evict(lru);
+	}
+}
@@ -0,0 +1,70 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __RESCACHE_H__
+#define __RESCACHE_H__
+
+#include <vector>
+#include "intern.h"
+
+/*
+	The unpacked data of the memlist entries, keyed by memlist index. Loading
+	an entry seen before is then a copy instead of a bank read and unpack. The
+	least recently used entries are dropped when the total size goes over
+	_maxSize, a null _maxSize disables the cache.
+
+	The entries are never modified once inserted, the engine patches its own
+	copy in the memory block (see SfxPlayer::prepareInstruments()).
+
+	The RT_POLY_ANIM screens are also kept once converted to a 4bpp page, in
+	slots of their own after the unpacked entries, sharing the same budget.
+*/
+struct ResourceCache {
+	enum {
+		MAX_ENTRIES = 256,
+		NUM_SLOTS = MAX_ENTRIES * 2 // unpacked entries, then converted screens
+	};
+
+	struct Entry {
+		std::vector<uint8_t> data;
+		uint32_t lastUse;
+	};
+
+	Entry _entries[NUM_SLOTS];
+	uint32_t _maxSize;
+	uint32_t _totalSize;
+	uint32_t _useCounter;
+
+	ResourceCache();
+
+	void clear();
+	void setMaxSize(uint32_t size);
+	bool contains(uint16_t num) const;
+	bool containsScreen(uint16_t num) const;
+	bool lookup(uint16_t num, uint8_t *dst, uint32_t size);
+	void insert(uint16_t num, const uint8_t *src, uint32_t size);
+	const uint8_t *lookupScreen(uint16_t num, uint32_t size);
+	void insertScreen(uint16_t num, const uint8_t *src, uint32_t size);
+	void evict(uint16_t slot);
+	Entry *lookupSlot(uint16_t slot, uint32_t size);
+	void insertSlot(uint16_t slot, const uint8_t *src, uint32_t size);
+	void evictLeastRecentlyUsed();
+};
+
+#endif
@@ -17,6 +17,7 @@
  */
 
 #include "resource.h"
+#include "assets.h"
 #include "bank.h"
 #include "file.h"
 #include "serializer.h"
@@ -25,18 +26,47 @@
 #include "parts.h"
 
 Resource::Resource(Video *vid, const char *dataDir) 
-	: video(vid), _dataDir(dataDir), currentPartId(0),requestedNextPart(0) {
+	: video(vid), _dataDir(dataDir), currentPartId(0),requestedNextPart(0), _decodeProgram(false), _bankFiles(dataDir), _prefetcher(dataDir, _memList, &_bankFiles), _assets(0) {
+#ifdef ENABLE_PROFILER
+	_profiler = 0;
+#endif
 }
 
 void Resource::readBank(const MemEntry *me, uint8_t *dstBuf) {
 	uint16_t n = me - _memList;
 	debug(DBG_BANK, "Resource::readBank(%d)", n);
 
-	Bank bk(_dataDir);
+	PROFILE_START(loadStart);
+
+	if (_assets && _assets->read(n, dstBuf, me->size)) {
+		PROFILE_RESOURCE(_profiler, RES_SHARED, me->size, loadStart);
+		return;
+	}
+	if (_cache.lookup(n, dstBuf, me->size)) {
+		PROFILE_RESOURCE(_profiler, RES_CACHE, me->size, loadStart);
+		return;
+	}
+	if (_prefetcher.take(n, dstBuf, me->size)) {
+		_cache.insert(n, dstBuf, me->size);
+		PROFILE_RESOURCE(_profiler, RES_PREFETCH, me->size, loadStart);
+		return;
+	}
+
+	if (_archive.isOpen()) {
+		if (!_archive.read(n, dstBuf, me->size)) {
+			error("Resource::readBank() unable to read archive entry %d\n", n);
+		}
+		PROFILE_RESOURCE(_profiler, RES_ARCHIVE, me->size, loadStart);
+		return;
+	}
+
+	Bank bk(_dataDir, &_bankFiles);
 	if (!bk.read(me, dstBuf)) {
 		error("Resource::readBank() unable to unpack entry %d\n", n);
 	}
+	_cache.insert(n, dstBuf, me->size);
 
+	PROFILE_RESOURCE(_profiler, RES_BANK, me->size, loadStart);
 }
 
 static const char *resTypeToString(unsigned int type)
@@ -57,25 +87,43 @@ static const char *resTypeToString(unsigned int type)
 
 #define RES_SIZE 0
 #define RES_COMPRESSED 1
-int resourceSizeStats[7][2];
 #define STATS_TOTAL_SIZE 6
-int resourceUnitStats[7][2];
 
 /*
-	Read all entries from memlist.bin. Do not load anything in memory,
-	this is just a fast way to access the data later based on their id.
+	Read all entries from memlist.bin, or from the index of the archive when
+	one is open, or copy them from the AssetStore when shared. Do not load anything in memory, this is just a fast way to
+	access the data later based on their id.
 */
 void Resource::readEntries() {	
-	File f;
+	if (_assets) {
+		_numMemList = _assets->_numMemList;
+		memcpy(_memList, _assets->_memList, sizeof(_memList));
+		return;
+	}
+	File f(File::BACKEND_MAPPED);
 	int resourceCounter = 0;
 	
-
-	if (!f.open("memlist.bin", _dataDir)) {
-		error("Resource::readEntries() unable to open 'memlist.bin' file\n");
-		//Error will exit() no need to return or do anything else.
+	// the entries are parsed from the mapped file, one record every stride bytes
+	const uint8_t *p;
+	const uint8_t *end;
+	uint32_t stride;
+	if (_archive.isOpen()) {
+		p = _archive.getRecord(0);
+		stride = Archive::ENTRY_SIZE;
+		end = p + _archive._numEntries * stride;
+	} else {
+		if (!f.open("memlist.bin", _dataDir)) {
+			error("Resource::readEntries() unable to open 'memlist.bin' file\n");
+			//Error will exit() no need to return or do anything else.
+		}
+		p = f.getData();
+		stride = Archive::MEMLIST_ENTRY_SIZE;
+		end = p + f.getSize();
 	}
 
 	//Prepare stats array
+	int resourceSizeStats[7][2];
+	int resourceUnitStats[7][2];
 	memset(resourceSizeStats,0,sizeof(resourceSizeStats));
 	memset(resourceUnitStats,0,sizeof(resourceUnitStats));
 
@@ -83,17 +131,21 @@ void Resource::readEntries() {
 	MemEntry *memEntry = _memList;
 	while (1) {
 		assert(_numMemList < ARRAYSIZE(_memList));
-		memEntry->state = f.readByte();
-		memEntry->type = f.readByte();
-		memEntry->bufPtr = 0; f.readUint16BE();
-		memEntry->unk4 = f.readUint16BE();
-		memEntry->rankNum = f.readByte();
-		memEntry->bankId = f.readByte();
-		memEntry->bankOffset = f.readUint32BE();
-		memEntry->unkC = f.readUint16BE();
-		memEntry->packedSize = f.readUint16BE();
-		memEntry->unk10 = f.readUint16BE();
-		memEntry->size = f.readUint16BE();
+		if (p + Archive::MEMLIST_ENTRY_SIZE > end) {
+			error("Resource::readEntries() truncated memlist\n");
+		}
+		memEntry->state = p[0];
+		memEntry->type = p[1];
+		memEntry->bufPtr = 0;
+		memEntry->unk4 = READ_BE_UINT16(p + 4);
+		memEntry->rankNum = p[6];
+		memEntry->bankId = p[7];
+		memEntry->bankOffset = READ_BE_UINT32(p + 8);
+		memEntry->unkC = READ_BE_UINT16(p + 12);
+		memEntry->packedSize = READ_BE_UINT16(p + 14);
+		memEntry->unk10 = READ_BE_UINT16(p + 16);
+		memEntry->size = READ_BE_UINT16(p + 18);
+		p += stride;
 
     if (memEntry->state == MEMENTRY_STATE_END_OF_MEMLIST) {
       break;
@@ -188,38 +240,70 @@ void Resource::loadMarkedAsNeeded() {
 		// At this point the resource descriptor should be pointed to "me"
 		// "That's what she said"
 
+		if (me->bankId == 0) {
+			warning("Resource::load() ec=0x%X (me->bankId == 0)", 0xF00);
+			me->state = MEMENTRY_STATE_NOT_NEEDED;
+			continue;
+		}
+
 		uint8_t *loadDestination = NULL;
 		if (me->type == RT_POLY_ANIM) {
-			loadDestination = _vidCurPtr;
-		} else {
-			loadDestination = _scriptCurPtr;
-			if (me->size > _vidBakPtr - _scriptCurPtr) {
-				warning("Resource::load() not enough memory");
+			PROFILE_START(screenStart);
+			const uint8_t *screen = _cache.lookupScreen(me - _memList, Video::VID_PAGE_SIZE);
+			if (screen) {
+				video->copyScreen(screen, me - _memList);
 				me->state = MEMENTRY_STATE_NOT_NEEDED;
+				PROFILE_RESOURCE(_profiler, RES_CACHE, me->size, screenStart);
 				continue;
 			}
+			if (me->size > MemArena::VIDEO_SIZE) {
+				error("Resource::load() bitmap entry %d does not fit, %d bytes", me - _memList, me->size);
+			}
+			loadDestination = _arena._vidPtr;
+		} else {
+			loadDestination = _arena.alloc(me->size);
+			if (!loadDestination) {
+				error("Resource::load() not enough memory for entry %d, %d bytes needed, %d bytes free of %d, see --memsize",
+					me - _memList, me->size, _arena.getCapacity() - _arena.getUsed(), _arena.getCapacity());
+			}
 		}
 
-
-		if (me->bankId == 0) {
-			warning("Resource::load() ec=0x%X (me->bankId == 0)", 0xF00);
+		debug(DBG_BANK, "Resource::load() bufPos=%X size=%X type=%X pos=%X bankId=%X", loadDestination - _arena._base, me->packedSize, me->type, me->bankOffset, me->bankId);
+		readBank(me, loadDestination);
+		if(me->type == RT_POLY_ANIM) {
+			video->copyPage(loadDestination, me - _memList);
+			_cache.insertScreen(me - _memList, video->_pages[0], Video::VID_PAGE_SIZE);
 			me->state = MEMENTRY_STATE_NOT_NEEDED;
 		} else {
-			debug(DBG_BANK, "Resource::load() bufPos=%X size=%X type=%X pos=%X bankId=%X", loadDestination - _memPtrStart, me->packedSize, me->type, me->bankOffset, me->bankId);
-			readBank(me, loadDestination);
-			if(me->type == RT_POLY_ANIM) {
-        video->copyPage(_vidCurPtr);
-				me->state = MEMENTRY_STATE_NOT_NEEDED;
-			} else {
-				me->bufPtr = loadDestination;
-				me->state = MEMENTRY_STATE_LOADED;
-				_scriptCurPtr += me->size;
-			}
+			me->bufPtr = loadDestination;
+			me->state = MEMENTRY_STATE_LOADED;
 		}
-
 	}
 
+	PROFILE_MEMORY(_profiler, _arena.getPartSize(), _arena.getUsed());
+}
 
+/*
+	Read the bitmap resource num converted to a page, out of the resources of
+	the current part, for the page deltas of the game states.
+*/
+bool Resource::readScreen(uint16_t num, uint8_t *dst) {
+	if (num >= _numMemList) {
+		return false;
+	}
+	const MemEntry *me = &_memList[num];
+	if (me->type != RT_POLY_ANIM || me->bankId == 0 || me->size > MemArena::VIDEO_SIZE) {
+		return false;
+	}
+	const uint8_t *screen = _cache.lookupScreen(num, Video::VID_PAGE_SIZE);
+	if (screen) {
+		memcpy(dst, screen, Video::VID_PAGE_SIZE);
+		return true;
+	}
+	readBank(me, _arena._vidPtr);
+	Video::convertPage(_arena._vidPtr, dst);
+	_cache.insertScreen(num, dst, Video::VID_PAGE_SIZE);
+	return true;
 }
 
 void Resource::invalidateRes() {
@@ -231,7 +315,8 @@ void Resource::invalidateRes() {
 		}
 		++me;
 	}
-	_scriptCurPtr = _scriptBakPtr;
+	_arena.resetScene();
+	video->_polygonCache.clear();
 }
 
 void Resource::invalidateAll() {
@@ -241,7 +326,7 @@ void Resource::invalidateAll() {
 		me->state = MEMENTRY_STATE_NOT_NEEDED;
 		++me;
 	}
-	_scriptCurPtr = _memPtrStart;
+	_arena.resetAll();
 }
 
 /* This method serves two purpose: 
@@ -256,6 +341,7 @@ void Resource::loadPartsOrMemoryEntry(uint16_t resourceId) {
 	if (resourceId > _numMemList) {
 
 		requestedNextPart = resourceId;
+		prefetchPart(resourceId);
 
 	} else {
 
@@ -292,6 +378,7 @@ void Resource::setupPart(uint16_t partId) {
 
 	// Mark all resources as located on harddrive.
 	invalidateAll();
+	video->_polygonCache.clear();
 
 	_memList[paletteIndex].state = MEMENTRY_STATE_LOAD_ME;
 	_memList[codeIndex].state = MEMENTRY_STATE_LOAD_ME;
@@ -328,21 +415,143 @@ void Resource::setupPart(uint16_t partId) {
 
 
 	currentPartId = partId;
-	
 
-	// _scriptCurPtr is changed in this->load();
-	_scriptBakPtr = _scriptCurPtr;	
+	decodeProgram();
+
+	// the scene resources are allocated after the part ones, and freed by invalidateRes()
+	_arena.commitPart();
+	debug(DBG_RES, "Part data: %d bytes of %d", _arena.getPartSize(), _arena.getCapacity());
+
+	prefetchResources();
 }
 
-void Resource::allocMemBlock() {
-	_memPtrStart = (uint8_t *)malloc(MEM_BLOCK_SIZE);
-	_scriptBakPtr = _scriptCurPtr = _memPtrStart;
-	_vidBakPtr = _vidCurPtr = _memPtrStart + MEM_BLOCK_SIZE - 0x800 * 16; //0x800 = 2048, so we have 32KB free for vidBack and vidCur
+/*
+	Starts unpacking the segments of partId which are not already cached. The
+	Prefetcher is not started when the option is off, this is then a no-op.
+	Nothing is unpacked when the resources are read from an archive.
+*/
+void Resource::prefetchPart(uint16_t partId) {
+	if (partId < GAME_PART_FIRST || partId > GAME_PART_LAST || partId == currentPartId || _archive.isOpen()) {
+		return;
+	}
+	uint16_t nums[Prefetcher::MAX_ENTRIES];
+	const int count = addPartSegments(partId, nums, 0);
+	_prefetcher.request(partId, nums, count);
+}
+
+// The segments of partId which are not cached are appended to nums
+int Resource::addPartSegments(uint16_t partId, uint16_t *nums, int count) const {
+	const uint16_t *part = memListParts[partId - GAME_PART_FIRST];
+	for (int i = MEMLIST_PART_PALETTE; i <= MEMLIST_PART_VIDEO2 && count < Prefetcher::MAX_ENTRIES; ++i) {
+		const uint16_t num = part[i];
+		if ((i != MEMLIST_PART_VIDEO2 || num != MEMLIST_PART_NONE) && !_cache.contains(num) && _memList[num].bankId != 0) {
+			nums[count++] = num;
+		}
+	}
+	return count;
+}
+
+/*
+	Starts unpacking the resources the bytecode of the current part may load
+	with op_updateMemList(), in the order the analysis reached them, then the
+	segments of the part it switches to. When the code reaches several parts
+	(the protection screen, the code input), the next one is assumed.
+*/
+void Resource::prefetchResources() {
+	if (_archive.isOpen() || _assets) {
+		return;
+	}
+	uint16_t nums[Prefetcher::MAX_ENTRIES];
+	int count = 0;
+	for (size_t i = 0; i < _analysis._resources.size() && count < Prefetcher::MAX_ENTRIES; ++i) {
+		const uint16_t num = _analysis._resources[i];
+		const MemEntry *me = &_memList[num];
+		if (me->bankId == 0 || me->state != MEMENTRY_STATE_NOT_NEEDED || _cache.contains(num) || _cache.containsScreen(num)) {
+			continue;
+		}
+		nums[count++] = num;
+	}
+	uint16_t nextPartId = currentPartId + 1;
+	if (_analysis._parts.size() == 1) {
+		nextPartId = _analysis._parts[0];
+	}
+	if (nextPartId >= GAME_PART_FIRST && nextPartId <= GAME_PART_LAST && nextPartId != currentPartId) {
+		count = addPartSegments(nextPartId, nums, count);
+	}
+	_prefetcher.request(currentPartId, nums, count);
+}
+
+void Resource::decodeProgram() {
+	_analysis.clear();
+	_program.clear();
+	if (currentPartId >= GAME_PART_FIRST && currentPartId <= GAME_PART_LAST) {
+		uint8_t codeIndex = memListParts[currentPartId - GAME_PART_FIRST][MEMLIST_PART_CODE];
+		_analysis.analyze(segBytecode, _memList[codeIndex].size, currentPartId, _numMemList);
+		if (_decodeProgram) {
+			_program.decode(segBytecode, _memList[codeIndex].size, currentPartId, &_analysis);
+		}
+	}
+}
+
+void Resource::allocMemBlock(uint32_t size) {
+	if (!_arena.init(size)) {
+		error("Resource::allocMemBlock() unable to allocate %d bytes", size);
+	}
 	_useSegVideo2 = false;
 }
 
 void Resource::freeMemBlock() {
-	free(_memPtrStart);
+	debug(DBG_RES, "Memory high water marks: %d bytes of part data, %d bytes in total, of %d", _arena._partHighWater, _arena._highWater, _arena.getCapacity());
+	_arena.free();
+}
+
+void Resource::captureState(State &st) const {
+	st.generation = _arena._generation;
+	st.currentPartId = currentPartId;
+	st.requestedNextPart = requestedNextPart;
+	st.partEnd = _arena._partEnd;
+	st.cur = _arena._cur;
+	st.useSegVideo2 = _useSegVideo2;
+	st.segPalettes = segPalettes;
+	st.segBytecode = segBytecode;
+	st.segCinematic = segCinematic;
+	st.segVideo2 = _segVideo2;
+	for (uint16_t i = 0; i < _numMemList; ++i) {
+		st.entryState[i] = _memList[i].state;
+		st.entryBufPtr[i] = _memList[i].bufPtr;
+	}
+}
+
+/*
+	Nothing was allocated since the capture when the generations match, the
+	arena holds the same resources and only the pointers are restored.
+	Otherwise the entries loaded at the time are read again at their offsets.
+*/
+void Resource::restoreState(const State &st) {
+	currentPartId = st.currentPartId;
+	requestedNextPart = st.requestedNextPart;
+	_arena._partEnd = st.partEnd;
+	_arena._cur = st.cur;
+	_useSegVideo2 = st.useSegVideo2;
+	segPalettes = st.segPalettes;
+	segBytecode = st.segBytecode;
+	segCinematic = st.segCinematic;
+	_segVideo2 = st.segVideo2;
+	for (uint16_t i = 0; i < _numMemList; ++i) {
+		_memList[i].state = st.entryState[i];
+		_memList[i].bufPtr = st.entryBufPtr[i];
+	}
+	if (_arena._generation != st.generation) {
+		for (uint16_t i = 0; i < _numMemList; ++i) {
+			MemEntry *me = &_memList[i];
+			if (me->state == MEMENTRY_STATE_LOADED) {
+				readBank(me, me->bufPtr);
+			}
+		}
+		_arena._generation = st.generation;
+		decodeProgram();
+		video->_polygonCache.clear();
+	}
 }
 
 void Resource::saveOrLoad(Serializer &ser) {
@@ -350,7 +559,7 @@ void Resource::saveOrLoad(Serializer &ser) {
 	if (ser._mode == Serializer::SM_SAVE) {
 		memset(loadedList, 0, sizeof(loadedList));
 		uint8_t *p = loadedList;
-		uint8_t *q = _memPtrStart;
+		uint8_t *q = _arena._base;
 		while (1) {
 			MemEntry *it = _memList;
 			MemEntry *me = 0;
@@ -371,13 +580,16 @@ void Resource::saveOrLoad(Serializer &ser) {
 		}
 	}
 
+	// the bitmap region is at the end of the block, it moves with --memsize
+	uint8_t *vidBakPtr = _arena._vidPtr;
+	uint8_t *vidCurPtr = _arena._vidPtr;
 	Serializer::Entry entries[] = {
 		SE_ARRAY(loadedList, 64, Serializer::SES_INT8, VER(1)),
 		SE_INT(&currentPartId, Serializer::SES_INT16, VER(1)),
-		SE_PTR(&_scriptBakPtr, VER(1)),
-		SE_PTR(&_scriptCurPtr, VER(1)),
-		SE_PTR(&_vidBakPtr, VER(1)),
-		SE_PTR(&_vidCurPtr, VER(1)),
+		SE_PTR(&_arena._partEnd, VER(1)),
+		SE_PTR(&_arena._cur, VER(1)),
+		SE_PTR(&vidBakPtr, VER(1)),
+		SE_PTR(&vidCurPtr, VER(1)),
 		SE_INT(&_useSegVideo2, Serializer::SES_BOOL, VER(1)),
 		SE_PTR(&segPalettes, VER(1)),
 		SE_PTR(&segBytecode, VER(1)),
@@ -388,14 +600,24 @@ void Resource::saveOrLoad(Serializer &ser) {
 
 	ser.saveOrLoadEntries(entries);
 	if (ser._mode == Serializer::SM_LOAD) {
+		if (_arena._partEnd < _arena._base || _arena._cur < _arena._partEnd || _arena._cur > _arena._vidPtr) {
+			error("Resource::saveOrLoad() the game state does not fit in %d bytes, see --memsize", _arena.getCapacity());
+		}
 		uint8_t *p = loadedList;
-		uint8_t *q = _memPtrStart;
+		uint8_t *q = _arena._base;
 		while (*p) {
 			MemEntry *me = &_memList[*p++];
+			if (q + me->size > _arena._cur) {
+				error("Resource::saveOrLoad() inconsistent game state");
+			}
 			readBank(me, q);
 			me->bufPtr = q;
 			me->state = MEMENTRY_STATE_LOADED;
 			q += me->size;
 		}
+		// the snapshots taken before have to read their entries again
+		++_arena._generation;
+		decodeProgram();
+		video->_polygonCache.clear();
 	}	
 }
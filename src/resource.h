@@ -20,6 +20,14 @@
 #define __RESOURCE_H__
 
 #include "intern.h"
+#include "archive.h"
+#include "arena.h"
+#include "bank.h"
+#include "prefetch.h"
+#include "profiler.h"
+#include "analyzer.h"
+#include "program.h"
+#include "rescache.h"
 
 
 #define MEMENTRY_STATE_END_OF_MEMLIST 0xFF
@@ -56,6 +64,7 @@ struct MemEntry {
     See MEMENTRY_STATE_* #defines above.
 */
 
+struct AssetStore;
 struct Serializer;
 struct Video;
 
@@ -77,16 +86,31 @@ struct Resource {
 	};
 	
 	enum {
-		MEM_BLOCK_SIZE = 600 * 1024   //600kb total memory consumed (not taking into account stack and static heap)
+		MEM_BLOCK_SIZE = 600 * 1024,   //600kb total memory consumed (not taking into account stack and static heap), default size of _arena
+		MAX_MEM_ENTRIES = 150
+	};
+
+	// Entries and segments, for the rewind snapshots. The content of the arena is
+	// not copied, it is read again from the banks when generation does not match.
+	struct State {
+		uint32_t generation;
+		uint16_t currentPartId, requestedNextPart;
+		uint8_t *partEnd, *cur;
+		bool useSegVideo2;
+		uint8_t *segPalettes;
+		uint8_t *segBytecode;
+		uint8_t *segCinematic;
+		uint8_t *segVideo2;
+		uint8_t entryState[MAX_MEM_ENTRIES];
+		uint8_t *entryBufPtr[MAX_MEM_ENTRIES];
 	};
-	
 	
 	Video *video;
 	const char *_dataDir;
-	MemEntry _memList[150];
+	MemEntry _memList[MAX_MEM_ENTRIES];
 	uint16_t _numMemList;
 	uint16_t currentPartId, requestedNextPart;
-	uint8_t *_memPtrStart, *_scriptBakPtr, *_scriptCurPtr, *_vidBakPtr, *_vidCurPtr;
+	MemArena _arena;
 	bool _useSegVideo2;
 
 	uint8_t *segPalettes;
@@ -94,18 +118,50 @@ struct Resource {
 	uint8_t *segCinematic;
 	uint8_t *_segVideo2;
 
+	// reachable code and resources of segBytecode
+	ScriptAnalysis _analysis;
+
+	// pre-decoded segBytecode, empty when the threaded interpreter is disabled
+	Program _program;
+	bool _decodeProgram;
+
+	// unpacked entries, see ResourceCache::_maxSize
+	ResourceCache _cache;
+
+	BankFiles _bankFiles;
+
+	// pre-unpacked resources, read instead of memlist.bin and the banks when open
+	Archive _archive;
+
+	// segments of the next part, unpacked on a worker thread when it is started
+	Prefetcher _prefetcher;
+
+	// memlist and unpacked entries shared with other engines, 0 to read them from the files
+	const AssetStore *_assets;
+
+#ifdef ENABLE_PROFILER
+	Profiler *_profiler;
+#endif
+
 	Resource(Video *vid, const char *dataDir);
 	
 	void readBank(const MemEntry *me, uint8_t *dstBuf);
+	bool readScreen(uint16_t num, uint8_t *dst);
 	void readEntries();
 	void loadMarkedAsNeeded();
 	void invalidateAll();
 	void invalidateRes();	
 	void loadPartsOrMemoryEntry(uint16_t num);
 	void setupPart(uint16_t ptrId);
-	void allocMemBlock();
+	void prefetchPart(uint16_t partId);
+	void prefetchResources();
+	int addPartSegments(uint16_t partId, uint16_t *nums, int count) const;
+	void decodeProgram();
+	void allocMemBlock(uint32_t size = MEM_BLOCK_SIZE);
 	void freeMemBlock();
-	
+
+	void captureState(State &st) const;
+	void restoreState(const State &st);
 	void saveOrLoad(Serializer &ser);
 };
 
@@ -0,0 +1,52 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "scheduler.h"
+#include "sys.h"
+
+FrameScheduler::FrameScheduler(System *sys)
+	: _sys(sys), _frameSkip(false), _resync(false), _deadline(0), _frameEnd(0), _frameInterval(NO_INTERVAL), _skippedFrames(0) {
+}
+
+// The next frame is presented at once, and paced from then on, the time
+// spent before (pause, load) is not counted in its interval
+void FrameScheduler::reset() {
+	_resync = true;
+	_frameEnd = _sys->getHighResTimeStamp();
+}
+
+bool FrameScheduler::waitFrame(uint32_t duration) {
+	const uint64_t now = _sys->getHighResTimeStamp();
+	bool present = true;
+	_deadline += duration * 1000;
+	if (_resync || now >= _deadline + MAX_LATENESS) {
+		_deadline = now;
+		_resync = false;
+	} else if (now < _deadline) {
+		// the leftover microseconds are carried by the deadline
+		_sys->sleep((_deadline - now) / 1000);
+	} else if (_frameSkip && now >= _deadline + duration * 1000 && _skippedFrames < MAX_SKIPPED_FRAMES) {
+		present = false;
+	}
+	_skippedFrames = present ? 0 : _skippedFrames + 1;
+	const uint64_t end = _sys->getHighResTimeStamp();
+	_frameInterval = (_frameEnd != 0) ? (uint32_t)(end - _frameEnd) : (uint32_t)NO_INTERVAL;
+	_frameEnd = end;
+	return present;
+}
@@ -0,0 +1,63 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include "intern.h"
+
+struct System;
+
+/*
+	Paces the frames on deadlines: each op_blitFramebuffer() is due
+	PAUSE_SLICES * 20 ms after the deadline of the previous frame, instead of
+	after the time the previous frame was displayed. An overrun is then made
+	up on the next frames instead of being lost, unless the frame is more
+	than MAX_LATENESS late, or after a reset() (pause, rewind, load), where
+	the schedule restarts from the current time without waiting.
+
+	With frame skipping, a frame which is still late by a whole frame when
+	it is due is not presented, at most MAX_SKIPPED_FRAMES in a row. The VM
+	and the pages are updated for it as usual.
+*/
+struct FrameScheduler {
+	enum {
+		MAX_LATENESS = 200 * 1000, // us
+		MAX_SKIPPED_FRAMES = 4
+	};
+
+	enum {
+		NO_INTERVAL = 0xFFFFFFFF // the first frame, there is no previous one
+	};
+
+	System *_sys;
+	bool _frameSkip;
+	bool _resync;
+	uint64_t _deadline;      // us, of the current frame
+	uint64_t _frameEnd;      // us, when the previous frame was due or done
+	uint32_t _frameInterval; // us, between the two last frames, or NO_INTERVAL
+	uint32_t _skippedFrames; // in a row
+
+	FrameScheduler(System *sys);
+
+	void reset();
+	bool waitFrame(uint32_t duration); // ms, false if the frame is to be skipped
+};
+
+#endif
@@ -26,13 +26,15 @@
 #define SE_INT(i,sz,ver)     { Serializer::SET_INT, sz, 1, i, ver, Serializer::CUR_VER }
 #define SE_ARRAY(a,n,sz,ver) { Serializer::SET_ARRAY, sz, n, a, ver, Serializer::CUR_VER }
 #define SE_PTR(p,ver)        { Serializer::SET_PTR, 0, 0, p, ver, Serializer::CUR_VER }
+// only loaded from the versions [ver, maxVer], not saved anymore
+#define SE_ARRAY_UPTO(a,n,sz,ver,maxVer) { Serializer::SET_ARRAY, sz, n, a, ver, maxVer }
 #define SE_END()             { Serializer::SET_END, 0, 0, 0, 0, 0 }
 
 struct File;
 
 struct Serializer {
 	enum {
-		CUR_VER = 2
+		CUR_VER = 3 // a StateWriter file, the pages are stored as deltas
 	};
 
 	enum EntryType {
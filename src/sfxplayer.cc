@@ -24,7 +24,8 @@
 
 
 SfxPlayer::SfxPlayer(Mixer *mix, Resource *res, System *stub)
-	: mixer(mix), res(res), sys(stub), _delay(0), _resNum(0) {
+	: mixer(mix), res(res), sys(stub), _delay(0), _resNum(0), _audioSequencer(false), _playing(false), _samplesLeft(0), _sampleRemainder(0), _snapshotSeq(0) {
+	memset(&_snapshot, 0, sizeof(_snapshot));
 }
 
 void SfxPlayer::init() {
@@ -36,49 +37,84 @@ void SfxPlayer::free() {
 	sys->destroyMutex(_mutex);
 }
 
+static MixerCommand musicCommand(uint8_t type) {
+	MixerCommand cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.type = type;
+	return cmd;
+}
+
 void SfxPlayer::setEventsDelay(uint16_t delay) {
 	debug(DBG_SND, "SfxPlayer::setEventsDelay(%d)", delay);
+	if (_audioSequencer) {
+		MixerCommand cmd = musicCommand(MixerCommand::CMD_MUSIC_DELAY);
+		cmd.delay = delay * 60 / 7050;
+		mixer->sendCommand(cmd);
+		return;
+	}
 	const MutexStack lock(sys, _mutex);
 	_delay = delay * 60 / 7050;
 }
 
 void SfxPlayer::loadSfxModule(uint16_t resNum, uint16_t delay, uint8_t pos) {
-
 	debug(DBG_SND, "SfxPlayer::loadSfxModule(0x%X, %d, %d)", resNum, delay, pos);
+	SfxModule mod;
+	uint16_t eventsDelay;
+	if (!loadModule(resNum, delay, pos, &mod, &eventsDelay)) {
+		return;
+	}
+	if (_audioSequencer) {
+		MixerCommand cmd = musicCommand(MixerCommand::CMD_MUSIC_LOAD);
+		cmd.resNum = resNum;
+		cmd.delay = eventsDelay;
+		cmd.module = mod;
+		mixer->sendCommand(cmd);
+		return;
+	}
 	const MutexStack lock(sys, _mutex);
+	_resNum = resNum;
+	_sfxMod = mod;
+	_delay = eventsDelay;
+}
 
+/*
+	Called from the virtual machine thread only, as it reads the memory block
+	and patches the instruments. The module and its delay in ms are returned
+	in mod and eventsDelay, for the timer or the audio thread.
+*/
+bool SfxPlayer::loadModule(uint16_t resNum, uint16_t delay, uint8_t pos, SfxModule *mod, uint16_t *eventsDelay) {
 
 	MemEntry *me = &res->_memList[resNum];
 
 	if (me->state == MEMENTRY_STATE_LOADED && me->type == Resource::RT_MUSIC) {
-		_resNum = resNum;
-		memset(&_sfxMod, 0, sizeof(SfxModule));
-		_sfxMod.curOrder = pos;
-		_sfxMod.numOrder = READ_BE_UINT16(me->bufPtr + 0x3E);
-		debug(DBG_SND, "SfxPlayer::loadSfxModule() curOrder = 0x%X numOrder = 0x%X", _sfxMod.curOrder, _sfxMod.numOrder);
+		memset(mod, 0, sizeof(SfxModule));
+		mod->curOrder = pos;
+		mod->numOrder = READ_BE_UINT16(me->bufPtr + 0x3E);
+		debug(DBG_SND, "SfxPlayer::loadSfxModule() curOrder = 0x%X numOrder = 0x%X", mod->curOrder, mod->numOrder);
 		for (int i = 0; i < 0x80; ++i) {
-			_sfxMod.orderTable[i] = *(me->bufPtr + 0x40 + i);
+			mod->orderTable[i] = *(me->bufPtr + 0x40 + i);
 		}
 		if (delay == 0) {
-			_delay = READ_BE_UINT16(me->bufPtr);
+			*eventsDelay = READ_BE_UINT16(me->bufPtr);
 		} else {
-			_delay = delay;
+			*eventsDelay = delay;
 		}
-		_delay = _delay * 60 / 7050;
-		_sfxMod.data = me->bufPtr + 0xC0;
-		debug(DBG_SND, "SfxPlayer::loadSfxModule() eventDelay = %d ms", _delay);
-		prepareInstruments(me->bufPtr + 2);
-	} else {
-		warning("SfxPlayer::loadSfxModule() ec=0x%X", 0xF8);
+		*eventsDelay = *eventsDelay * 60 / 7050;
+		mod->data = me->bufPtr + 0xC0;
+		debug(DBG_SND, "SfxPlayer::loadSfxModule() eventDelay = %d ms", *eventsDelay);
+		prepareInstruments(me->bufPtr + 2, mod);
+		return true;
 	}
+	warning("SfxPlayer::loadSfxModule() ec=0x%X", 0xF8);
+	return false;
 }
 
-void SfxPlayer::prepareInstruments(const uint8_t *p) {
+void SfxPlayer::prepareInstruments(const uint8_t *p, SfxModule *mod) {
 
-	memset(_sfxMod.samples, 0, sizeof(_sfxMod.samples));
+	memset(mod->samples, 0, sizeof(mod->samples));
 
 	for (int i = 0; i < 15; ++i) {
-		SfxInstrument *ins = &_sfxMod.samples[i];
+		SfxInstrument *ins = &mod->samples[i];
 		uint16_t resNum = READ_BE_UINT16(p); p += 2;
 		if (resNum != 0) {
 			ins->volume = READ_BE_UINT16(p);
@@ -97,13 +133,21 @@ void SfxPlayer::prepareInstruments(const uint8_t *p) {
 
 void SfxPlayer::start() {
 	debug(DBG_SND, "SfxPlayer::start()");
+	if (_audioSequencer) {
+		mixer->sendCommand(musicCommand(MixerCommand::CMD_MUSIC_START));
+		return;
+	}
 	const MutexStack lock(sys, _mutex);
 	_sfxMod.curPos = 0;
-	_timerId = sys->addTimer(_delay, eventsCallback, this);			
+	_timerId = sys->addTimer(_delay, eventsCallback, this);
 }
 
 void SfxPlayer::stop() {
 	debug(DBG_SND, "SfxPlayer::stop()");
+	if (_audioSequencer) {
+		mixer->sendCommand(musicCommand(MixerCommand::CMD_MUSIC_STOP));
+		return;
+	}
 	const MutexStack lock(sys, _mutex);
 	if (_resNum != 0) {
 		_resNum = 0;
@@ -112,7 +156,6 @@ void SfxPlayer::stop() {
 }
 
 void SfxPlayer::handleEvents() {
-	const MutexStack lock(sys, _mutex);
 	uint8_t order = _sfxMod.orderTable[_sfxMod.curOrder];
 	const uint8_t *patternData = _sfxMod.data + _sfxMod.curPos + order * 1024;
 	for (uint8_t ch = 0; ch < 4; ++ch) {
@@ -126,7 +169,11 @@ void SfxPlayer::handleEvents() {
 		order = _sfxMod.curOrder + 1;
 		if (order == _sfxMod.numOrder) {
 			_resNum = 0;
-			sys->removeTimer(_timerId);
+			if (_audioSequencer) {
+				_playing = false;
+			} else {
+				sys->removeTimer(_timerId);
+			}
 			mixer->stopAll();
 		}
 		_sfxMod.curOrder = order;
@@ -202,25 +249,150 @@ void SfxPlayer::handlePattern(uint8_t channel, const uint8_t *data) {
 
 uint32_t SfxPlayer::eventsCallback(uint32_t interval, void *param) {
 	SfxPlayer *p = (SfxPlayer *)param;
+	const MutexStack lock(p->sys, p->_mutex);
 	p->handleEvents();
 	return p->_delay;
 }
 
+// Called from the audio thread only, like the functions below
+void SfxPlayer::processCommand(const MixerCommand &cmd) {
+	switch (cmd.type) {
+	case MixerCommand::CMD_MUSIC_LOAD:
+		_resNum = cmd.resNum;
+		_sfxMod = cmd.module;
+		_delay = cmd.delay;
+		break;
+	case MixerCommand::CMD_MUSIC_START:
+		_sfxMod.curPos = 0;
+		_playing = true;
+		_sampleRemainder = 0;
+		scheduleRow();
+		break;
+	case MixerCommand::CMD_MUSIC_STOP:
+		_resNum = 0;
+		_playing = false;
+		break;
+	case MixerCommand::CMD_MUSIC_DELAY:
+		_delay = cmd.delay;
+		break;
+	case MixerCommand::CMD_MUSIC_RESTORE:
+		_resNum = cmd.resNum;
+		_sfxMod = cmd.module;
+		_delay = cmd.delay;
+		_playing = true;
+		_sampleRemainder = 0;
+		scheduleRow();
+		break;
+	}
+}
+
+/*
+	The rows are _delay ms apart. The remainder of the conversion to samples is
+	carried over to the next row, so the music does not drift from the timers.
+*/
+void SfxPlayer::scheduleRow() {
+	const uint32_t len = _delay * sys->getOutputSampleRate() + _sampleRemainder;
+	_samplesLeft = len / 1000;
+	_sampleRemainder = len % 1000;
+}
+
+/*
+	Plays the rows falling due, then returns the number of samples which can be
+	mixed before the next one, at most count. Like a timer returning a zero
+	interval, a null delay stops the music after the current row.
+*/
+uint32_t SfxPlayer::processRows(uint32_t count) {
+	while (_playing && _samplesLeft == 0) {
+		handleEvents();
+		if (_delay == 0) {
+			_playing = false;
+		}
+		if (_playing) {
+			scheduleRow();
+		}
+	}
+	return _playing ? MIN(count, _samplesLeft) : count;
+}
+
+void SfxPlayer::consumeSamples(uint32_t count) {
+	if (_playing) {
+		_samplesLeft -= count;
+	}
+}
+
+void SfxPlayer::publishSnapshot() {
+	_snapshotSeq.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	_snapshot.delay = _delay;
+	_snapshot.resNum = _playing ? _resNum : 0;
+	_snapshot.curPos = _sfxMod.curPos;
+	_snapshot.curOrder = _sfxMod.curOrder;
+	_snapshotSeq.fetch_add(1, std::memory_order_release);
+}
+
+/*
+	In sequencer mode, the state captured is the one of the last mixed buffer,
+	and the restored one is sent to the audio thread like the other commands.
+*/
+void SfxPlayer::captureState(State &st) {
+	if (_audioSequencer) {
+		while (1) {
+			const uint32_t seq = _snapshotSeq.load(std::memory_order_acquire);
+			if (seq & 1) {
+				continue;
+			}
+			st = _snapshot;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (_snapshotSeq.load(std::memory_order_relaxed) == seq) {
+				break;
+			}
+		}
+		return;
+	}
+	const MutexStack lock(sys, _mutex);
+	st.delay = _delay;
+	st.resNum = _resNum;
+	st.curPos = _sfxMod.curPos;
+	st.curOrder = _sfxMod.curOrder;
+}
+
+void SfxPlayer::restoreState(const State &st) {
+	stop();
+	if (st.resNum == 0) {
+		return;
+	}
+	if (_audioSequencer) {
+		MixerCommand cmd = musicCommand(MixerCommand::CMD_MUSIC_RESTORE);
+		uint16_t eventsDelay;
+		if (!loadModule(st.resNum, 0, st.curOrder, &cmd.module, &eventsDelay)) {
+			return;
+		}
+		cmd.resNum = st.resNum;
+		cmd.delay = st.delay;
+		mixer->sendCommand(cmd);
+		return;
+	}
+	loadSfxModule(st.resNum, 0, st.curOrder);
+	const MutexStack lock(sys, _mutex);
+	_delay = st.delay;
+	_timerId = sys->addTimer(_delay, eventsCallback, this);
+}
+
 void SfxPlayer::saveOrLoad(Serializer &ser) {
-	sys->lockMutex(_mutex);
+	State st;
+	memset(&st, 0, sizeof(st));
+	if (ser._mode == Serializer::SM_SAVE) {
+		captureState(st);
+	}
 	Serializer::Entry entries[] = {
-		SE_INT(&_delay, Serializer::SES_INT8, VER(2)),
-		SE_INT(&_resNum, Serializer::SES_INT16, VER(2)),
-		SE_INT(&_sfxMod.curPos, Serializer::SES_INT16, VER(2)),
-		SE_INT(&_sfxMod.curOrder, Serializer::SES_INT8, VER(2)),
+		SE_INT(&st.delay, Serializer::SES_INT8, VER(2)),
+		SE_INT(&st.resNum, Serializer::SES_INT16, VER(2)),
+		SE_INT(&st.curPos, Serializer::SES_INT16, VER(2)),
+		SE_INT(&st.curOrder, Serializer::SES_INT8, VER(2)),
 		SE_END()
 	};
 	ser.saveOrLoadEntries(entries);
-	sys->unlockMutex(_mutex);
-	if (ser._mode == Serializer::SM_LOAD && _resNum != 0) {
-		uint16_t delay = _delay;
-		loadSfxModule(_resNum, 0, _sfxMod.curOrder);
-		_delay = delay;
-		_timerId = sys->addTimer(_delay, eventsCallback, this);
+	if (ser._mode == Serializer::SM_LOAD) {
+		restoreState(st);
 	}
 }
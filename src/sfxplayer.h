@@ -19,6 +19,7 @@
 #ifndef __SFXPLAYER_H__
 #define __SFXPLAYER_H__
 
+#include <atomic>
 #include "intern.h"
 
 struct SfxInstrument {
@@ -48,11 +49,20 @@ struct SfxPattern {
 };
 
 struct Mixer;
+struct MixerCommand;
 struct Resource;
 struct Serializer;
 struct System;
 
 struct SfxPlayer {
+	// Playback position, saved in the game states and the rewind snapshots
+	struct State {
+		uint16_t delay;
+		uint16_t resNum; // 0 when no module is playing
+		uint16_t curPos;
+		uint8_t curOrder;
+	};
+
 	Mixer *mixer;
 	Resource *res;
 	System *sys;
@@ -64,13 +74,27 @@ struct SfxPlayer {
 	SfxModule _sfxMod;
 	int16_t *_markVar;
 
+	// When set, the rows are not scheduled with a timer but from Mixer::mix(),
+	// by counting the output samples. The module is then only accessed from the
+	// audio thread, the calls above are sent as mixer commands, with the module
+	// already resolved from the resources on the virtual machine thread.
+	bool _audioSequencer;
+	bool _playing;
+	uint32_t _samplesLeft;     // samples to mix before the next row
+	uint32_t _sampleRemainder; // fractional part of the row length, in 1/1000 sample
+
+	// Copy of the sequencer state for the savegames, see Mixer::_snapshot
+	State _snapshot;
+	std::atomic<uint32_t> _snapshotSeq;
+
 	SfxPlayer(Mixer *mix, Resource *res, System *stub);
 	void init();
 	void free();
 
 	void setEventsDelay(uint16_t delay);
 	void loadSfxModule(uint16_t resNum, uint16_t delay, uint8_t pos);
-	void prepareInstruments(const uint8_t *p);
+	bool loadModule(uint16_t resNum, uint16_t delay, uint8_t pos, SfxModule *mod, uint16_t *eventsDelay);
+	void prepareInstruments(const uint8_t *p, SfxModule *mod);
 	void start();
 	void stop();
 	void handleEvents();
@@ -78,6 +102,14 @@ struct SfxPlayer {
 
 	static uint32_t eventsCallback(uint32_t interval, void *param);
 
+	void processCommand(const MixerCommand &cmd);
+	void scheduleRow();
+	uint32_t processRows(uint32_t count);
+	void consumeSamples(uint32_t count);
+	void publishSnapshot();
+
+	void captureState(State &st);
+	void restoreState(const State &st);
 	void saveOrLoad(Serializer &ser);
 };
 
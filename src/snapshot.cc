@@ -0,0 +1,61 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "snapshot.h"
+
+
+SnapshotRing::SnapshotRing()
+	: _snapshots(0), _size(0), _head(0), _count(0) {
+}
+
+bool SnapshotRing::init(uint32_t seconds) {
+	_size = seconds * SNAPSHOTS_PER_SECOND;
+	_snapshots = (GameSnapshot *)malloc(_size * sizeof(GameSnapshot));
+	if (!_snapshots) {
+		_size = 0;
+		return false;
+	}
+	clear();
+	return true;
+}
+
+void SnapshotRing::free() {
+	::free(_snapshots);
+	_snapshots = 0;
+	_size = 0;
+	clear();
+}
+
+GameSnapshot *SnapshotRing::push() {
+	GameSnapshot *gs = &_snapshots[_head];
+	_head = (_head + 1) % _size;
+	if (_count < _size) {
+		++_count;
+	}
+	return gs;
+}
+
+GameSnapshot *SnapshotRing::pop() {
+	if (_count == 0) {
+		return 0;
+	}
+	_head = (_head + _size - 1) % _size;
+	--_count;
+	return &_snapshots[_head];
+}
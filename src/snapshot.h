@@ -0,0 +1,69 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "intern.h"
+#include "mixer.h"
+#include "resource.h"
+#include "sfxplayer.h"
+#include "video.h"
+#include "vm.h"
+
+/*
+	The state of the engine in its native layout, a copy of the modules
+	fields without any conversion so that it can be taken every frame. The
+	resources are not copied, see Resource::State.
+*/
+struct GameSnapshot {
+	uint32_t timeStamp;
+	VirtualMachine::State vm;
+	Resource::State res;
+	Video::State video;
+	SfxPlayer::State player;
+	Mixer::State mixer;
+};
+
+/*
+	The last seconds of snapshots, preallocated at init(). push() overwrites
+	the oldest one when the ring is full, pop() returns the newest one.
+*/
+struct SnapshotRing {
+	enum {
+		SNAPSHOTS_PER_SECOND = 25
+	};
+
+	GameSnapshot *_snapshots;
+	uint32_t _size;
+	uint32_t _head; // next slot written
+	uint32_t _count;
+
+	SnapshotRing();
+
+	bool init(uint32_t seconds);
+	void free();
+	void clear() { _head = _count = 0; }
+
+	bool empty() const { return _count == 0; }
+	GameSnapshot *push();
+	GameSnapshot *pop(); // 0 when empty
+};
+
+#endif
@@ -0,0 +1,143 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "statewriter.h"
+#include "archive.h"
+#include "file.h"
+#include "serializer.h"
+
+StateWriter::StateWriter()
+	: _quit(false), _busy(false) {
+}
+
+// The pending states are written before the worker exits
+void StateWriter::free() {
+	if (_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_quit = true;
+		}
+		_cond.notify_all();
+		_thread.join();
+	}
+}
+
+/*
+	Queues the state to be written to filename, the buffer is taken over. A
+	state of the same file which is still queued is replaced. The worker is
+	started on the first call.
+*/
+void StateWriter::write(const char *filename, const char *directory, const char *desc, std::vector<uint8_t> &state) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_thread.joinable()) {
+		_quit = false;
+		_thread = std::thread(&StateWriter::run, this);
+	}
+	Job *job = 0;
+	for (size_t i = 0; i < _jobs.size(); ++i) {
+		if (strcmp(_jobs[i].filename, filename) == 0) {
+			job = &_jobs[i];
+			break;
+		}
+	}
+	if (!job) {
+		_jobs.push_back(Job());
+		job = &_jobs.back();
+	}
+	snprintf(job->filename, sizeof(job->filename), "%s", filename);
+	job->directory = directory;
+	memset(job->desc, 0, sizeof(job->desc));
+	strncpy(job->desc, desc, sizeof(job->desc) - 1);
+	job->state.swap(state);
+	_cond.notify_all();
+}
+
+// Waits for the queued states to be written
+void StateWriter::flush() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_cond.wait(lock, [this] { return _jobs.empty() && !_busy; });
+}
+
+void StateWriter::run() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (1) {
+		_cond.wait(lock, [this] { return !_jobs.empty() || _quit; });
+		if (_jobs.empty()) {
+			break;
+		}
+		Job job;
+		std::swap(job, _jobs.front());
+		_jobs.erase(_jobs.begin());
+		_busy = true;
+		lock.unlock();
+		writeFile(job);
+		lock.lock();
+		_busy = false;
+		_cond.notify_all();
+	}
+}
+
+bool StateWriter::writeFile(const Job &job) {
+	const uint32_t size = job.state.size();
+	std::vector<uint8_t> payload(size);
+	// a packed payload is always smaller than the state
+	uint32_t payloadSize = Archive::compress(job.state.data(), size, payload.data(), size - 1);
+	if (payloadSize == 0) {
+		memcpy(payload.data(), job.state.data(), size);
+		payloadSize = size;
+	}
+	File f;
+	if (!f.open(job.filename, job.directory, "wb")) {
+		warning("Unable to save state file '%s'", job.filename);
+		return false;
+	}
+	f.writeUint32BE(MAGIC);
+	f.writeUint16BE(Serializer::CUR_VER);
+	f.writeUint16BE(0);
+	f.write((void *)job.desc, sizeof(job.desc));
+	f.writeUint32BE(size);
+	f.writeUint32BE(payloadSize);
+	f.write(payload.data(), payloadSize);
+	if (f.ioErr()) {
+		warning("I/O error when saving game state");
+		return false;
+	}
+	debug(DBG_INFO, "Saved state to '%s', %d bytes packed to %d", job.filename, size, payloadSize);
+	return true;
+}
+
+// Reads the serialized state of a version 3 file, following the header
+bool StateWriter::readState(File &f, std::vector<uint8_t> &state) {
+	const uint32_t size = f.readUint32BE();
+	const uint32_t payloadSize = f.readUint32BE();
+	if (f.ioErr() || size > MAX_STATE_SIZE || payloadSize > size) {
+		return false;
+	}
+	std::vector<uint8_t> payload(payloadSize);
+	f.read(payload.data(), payloadSize);
+	if (f.ioErr()) {
+		return false;
+	}
+	state.resize(size);
+	if (payloadSize == size) {
+		memcpy(state.data(), payload.data(), size);
+		return true;
+	}
+	return Archive::decompress(payload.data(), payloadSize, state.data(), size);
+}
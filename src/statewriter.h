@@ -0,0 +1,83 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __STATEWRITER_H__
+#define __STATEWRITER_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "intern.h"
+
+struct File;
+
+/*
+	Packs and writes the game states on a worker thread. The state is
+	serialized in memory by the main thread, which then only hands the buffer
+	over, the compression and the file writes are done by the worker.
+
+	From version 3 of the Serializer, the game state files are not gzipped
+	anymore, all the fields are big endian:
+
+	  0x00  magic 'AWSV'
+	  0x04  Serializer version
+	  0x06  0
+	  0x08  description, 32 bytes
+	  0x28  size of the serialized state
+	  0x2C  size of the payload, the size of the state when it is stored as is
+	  0x30  payload, the serialized state compressed with Archive::compress()
+
+	The versions 1 and 2 have the same header, the whole file being gzipped and
+	followed by the serialized state. zlib reads the version 3 files as is.
+*/
+struct StateWriter {
+	enum {
+		MAGIC = 0x41575356, // 'AWSV'
+		DESC_SIZE = 32,
+		MAX_STATE_SIZE = 1 << 20
+	};
+
+	struct Job {
+		char filename[20];
+		const char *directory;
+		char desc[DESC_SIZE];
+		std::vector<uint8_t> state;
+	};
+
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _quit;
+	bool _busy;             // the worker is writing a job
+	std::vector<Job> _jobs; // pending, at most one per file
+
+	StateWriter();
+
+	void free();
+	void write(const char *filename, const char *directory, const char *desc, std::vector<uint8_t> &state);
+	void flush();
+
+	void run();
+
+	static bool writeFile(const Job &job);
+	static bool readState(File &f, std::vector<uint8_t> &state);
+};
+
+#endif
@@ -41,6 +41,8 @@ struct PlayerInput {
 	char lastChar;
 	bool save, load;
 	int8_t stateSlot;
+	bool dumpStats;
+	bool rewind; // held down
 };
 
 /*
@@ -58,13 +60,19 @@ struct System {
 	virtual void destroy() = 0;
 
 	virtual void setPalette(const uint8_t *buf) = 0;
-	virtual void updateDisplay(const uint8_t *buf) = 0;
+	// buf is a whole 4bpp page, only the rows [y, y + h[ changed since the previous call
+	virtual void updateDisplay(const uint8_t *buf, uint16_t y, uint16_t h) = 0;
+	// buf is a whole 8bpp page of w x h pixels, of the HiresRenderer
+	virtual void updateDisplayHires(const uint8_t *buf, uint16_t w, uint16_t h) = 0;
 
 	virtual void processEvents() = 0;
 	virtual void sleep(uint32_t duration) = 0;
 	virtual uint32_t getTimeStamp() = 0;
+	// monotonic, in microseconds since init()
+	virtual uint64_t getHighResTimeStamp() = 0;
 
-	virtual void startAudio(AudioCallback callback, void *param) = 0;
+	// the callback fills len bytes of unsigned 8-bit or signed 16-bit (native endian) mono samples
+	virtual void startAudio(AudioCallback callback, void *param, uint32_t sampleRate, uint8_t sampleBits) = 0;
 	virtual void stopAudio() = 0;
 	virtual uint32_t getOutputSampleRate() = 0;
 	
@@ -0,0 +1,241 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "sys.h"
+#include "util.h"
+
+/*
+	A System without display nor sound device, used for regression and replay runs.
+
+	Time is virtual: the clock only moves forward when the VM asks to sleep, and the
+	timers (used by the SfxPlayer) are fired from sleep() as the clock reaches them.
+	The audio callback is pulled the same way, the samples of the elapsed time are
+	mixed in between the timers and thrown away. A run is hence paced by the game
+	logic only and not by the host.
+
+	In turbo mode sleep() returns immediately after advancing the clock, so the VM
+	runs as fast as the CPU allows.
+*/
+struct HeadlessStub : System {
+	enum {
+		MAX_TIMERS = 8,
+		SOUND_SAMPLE_RATE = 22050,
+		AUDIO_BUFFER_SIZE = 512
+	};
+
+	struct Timer {
+		int id;
+		uint32_t due;
+		uint32_t interval;
+		TimerCallback callback;
+		void *param;
+	};
+
+	bool _turbo;
+	uint32_t _timeStamp;
+	int _nextTimerId;
+	Timer _timers[MAX_TIMERS];
+	AudioCallback _audioCallback;
+	void *_audioParam;
+	uint32_t _audioSampleRate;
+	uint8_t _audioSampleBits;
+	uint64_t _audioSamples; // samples mixed since the start of the clock
+	uint8_t _audioBuffer[AUDIO_BUFFER_SIZE];
+
+	HeadlessStub(bool turbo);
+	virtual ~HeadlessStub() {}
+	virtual void init(const char *title);
+	virtual void destroy();
+	virtual void setPalette(const uint8_t *buf);
+	virtual void updateDisplay(const uint8_t *src, uint16_t y, uint16_t h);
+	virtual void updateDisplayHires(const uint8_t *src, uint16_t w, uint16_t h);
+	virtual void processEvents();
+	virtual void sleep(uint32_t duration);
+	virtual uint32_t getTimeStamp();
+	virtual uint64_t getHighResTimeStamp();
+	virtual void startAudio(AudioCallback callback, void *param, uint32_t sampleRate, uint8_t sampleBits);
+	virtual void stopAudio();
+	virtual uint32_t getOutputSampleRate();
+	virtual int addTimer(uint32_t delay, TimerCallback callback, void *param);
+	virtual void removeTimer(int timerId);
+	virtual void *createMutex();
+	virtual void destroyMutex(void *mutex);
+	virtual void lockMutex(void *mutex);
+	virtual void unlockMutex(void *mutex);
+
+	void advanceTime(uint32_t duration);
+	void mixAudio(uint32_t timeStamp);
+};
+
+HeadlessStub::HeadlessStub(bool turbo)
+	: _turbo(turbo), _timeStamp(0), _nextTimerId(0), _audioCallback(0), _audioParam(0), _audioSampleRate(SOUND_SAMPLE_RATE), _audioSampleBits(8), _audioSamples(0) {
+	memset(_timers, 0, sizeof(_timers));
+}
+
+void HeadlessStub::init(const char *title) {
+	debug(DBG_INFO, "HeadlessStub::init('%s') turbo=%d", title, _turbo);
+	memset(&input, 0, sizeof(input));
+	_timeStamp = 0;
+}
+
+void HeadlessStub::destroy() {
+	memset(_timers, 0, sizeof(_timers));
+}
+
+void HeadlessStub::setPalette(const uint8_t *buf) {
+}
+
+void HeadlessStub::updateDisplay(const uint8_t *src, uint16_t y, uint16_t h) {
+}
+
+void HeadlessStub::updateDisplayHires(const uint8_t *src, uint16_t w, uint16_t h) {
+}
+
+void HeadlessStub::processEvents() {
+}
+
+void HeadlessStub::sleep(uint32_t duration) {
+	advanceTime(duration);
+	if (!_turbo) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(duration));
+	}
+}
+
+uint32_t HeadlessStub::getTimeStamp() {
+	return _timeStamp;
+}
+
+uint64_t HeadlessStub::getHighResTimeStamp() {
+	return (uint64_t)_timeStamp * 1000;
+}
+
+void HeadlessStub::startAudio(AudioCallback callback, void *param, uint32_t sampleRate, uint8_t sampleBits) {
+	_audioCallback = callback;
+	_audioParam = param;
+	_audioSampleRate = sampleRate;
+	_audioSampleBits = sampleBits;
+	_audioSamples = (uint64_t)_timeStamp * _audioSampleRate / 1000;
+}
+
+void HeadlessStub::stopAudio() {
+	_audioCallback = 0;
+	_audioParam = 0;
+}
+
+uint32_t HeadlessStub::getOutputSampleRate() {
+	return _audioSampleRate;
+}
+
+int HeadlessStub::addTimer(uint32_t delay, TimerCallback callback, void *param) {
+	for (int i = 0; i < MAX_TIMERS; ++i) {
+		Timer *t = &_timers[i];
+		if (t->id == 0) {
+			t->id = ++_nextTimerId;
+			t->due = _timeStamp + delay;
+			t->interval = delay;
+			t->callback = callback;
+			t->param = param;
+			return t->id;
+		}
+	}
+	warning("HeadlessStub::addTimer() no free timer");
+	return 0;
+}
+
+void HeadlessStub::removeTimer(int timerId) {
+	for (int i = 0; i < MAX_TIMERS; ++i) {
+		if (timerId != 0 && _timers[i].id == timerId) {
+			_timers[i].id = 0;
+		}
+	}
+}
+
+void *HeadlessStub::createMutex() {
+	return new std::mutex;
+}
+
+void HeadlessStub::destroyMutex(void *mutex) {
+	delete (std::mutex *)mutex;
+}
+
+void HeadlessStub::lockMutex(void *mutex) {
+	((std::mutex *)mutex)->lock();
+}
+
+void HeadlessStub::unlockMutex(void *mutex) {
+	((std::mutex *)mutex)->unlock();
+}
+
+/*
+	Move the virtual clock forward, firing every timer that falls due on the way,
+	in chronological order. Like SDL, a callback returns the next interval or 0 to
+	cancel itself, and it is allowed to remove its own timer.
+*/
+void HeadlessStub::advanceTime(uint32_t duration) {
+	const uint32_t target = _timeStamp + duration;
+	while (1) {
+		Timer *next = 0;
+		for (int i = 0; i < MAX_TIMERS; ++i) {
+			Timer *t = &_timers[i];
+			if (t->id != 0 && (int32_t)(t->due - target) <= 0) {
+				if (next == 0 || (int32_t)(t->due - next->due) < 0) {
+					next = t;
+				}
+			}
+		}
+		if (next == 0) {
+			break;
+		}
+		if ((int32_t)(next->due - _timeStamp) > 0) {
+			_timeStamp = next->due;
+		}
+		mixAudio(_timeStamp);
+		const int id = next->id;
+		const uint32_t interval = next->callback(next->interval, next->param);
+		if (next->id == id) {
+			if (interval == 0) {
+				next->id = 0;
+			} else {
+				next->due += interval;
+				next->interval = interval;
+			}
+		}
+	}
+	_timeStamp = target;
+	mixAudio(_timeStamp);
+}
+
+void HeadlessStub::mixAudio(uint32_t timeStamp) {
+	if (_audioCallback == 0) {
+		return;
+	}
+	const int bytesPerSample = _audioSampleBits / 8;
+	const uint64_t target = (uint64_t)timeStamp * _audioSampleRate / 1000;
+	while (_audioSamples < target) {
+		const int count = (int)MIN(target - _audioSamples, (uint64_t)(AUDIO_BUFFER_SIZE / bytesPerSample));
+		_audioCallback(_audioParam, _audioBuffer, count * bytesPerSample);
+		_audioSamples += count;
+	}
+}
+
+System *System_Headless_create(bool turbo) {
+	return new HeadlessStub(turbo);
+}
@@ -17,9 +17,115 @@
  */
 
 #include <SDL2/SDL.h>
+#ifdef AUDIO_THREAD
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 #include "sys.h"
 #include "util.h"
 
+#ifdef AUDIO_THREAD
+/*
+	Renders the sound ahead on a thread of its own, in chunks of a quarter of
+	the device buffer, into a ring of RING_CHUNKS chunks. The device callback
+	only copies the samples out, so the mixer and the audio sequencer do not
+	run on the thread of the device callback, which is the main thread of the
+	browser with Emscripten. A late chunk is played as silence.
+*/
+struct AudioThread {
+	enum {
+		RING_CHUNKS = 4
+	};
+
+	System::AudioCallback _callback;
+	void *_param;
+	uint8_t _silence;
+	uint8_t *_ring;
+	uint8_t *_chunk;
+	uint32_t _chunkSize;
+	uint32_t _ringSize;
+	uint32_t _readPos;
+	uint32_t _fill;
+	bool _quit;
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+
+	AudioThread() : _callback(0), _param(0), _silence(0), _ring(0), _chunk(0), _chunkSize(0), _ringSize(0), _readPos(0), _fill(0), _quit(false) {}
+
+	void init(System::AudioCallback callback, void *param, uint32_t chunkSize, uint8_t silence) {
+		_callback = callback;
+		_param = param;
+		_silence = silence;
+		_chunkSize = chunkSize;
+		_ringSize = chunkSize * RING_CHUNKS;
+		_ring = (uint8_t *)malloc(_ringSize);
+		_chunk = (uint8_t *)malloc(_chunkSize);
+		if (!_ring || !_chunk) {
+			error("AudioThread::init() unable to allocate the ring");
+		}
+		_readPos = _fill = 0;
+		_quit = false;
+		_thread = std::thread(&AudioThread::render, this);
+	}
+
+	void free() {
+		if (_thread.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_quit = true;
+			}
+			_cond.notify_one();
+			_thread.join();
+		}
+		::free(_ring);
+		_ring = 0;
+		::free(_chunk);
+		_chunk = 0;
+	}
+
+	void render() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (!_quit) {
+			if (_fill + _chunkSize > _ringSize) {
+				_cond.wait(lock);
+				continue;
+			}
+			lock.unlock();
+			_callback(_param, _chunk, _chunkSize);
+			lock.lock();
+			const uint32_t writePos = (_readPos + _fill) % _ringSize;
+			const uint32_t n = MIN(_chunkSize, _ringSize - writePos);
+			memcpy(_ring + writePos, _chunk, n);
+			memcpy(_ring, _chunk + n, _chunkSize - n);
+			_fill += _chunkSize;
+		}
+	}
+
+	void read(uint8_t *buf, uint32_t len) {
+		uint32_t count;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			count = MIN(len, _fill);
+			const uint32_t n = MIN(count, _ringSize - _readPos);
+			memcpy(buf, _ring + _readPos, n);
+			memcpy(buf + n, _ring, count - n);
+			_readPos = (_readPos + count) % _ringSize;
+			_fill -= count;
+		}
+		_cond.notify_one();
+		if (count < len) {
+			memset(buf + count, _silence, len - count);
+		}
+	}
+
+	static void readCallback(void *param, uint8_t *buf, int len) {
+		((AudioThread *)param)->read(buf, len);
+	}
+};
+#endif
+
 
 struct SDLStub : System {
 	typedef void (SDLStub::*ScaleProc)(uint16_t *dst, uint16_t dstPitch, const uint16_t *src, uint16_t srcPitch, uint16_t w, uint16_t h);
@@ -32,20 +138,34 @@ struct SDLStub : System {
 
 	int DEFAULT_SCALE = 3;
 
-	SDL_Surface *_screen = nullptr;
 	SDL_Window * _window = nullptr;
 	SDL_Renderer * _renderer = nullptr;
+	SDL_Texture * _texture = nullptr;
+	SDL_Texture * _hiresTexture = nullptr;
+	uint16_t _hiresW = 0, _hiresH = 0;
+	bool _fullUpdate = true;
 	uint8_t _scale = DEFAULT_SCALE;
+	uint32_t _sampleRate = SOUND_SAMPLE_RATE;
+	uint64_t _startCounter = 0;
+#ifdef AUDIO_THREAD
+	AudioThread _audioThread;
+#endif
+
+	// ARGB8888 colors of the two pixels of each 4bpp byte, rebuilt by setPalette()
+	uint32_t _pixelsLut[256][2];
+	uint32_t _palette[NUM_COLORS];
 
 	virtual ~SDLStub() {}
 	virtual void init(const char *title);
 	virtual void destroy();
 	virtual void setPalette(const uint8_t *buf);
-	virtual void updateDisplay(const uint8_t *src);
+	virtual void updateDisplay(const uint8_t *src, uint16_t y, uint16_t h);
+	virtual void updateDisplayHires(const uint8_t *src, uint16_t w, uint16_t h);
 	virtual void processEvents();
 	virtual void sleep(uint32_t duration);
 	virtual uint32_t getTimeStamp();
-	virtual void startAudio(AudioCallback callback, void *param);
+	virtual uint64_t getHighResTimeStamp();
+	virtual void startAudio(AudioCallback callback, void *param, uint32_t sampleRate, uint8_t sampleBits);
 	virtual void stopAudio();
 	virtual uint32_t getOutputSampleRate();
 	virtual int addTimer(uint32_t delay, TimerCallback callback, void *param);
@@ -62,6 +182,7 @@ struct SDLStub : System {
 
 void SDLStub::init(const char *title) {
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER);
+	_startCounter = SDL_GetPerformanceCounter();
 //	SDL_EnableKeyRepeat(SDL_DEFAULT_REPEAT_DELAY, SDL_DEFAULT_REPEAT_INTERVAL);
 	SDL_ShowCursor(SDL_DISABLE);
 
@@ -69,6 +190,8 @@ void SDLStub::init(const char *title) {
 	SDL_CaptureMouse(SDL_TRUE);
 
 	memset(&input, 0, sizeof(input));
+	memset(_pixelsLut, 0, sizeof(_pixelsLut));
+	memset(_palette, 0, sizeof(_palette));
   _scale = DEFAULT_SCALE;
 	prepareGfxMode();
 }
@@ -78,20 +201,23 @@ void SDLStub::destroy() {
 	SDL_Quit();
 }
 
-static SDL_Color palette[NUM_COLORS];
 void SDLStub::setPalette(const uint8_t *p) {
   // The incoming palette is in 565 format.
+  uint32_t *palette = _palette;
   for (int i = 0; i < NUM_COLORS; ++i)
   {
     uint8_t c1 = *(p + 0);
     uint8_t c2 = *(p + 1);
-    palette[i].r = (((c1 & 0x0F) << 2) | ((c1 & 0x0F) >> 2)) << 2; // r
-    palette[i].g = (((c2 & 0xF0) >> 2) | ((c2 & 0xF0) >> 6)) << 2; // g
-    palette[i].b = (((c2 & 0x0F) >> 2) | ((c2 & 0x0F) << 2)) << 2; // b
-    palette[i].a = 0xFF;
+    uint32_t r = (((c1 & 0x0F) << 2) | ((c1 & 0x0F) >> 2)) << 2; // r
+    uint32_t g = (((c2 & 0xF0) >> 2) | ((c2 & 0xF0) >> 6)) << 2; // g
+    uint32_t b = (((c2 & 0x0F) >> 2) | ((c2 & 0x0F) << 2)) << 2; // b
+    palette[i] = 0xFF000000 | (r << 16) | (g << 8) | b;
     p += 2;
   }
-  SDL_SetPaletteColors(_screen->format->palette, palette, 0, NUM_COLORS);
+  for (int i = 0; i < 256; ++i) {
+    _pixelsLut[i][0] = palette[i >> 4];
+    _pixelsLut[i][1] = palette[i & 0xF];
+  }
 }
 
 void SDLStub::prepareGfxMode() {
@@ -100,39 +226,85 @@ void SDLStub::prepareGfxMode() {
 
   _window = SDL_CreateWindow("Another World", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, w * _scale, h * _scale, SDL_WINDOW_SHOWN);
   _renderer = SDL_CreateRenderer(_window, -1, 0);
-  _screen = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 8, 0, 0, 0, 0);
-  if (!_screen) {
-    error("SDLStub::prepareGfxMode() unable to allocate _screen buffer");
+  // The texture is kept from frame to frame, the changed rows of the page are
+  // converted directly into it.
+  _texture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, w, h);
+  if (!_texture) {
+    error("SDLStub::prepareGfxMode() unable to allocate _texture");
   }
-  // Upon resize during gameplay, the screen surface is re-created and a new palette is allocated.
-  // This will result in an all-white surface palette displaying a window full of white until a
-  // a palette is set by the VM.
-  // To avoid this issue, we save the last palette locally and re-upload it each time. On game start-up this
-  // is not requested.
-  SDL_SetPaletteColors(_screen->format->palette, palette, 0, NUM_COLORS);
+  // Upon resize during gameplay, the texture is re-created and its content is lost,
+  // so the next frame is fully converted again from the last palette.
+  _fullUpdate = true;
 }
 
-void SDLStub::updateDisplay(const uint8_t *src) {
-  uint16_t height = SCREEN_H;
-	uint8_t* p = (uint8_t*)_screen->pixels;
-
-	//For each line
-	while (height--) {
-		//One byte gives us two pixels, we only need to iterate w/2 times.
-		for (int i = 0; i < SCREEN_W / 2; ++i) {
-			//Extract two palette indices from upper byte and lower byte.
-			p[i * 2 + 0] = *(src + i) >> 4;
-			p[i * 2 + 1] = *(src + i) & 0xF;
-		}
-		p += _screen->pitch;
-    src += SCREEN_W/2;
-	}
+void SDLStub::updateDisplay(const uint8_t *src, uint16_t y, uint16_t h) {
+  if (_fullUpdate) {
+    y = 0;
+    h = SCREEN_H;
+    _fullUpdate = false;
+  }
+  if (h != 0) {
+    SDL_Rect r;
+    r.x = 0;
+    r.y = y;
+    r.w = SCREEN_W;
+    r.h = h;
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(_texture, &r, &pixels, &pitch) == 0) {
+      uint8_t *dst = (uint8_t *)pixels;
+      src += y * SCREEN_W / 2;
+
+      //For each line
+      while (h--) {
+        uint32_t *p = (uint32_t *)dst;
+        //One byte gives us two pixels, we only need to iterate w/2 times.
+        for (int i = 0; i < SCREEN_W / 2; ++i) {
+          const uint32_t *c = _pixelsLut[src[i]];
+          p[i * 2 + 0] = c[0];
+          p[i * 2 + 1] = c[1];
+        }
+        dst += pitch;
+        src += SCREEN_W / 2;
+      }
+      SDL_UnlockTexture(_texture);
+    }
+  }
 
-  SDL_Texture* texture = SDL_CreateTextureFromSurface(_renderer, _screen);
-  SDL_RenderCopy(_renderer, texture, nullptr, nullptr);
+  SDL_RenderCopy(_renderer, _texture, nullptr, nullptr);
   SDL_RenderPresent(_renderer);
-  SDL_DestroyTexture(texture);
+}
 
+// The texture is (re)created at the size of the page, and fully converted each frame
+void SDLStub::updateDisplayHires(const uint8_t *src, uint16_t w, uint16_t h) {
+  if (!_hiresTexture || w != _hiresW || h != _hiresH) {
+    if (_hiresTexture) {
+      SDL_DestroyTexture(_hiresTexture);
+    }
+    _hiresTexture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, w, h);
+    if (!_hiresTexture) {
+      error("SDLStub::updateDisplayHires() unable to allocate _hiresTexture");
+    }
+    _hiresW = w;
+    _hiresH = h;
+  }
+  void *pixels;
+  int pitch;
+  if (SDL_LockTexture(_hiresTexture, nullptr, &pixels, &pitch) == 0) {
+    uint8_t *dst = (uint8_t *)pixels;
+    for (int y = 0; y < h; ++y) {
+      uint32_t *p = (uint32_t *)dst;
+      for (int x = 0; x < w; ++x) {
+        p[x] = _palette[src[x] & 0xF];
+      }
+      dst += pitch;
+      src += w;
+    }
+    SDL_UnlockTexture(_hiresTexture);
+  }
+
+  SDL_RenderCopy(_renderer, _hiresTexture, nullptr, nullptr);
+  SDL_RenderPresent(_renderer);
 }
 
 void SDLStub::processEvents() {
@@ -163,6 +335,9 @@ void SDLStub::processEvents() {
 			case SDLK_ESCAPE:
         input.quit = true;
 				break;
+			case SDLK_r:
+				input.rewind = false;
+				break;
 			}
 			break;
 		case SDL_KEYDOWN:
@@ -177,6 +352,10 @@ void SDLStub::processEvents() {
 					input.stateSlot = 1;
 				} else if (ev.key.keysym.sym == SDLK_KP_MINUS) {
 					input.stateSlot = -1;
+				} else if (ev.key.keysym.sym == SDLK_i) {
+					input.dumpStats = true;
+				} else if (ev.key.keysym.sym == SDLK_r) {
+					input.rewind = true;
 				}
         break;
 			}
@@ -227,16 +406,31 @@ uint32_t SDLStub::getTimeStamp() {
 	return SDL_GetTicks();	
 }
 
-void SDLStub::startAudio(AudioCallback callback, void *param) {
+uint64_t SDLStub::getHighResTimeStamp() {
+	const uint64_t counter = SDL_GetPerformanceCounter() - _startCounter;
+	const uint64_t frequency = SDL_GetPerformanceFrequency();
+	return (counter / frequency) * 1000000 + (counter % frequency) * 1000000 / frequency;
+}
+
+// No obtained spec is given to SDL_OpenAudio(), SDL converts to the device format if needed
+void SDLStub::startAudio(AudioCallback callback, void *param, uint32_t sampleRate, uint8_t sampleBits) {
 	SDL_AudioSpec desired;
 	memset(&desired, 0, sizeof(desired));
 
-	desired.freq = SOUND_SAMPLE_RATE;
-	desired.format = AUDIO_U8;
+	_sampleRate = sampleRate;
+	desired.freq = sampleRate;
+	desired.format = (sampleBits == 16) ? AUDIO_S16SYS : AUDIO_U8;
 	desired.channels = 1;
-	desired.samples = 2048;
+	desired.samples = (sampleRate > SOUND_SAMPLE_RATE) ? 4096 : 2048; // about 90ms
+#ifdef AUDIO_THREAD
+	const uint32_t bufferSize = desired.samples * ((sampleBits == 16) ? 2 : 1);
+	_audioThread.init(callback, param, bufferSize / 4, (sampleBits == 16) ? 0 : 0x80);
+	desired.callback = AudioThread::readCallback;
+	desired.userdata = &_audioThread;
+#else
 	desired.callback = callback;
 	desired.userdata = param;
+#endif
 	if (SDL_OpenAudio(&desired, NULL) == 0) {
 		SDL_PauseAudio(0);
 	} else {
@@ -246,10 +440,13 @@ void SDLStub::startAudio(AudioCallback callback, void *param) {
 
 void SDLStub::stopAudio() {
 	SDL_CloseAudio();
+#ifdef AUDIO_THREAD
+	_audioThread.free();
+#endif
 }
 
 uint32_t SDLStub::getOutputSampleRate() {
-	return SOUND_SAMPLE_RATE;
+	return _sampleRate;
 }
 
 int SDLStub::addTimer(uint32_t delay, TimerCallback callback, void *param) {
@@ -279,20 +476,25 @@ void SDLStub::unlockMutex(void *mutex) {
 
 
 void SDLStub::cleanupGfxMode() {
-	if (_screen) {
-		SDL_FreeSurface(_screen);
-    _screen = 0;
+	if (_texture) {
+		SDL_DestroyTexture(_texture);
+		_texture = nullptr;
+	}
+
+	if (_hiresTexture) {
+		SDL_DestroyTexture(_hiresTexture);
+		_hiresTexture = nullptr;
+	}
+
+	if (_renderer) {
+		SDL_DestroyRenderer(_renderer);
+		_renderer = nullptr;
 	}
 
 	if (_window) {
 	  SDL_DestroyWindow(_window);
 	  _window = nullptr;
 	}
-
-	if (_screen) {
-	  SDL_FreeSurface(_screen);
-	  _screen = nullptr;
-	}
 }
 
 void SDLStub::switchGfxMode() {
@@ -300,6 +502,7 @@ void SDLStub::switchGfxMode() {
 	prepareGfxMode();
 }
 
-SDLStub sysImplementation;
-System *stub = &sysImplementation;
+System *System_SDL_create() {
+	return new SDLStub();
+}
 
@@ -17,10 +17,250 @@
  */
 
 #include "video.h"
+#include "framehash.h"
 #include "resource.h"
 #include "serializer.h"
 #include "sys.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+/*
+	Span kernels, they fill, copy or blend the w whole bytes in the middle of
+	a scanline, the leading and trailing nibbles are handled by the callers.
+
+	The spans are done with 16 bytes vectors, then 8, 4 or 1 byte words for
+	the narrow ones. The last chunk of a span overlaps the previous one
+	instead of looping on the remaining bytes, which is fine since the three
+	operations are idempotent.
+*/
+#if defined(__SSE2__)
+typedef __m128i SpanVector;
+static inline SpanVector loadVector(const uint8_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void storeVector(uint8_t *p, SpanVector v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline SpanVector splatVector(uint8_t b) { return _mm_set1_epi8(b); }
+static inline SpanVector orVector(SpanVector a, SpanVector b) { return _mm_or_si128(a, b); }
+#define SPAN_VECTOR 16
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+typedef uint8x16_t SpanVector;
+static inline SpanVector loadVector(const uint8_t *p) { return vld1q_u8(p); }
+static inline void storeVector(uint8_t *p, SpanVector v) { vst1q_u8(p, v); }
+static inline SpanVector splatVector(uint8_t b) { return vdupq_n_u8(b); }
+static inline SpanVector orVector(SpanVector a, SpanVector b) { return vorrq_u8(a, b); }
+#define SPAN_VECTOR 16
+#elif defined(__wasm_simd128__)
+typedef v128_t SpanVector;
+static inline SpanVector loadVector(const uint8_t *p) { return wasm_v128_load(p); }
+static inline void storeVector(uint8_t *p, SpanVector v) { wasm_v128_store(p, v); }
+static inline SpanVector splatVector(uint8_t b) { return wasm_i8x16_splat(b); }
+static inline SpanVector orVector(SpanVector a, SpanVector b) { return wasm_v128_or(a, b); }
+#define SPAN_VECTOR 16
+#endif
+
+template <typename T>
+static inline T loadWord(const uint8_t *p) {
+	T v;
+	memcpy(&v, p, sizeof(T));
+	return v;
+}
+
+template <typename T>
+static inline void storeWord(uint8_t *p, T v) {
+	memcpy(p, &v, sizeof(T));
+}
+
+static inline void fillSpan(uint8_t *p, uint8_t colb, uint16_t w) {
+#ifdef SPAN_VECTOR
+	if (w >= SPAN_VECTOR) {
+		const SpanVector c = splatVector(colb);
+		for (uint16_t i = 0; i < w - SPAN_VECTOR; i += SPAN_VECTOR) {
+			storeVector(p + i, c);
+		}
+		storeVector(p + w - SPAN_VECTOR, c);
+		return;
+	}
+#endif
+	if (w >= 8) {
+		const uint64_t c = colb * 0x0101010101010101ULL;
+		for (uint16_t i = 0; i < w - 8; i += 8) {
+			storeWord<uint64_t>(p + i, c);
+		}
+		storeWord<uint64_t>(p + w - 8, c);
+	} else if (w >= 4) {
+		const uint32_t c = colb * 0x01010101U;
+		storeWord<uint32_t>(p, c);
+		storeWord<uint32_t>(p + w - 4, c);
+	} else {
+		for (; w != 0; --w) {
+			*p++ = colb;
+		}
+	}
+}
+
+static inline void copySpan(uint8_t *p, const uint8_t *q, uint16_t w) {
+#ifdef SPAN_VECTOR
+	if (w >= SPAN_VECTOR) {
+		for (uint16_t i = 0; i < w - SPAN_VECTOR; i += SPAN_VECTOR) {
+			storeVector(p + i, loadVector(q + i));
+		}
+		storeVector(p + w - SPAN_VECTOR, loadVector(q + w - SPAN_VECTOR));
+		return;
+	}
+#endif
+	if (w >= 8) {
+		for (uint16_t i = 0; i < w - 8; i += 8) {
+			storeWord<uint64_t>(p + i, loadWord<uint64_t>(q + i));
+		}
+		storeWord<uint64_t>(p + w - 8, loadWord<uint64_t>(q + w - 8));
+	} else if (w >= 4) {
+		const uint32_t a = loadWord<uint32_t>(q);
+		const uint32_t b = loadWord<uint32_t>(q + w - 4);
+		storeWord<uint32_t>(p, a);
+		storeWord<uint32_t>(p + w - 4, b);
+	} else {
+		for (; w != 0; --w) {
+			*p++ = *q++;
+		}
+	}
+}
+
+// (*p & 0x77) | 0x88 is the same as *p | 0x88
+static inline void blendSpan(uint8_t *p, uint16_t w) {
+#ifdef SPAN_VECTOR
+	if (w >= SPAN_VECTOR) {
+		const SpanVector m = splatVector(0x88);
+		for (uint16_t i = 0; i < w - SPAN_VECTOR; i += SPAN_VECTOR) {
+			storeVector(p + i, orVector(loadVector(p + i), m));
+		}
+		storeVector(p + w - SPAN_VECTOR, orVector(loadVector(p + w - SPAN_VECTOR), m));
+		return;
+	}
+#endif
+	if (w >= 8) {
+		for (uint16_t i = 0; i < w - 8; i += 8) {
+			storeWord<uint64_t>(p + i, loadWord<uint64_t>(p + i) | 0x8888888888888888ULL);
+		}
+		storeWord<uint64_t>(p + w - 8, loadWord<uint64_t>(p + w - 8) | 0x8888888888888888ULL);
+	} else if (w >= 4) {
+		storeWord<uint32_t>(p, loadWord<uint32_t>(p) | 0x88888888U);
+		storeWord<uint32_t>(p + w - 4, loadWord<uint32_t>(p + w - 4) | 0x88888888U);
+	} else {
+		for (; w != 0; --w) {
+			*p++ |= 0x88;
+		}
+	}
+}
+
+
+
+/*
+	Scanline fillers, dst and src point to the same row of the destination
+	page and of page 0, x1 and x2 are already clipped to the screen.
+*/
+typedef void (*SpanProc)(uint8_t *dst, const uint8_t *src, int16_t x1, int16_t x2, uint8_t color);
+
+// Blend a line
+static void drawSpanBlend(uint8_t *dst, const uint8_t *, int16_t x1, int16_t x2, uint8_t) {
+	int16_t xmax = MAX(x1, x2);
+	int16_t xmin = MIN(x1, x2);
+	uint8_t *p = dst + xmin / 2;
+
+	uint16_t w = xmax / 2 - xmin / 2 + 1;
+	uint8_t cmaske = 0;
+	uint8_t cmasks = 0;	
+	if (xmin & 1) {
+		--w;
+		cmasks = 0xF7;
+	}
+	if (!(xmax & 1)) {
+		--w;
+		cmaske = 0x7F;
+	}
+
+	if (cmasks != 0) {
+		*p = (*p & cmasks) | 0x08;
+		++p;
+	}
+	blendSpan(p, w);
+	p += w;
+	if (cmaske != 0) {
+		*p = (*p & cmaske) | 0x80;
+		++p;
+	}
+
+
+}
+
+static void drawSpanN(uint8_t *dst, const uint8_t *, int16_t x1, int16_t x2, uint8_t color) {
+	int16_t xmax = MAX(x1, x2);
+	int16_t xmin = MIN(x1, x2);
+	uint8_t *p = dst + xmin / 2;
+
+	uint16_t w = xmax / 2 - xmin / 2 + 1;
+	uint8_t cmaske = 0;
+	uint8_t cmasks = 0;	
+	if (xmin & 1) {
+		--w;
+		cmasks = 0xF0;
+	}
+	if (!(xmax & 1)) {
+		--w;
+		cmaske = 0x0F;
+	}
+
+	uint8_t colb = ((color & 0xF) << 4) | (color & 0xF);	
+	if (cmasks != 0) {
+		*p = (*p & cmasks) | (colb & 0x0F);
+		++p;
+	}
+	fillSpan(p, colb, w);
+	p += w;
+	if (cmaske != 0) {
+		*p = (*p & cmaske) | (colb & 0xF0);
+		++p;		
+	}
+
+	
+}
+
+static void drawSpanP(uint8_t *dst, const uint8_t *src, int16_t x1, int16_t x2, uint8_t) {
+	int16_t xmax = MAX(x1, x2);
+	int16_t xmin = MIN(x1, x2);
+	uint8_t *p = dst + xmin / 2;
+	const uint8_t *q = src + xmin / 2;
+
+	uint8_t w = xmax / 2 - xmin / 2 + 1;
+	uint8_t cmaske = 0;
+	uint8_t cmasks = 0;	
+	if (xmin & 1) {
+		--w;
+		cmasks = 0xF0;
+	}
+	if (!(xmax & 1)) {
+		--w;
+		cmaske = 0x0F;
+	}
+
+	if (cmasks != 0) {
+		*p = (*p & cmasks) | (*q & 0x0F);
+		++p;
+		++q;
+	}
+	copySpan(p, q, w);
+	p += w;
+	q += w;
+	if (cmaske != 0) {
+		*p = (*p & cmaske) | (*q & 0xF0);
+		++p;
+		++q;
+	}
+
+}
 
 void Polygon::readVertices(const uint8_t *p, uint16_t zoom) {
 	bbw = (*p++) * zoom / 64;
@@ -37,7 +277,10 @@ void Polygon::readVertices(const uint8_t *p, uint16_t zoom) {
 }
 
 Video::Video(Resource *resParameter, System *stub) 
-	: res(resParameter), sys(stub) {
+	: res(resParameter), sys(stub), _cachePolygons(true), _flattening(false), _polygonDepth(0), _frameHasher(0), _deferred(false), _rasterBands(1) {
+#ifdef ENABLE_PROFILER
+	_profiler = 0;
+#endif
 }
 
 void Video::init() {
@@ -57,11 +300,58 @@ void Video::init() {
 
 	changePagePtr1(0xFE);
 
+	markAllDirty();
+
+	_screenNum = NO_SCREEN;
+	memset(_screenRef, 0, sizeof(_screenRef));
+
 	_interpTable[0] = 0x4000;
 
 	for (int i = 1; i < 0x400; ++i) {
 		_interpTable[i] = 0x4000 / i;
 	}
+
+	// the first entry wins, as with the linear search it replaces
+	_stringIndex.clear();
+	for (const StrEntry *se = _stringsTableEng; se->id != END_OF_STRING_DICTIONARY; ++se) {
+		if (se->id >= _stringIndex.size()) {
+			_stringIndex.resize(se->id + 1, 0);
+		}
+		if (!_stringIndex[se->id]) {
+			_stringIndex[se->id] = se;
+		}
+	}
+
+	for (int i = 0; i < 16; ++i) {
+		_glyphCaches[i].ready = false;
+	}
+}
+
+void Video::free() {
+	flush();
+	_rasterPool.free();
+	_hires.free();
+}
+
+// 0 disables the high resolution pages
+void Video::setHiresScale(uint8_t scale) {
+	_hires.free();
+	if (scale != 0) {
+		if (_hires.init(scale)) {
+			upscaleHiresPages();
+		} else {
+			warning("Video::setHiresScale() unable to allocate the pages at scale %d", scale);
+		}
+	}
+}
+
+void Video::upscaleHiresPages() {
+	if (_hires.enabled()) {
+		flush();
+		for (int i = 0; i < 4; ++i) {
+			_hires.upscalePage(i, _pages[i]);
+		}
+	}
 }
 
 /*
@@ -79,9 +369,32 @@ void Video::setDataBuffer(uint8_t *dataBuf, uint16_t offset) {
 	 - A list of screenspace vertices.
 	 - A list of objectspace vertices, based on a delta from the first vertex.
 
-	 This is a recursive function. */
+	 This is a recursive function. When the polygon cache is enabled, the whole
+	 hierarchy is flattened once from the origin, then drawn from the cache. */
 void Video::readAndDrawPolygon(uint8_t color, uint16_t zoom, const Point &pt) {
 
+	if (_hires.enabled() && !_flattening && _polygonDepth == 0) {
+		const size_t firstPolygon = _hires._polygons.size();
+		_hires.drawShape(getPageIndex(_curPagePtr1), _dataBuf, _pData.pc - _dataBuf, color, zoom, pt.x * _hires._scale, pt.y * _hires._scale);
+		for (size_t i = firstPolygon; i < _hires._polygons.size(); ++i) {
+			queueHiresPolygon(i);
+		}
+	}
+
+	if (_cachePolygons && !_flattening) {
+		const uint16_t offset = _pData.pc - _dataBuf;
+		const PolygonCache::Shape *shape = _polygonCache.find(_dataBuf, offset, zoom, color);
+		if (!shape) {
+			_polygonCache.beginShape();
+			_flattening = true;
+			readAndDrawPolygon(color, zoom, Point(0, 0));
+			_flattening = false;
+			shape = _polygonCache.endShape(_dataBuf, offset, zoom, color);
+		}
+		drawShape(*shape, pt);
+		return;
+	}
+
 	uint8_t i = _pData.fetchByte();
 
 	//This is 
@@ -96,7 +409,20 @@ void Video::readAndDrawPolygon(uint8_t color, uint16_t zoom, const Point &pt) {
 		// vertices informations.
 		polygon.readVertices(_pData.pc, zoom);
 
+		if (_flattening) {
+			CachedPolygon cp;
+			PolygonEdge edges[Polygon::MAX_POINTS / 2];
+			cp.x = pt.x;
+			cp.y = pt.y;
+			cp.color = color;
+			calcEdges(cp, edges);
+			_polygonCache.addPolygon(cp, edges);
+			return;
+		}
+
+		PROFILE_START(polygonStart);
 		fillPolygon(color, zoom, pt);
+		PROFILE_POLYGON(_profiler, polygonStart);
 
 
 
@@ -118,55 +444,114 @@ void Video::readAndDrawPolygon(uint8_t color, uint16_t zoom, const Point &pt) {
 
 void Video::fillPolygon(uint16_t color, uint16_t zoom, const Point &pt) {
 
-	if (polygon.bbw == 0 && polygon.bbh == 1 && polygon.numPoints == 4) {
-		drawPoint(color, pt.x, pt.y);
+	CachedPolygon cp;
+	PolygonEdge edges[Polygon::MAX_POINTS / 2];
+	cp.x = 0;
+	cp.y = 0;
+	cp.color = color;
+	calcEdges(cp, edges);
+	drawPolygon(cp, edges, pt);
+}
+
+/*
+	Precompute the edge steps of the current polygon, fillPolygon() walks the
+	vertices from both ends of the list, two edges at a time.
+*/
+void Video::calcEdges(CachedPolygon &cp, PolygonEdge *edges) {
+
+	cp.bbw = polygon.bbw;
+	cp.bbh = polygon.bbh;
+	cp.numPoints = polygon.numPoints;
+	cp.numEdges = 0;
+	cp.height = 0;
+	if (polygon.numPoints < 2) {
+		cp.firstX = cp.lastX = 0;
+		return;
+	}
+
+	uint16_t i = 0;
+	uint16_t j = polygon.numPoints - 1;
+
+	cp.firstX = polygon.points[i].x;
+	cp.lastX = polygon.points[j].x;
+
+	++i;
+	--j;
+
+	for (int n = polygon.numPoints - 2; n != 0; n -= 2) {
+		PolygonEdge *e = &edges[cp.numEdges++];
+		e->step1 = calcStep(polygon.points[j + 1], polygon.points[j], e->h);
+		e->step2 = calcStep(polygon.points[i - 1], polygon.points[i], e->h);
+		cp.height += e->h;
+
+		++i;
+		--j;
+	}
+}
+
+void Video::drawPolygon(const CachedPolygon &cp, const PolygonEdge *edges, const Point &pt) {
+
+	if (cp.bbw == 0 && cp.bbh == 1 && cp.numPoints == 4) {
+		drawPoint(cp.color, pt.x, pt.y);
 
 		return;
 	}
 	
-	int16_t x1 = pt.x - polygon.bbw / 2;
-	int16_t x2 = pt.x + polygon.bbw / 2;
-	int16_t y1 = pt.y - polygon.bbh / 2;
-	int16_t y2 = pt.y + polygon.bbh / 2;
+	int16_t x1 = pt.x - cp.bbw / 2;
+	int16_t x2 = pt.x + cp.bbw / 2;
+	int16_t y1 = pt.y - cp.bbh / 2;
+	int16_t y2 = pt.y + cp.bbh / 2;
 
 	if (x1 > 319 || x2 < 0 || y1 > 199 || y2 < 0)
 		return;
 
-	_hliney = y1;
-	
-	uint16_t i, j;
-	i = 0;
-	j = polygon.numPoints - 1;
-	
-	x2 = polygon.points[i].x + x1;
-	x1 = polygon.points[j].x + x1;
+	markDirty(_curPagePtr1, y1, y1 + (int)cp.height);
 
-	++i;
-	--j;
+	if (_deferred) {
+		RasterCommand *cmd = queueCommand(RasterCommand::CMD_POLYGON, _curPagePtr1, y1, MIN(y1 + (int)cp.height, 200));
+		if (cmd) {
+			cmd->pt = pt;
+			cmd->cp = cp;
+			cmd->cp.firstEdge = _rasterEdges.size();
+			_rasterEdges.insert(_rasterEdges.end(), edges, edges + cp.numEdges);
+		}
+		return;
+	}
+	scanPolygon(cp, edges, pt, _curPagePtr1, 0, 200, true);
+}
+
+/*
+	Fills the rows [clipY1, clipY2[ of the polygon. The rows above clipY1 are
+	skipped by stepping the edges all at once, which gives the same fixed
+	point positions as stepping them row by row.
+*/
+void Video::scanPolygon(const CachedPolygon &cp, const PolygonEdge *edges, const Point &pt, uint8_t *page, int16_t clipY1, int16_t clipY2, bool countSpans) const {
 
-	drawLine drawFct;
+	const uint8_t color = cp.color;
+
+	int16_t x1 = pt.x - cp.bbw / 2;
+	int16_t hliney = pt.y - cp.bbh / 2;
+
+	int16_t x2 = cp.firstX + x1;
+	x1 = cp.lastX + x1;
+
+	SpanProc drawFct;
 	if (color < 0x10) {
-		drawFct = &Video::drawLineN;
+		drawFct = &drawSpanN;
 	} else if (color > 0x10) {
-		drawFct = &Video::drawLineP;
+		drawFct = &drawSpanP;
 	} else {
-		drawFct = &Video::drawLineBlend;
+		drawFct = &drawSpanBlend;
 	}
 
 	uint32_t cpt1 = x1 << 16;
 	uint32_t cpt2 = x2 << 16;
 
-	while (1) {
-		polygon.numPoints -= 2;
-		if (polygon.numPoints == 0) {
-			break;
-		}
-		uint16_t h;
-		int32_t step1 = calcStep(polygon.points[j + 1], polygon.points[j], h);
-		int32_t step2 = calcStep(polygon.points[i - 1], polygon.points[i], h);
-
-		++i;
-		--j;
+	for (uint16_t n = 0; n < cp.numEdges; ++n) {
+		const PolygonEdge *e = &edges[n];
+		int32_t step1 = e->step1;
+		int32_t step2 = e->step2;
+		uint16_t h = e->h;
 
 		cpt1 = (cpt1 & 0xFFFF0000) | 0x7FFF;
 		cpt2 = (cpt2 & 0xFFFF0000) | 0x8000;
@@ -175,28 +560,42 @@ void Video::fillPolygon(uint16_t color, uint16_t zoom, const Point &pt) {
 			cpt1 += step1;
 			cpt2 += step2;
 		} else {
+			if (hliney < clipY1) {
+				const uint16_t skip = MIN((int)h, clipY1 - hliney);
+				cpt1 += (uint32_t)step1 * skip;
+				cpt2 += (uint32_t)step2 * skip;
+				hliney += skip;
+				h -= skip;
+				if (hliney >= clipY2) return;
+			}
 			for (; h != 0; --h) {
-				if (_hliney >= 0) {
-					x1 = cpt1 >> 16;
-					x2 = cpt2 >> 16;
-					if (x1 <= 319 && x2 >= 0) {
-						if (x1 < 0) x1 = 0;
-						if (x2 > 319) x2 = 319;
-						(this->*drawFct)(x1, x2, color);
+				x1 = cpt1 >> 16;
+				x2 = cpt2 >> 16;
+				if (x1 <= 319 && x2 >= 0) {
+					if (x1 < 0) x1 = 0;
+					if (x2 > 319) x2 = 319;
+					if (countSpans) {
+						PROFILE_SPAN(_profiler, x1, x2);
 					}
+					drawFct(page + hliney * 160, _pages[0] + hliney * 160, x1, x2, color);
 				}
 				cpt1 += step1;
 				cpt2 += step2;
-				++_hliney;					
-				if (_hliney > 199) return;
+				++hliney;					
+				if (hliney >= clipY2) return;
 			}
 		}
 	}
+}
 
+void Video::drawShape(const PolygonCache::Shape &shape, const Point &pt) {
 
-
-
-
+	const CachedPolygon *cp = &_polygonCache._polygons[shape.firstPolygon];
+	for (uint32_t n = 0; n < shape.numPolygons; ++n, ++cp) {
+		PROFILE_START(polygonStart);
+		drawPolygon(*cp, _polygonCache._edges.data() + cp->firstEdge, Point(pt.x + cp->x, pt.y + cp->y));
+		PROFILE_POLYGON(_profiler, polygonStart);
+	}
 }
 
 /*
@@ -212,6 +611,8 @@ void Video::readAndDrawPolygonHierarchy(uint16_t zoom, const Point &pgc) {
 	int16_t childs = _pData.fetchByte();
 	debug(DBG_VIDEO, "Video::readAndDrawPolygonHierarchy childs=%d", childs);
 
+	++_polygonDepth;
+
 	for ( ; childs >= 0; --childs) {
 
 		uint16_t off = _pData.fetchWord();
@@ -238,6 +639,7 @@ void Video::readAndDrawPolygonHierarchy(uint16_t zoom, const Point &pgc) {
 
 		_pData.pc = bak;
 	}
+	--_polygonDepth;
 
 	
 }
@@ -249,17 +651,16 @@ int32_t Video::calcStep(const Point &p1, const Point &p2, uint16_t &dy) {
 
 void Video::drawString(uint8_t color, uint16_t x, uint16_t y, uint16_t stringId) {
 
-	const StrEntry *se = _stringsTableEng;
+	// the glyphs are drawn in place, after the pending drawing
+	flush();
 
-	//Search for the location where the string is located.
-	while (se->id != END_OF_STRING_DICTIONARY && se->id != stringId) 
-		++se;
-	
-	debug(DBG_VIDEO, "drawString(%d, %d, %d, '%s')", color, x, y, se->str);
+	const StrEntry *se = (stringId < _stringIndex.size()) ? _stringIndex[stringId] : 0;
 
 	//Not found
-	if (se->id == END_OF_STRING_DICTIONARY)
+	if (!se)
 		return;
+
+	debug(DBG_VIDEO, "drawString(%d, %d, %d, '%s')", color, x, y, se->str);
 	
 
     //Used if the string contains a return carriage.
@@ -280,166 +681,153 @@ void Video::drawString(uint8_t color, uint16_t x, uint16_t y, uint16_t stringId)
 }
 
 void Video::drawChar(uint8_t character, uint16_t x, uint16_t y, uint8_t color, uint8_t *buf) {
-	if (x <= 39 && y <= 192) {
+	const uint8_t glyph = character - ' ';
+	if (x <= 39 && y <= 192 && glyph < FONT_GLYPHS) {
 		
-		const uint8_t *ft = _font + (character - ' ') * 8;
+		markDirty(buf, y, y + 8);
+		if (_hires.enabled()) {
+			_hires.drawChar(getPageIndex(buf), _font + glyph * 8, x, y, color);
+		}
+
+		const GlyphCache *gc = getGlyphCache(color);
+		const uint32_t *masks = gc->masks + glyph * 8;
+		const uint32_t *values = gc->values + glyph * 8;
 
 		uint8_t *p = buf + x * 4 + y * 160;
 
 		for (int j = 0; j < 8; ++j) {
-			uint8_t ch = *(ft + j);
-			for (int i = 0; i < 4; ++i) {
-				uint8_t b = *(p + i);
-				uint8_t cmask = 0xFF;
-				uint8_t colb = 0;
-				if (ch & 0x80) {
-					colb |= color << 4;
-					cmask &= 0x0F;
-				}
-				ch <<= 1;
-				if (ch & 0x80) {
-					colb |= color;
-					cmask &= 0xF0;
-				}
-				ch <<= 1;
-				*(p + i) = (b & cmask) | colb;
-			}
+			uint32_t b;
+			memcpy(&b, p, sizeof(b));
+			b = (b & masks[j]) | values[j];
+			memcpy(p, &b, sizeof(b));
 			p += 160;
 		}
 	}
 }
 
+/*
+	The glyph rows are expanded once per color, each nibble of a row either
+	keeps the page pixel (mask 0xF) or takes the color (mask 0). A color
+	above 15 shares the slot of its low nibble and rebuilds it on change.
+*/
+const Video::GlyphCache *Video::getGlyphCache(uint8_t color) {
+	GlyphCache *gc = &_glyphCaches[color & 15];
+	if (gc->ready && gc->color == color) {
+		return gc;
+	}
+	for (int n = 0; n < FONT_GLYPHS * 8; ++n) {
+		uint8_t ch = _font[n];
+		uint8_t masks[4], values[4];
+		for (int i = 0; i < 4; ++i) {
+			uint8_t cmask = 0xFF;
+			uint8_t colb = 0;
+			if (ch & 0x80) {
+				colb |= color << 4;
+				cmask &= 0x0F;
+			}
+			ch <<= 1;
+			if (ch & 0x80) {
+				colb |= color;
+				cmask &= 0xF0;
+			}
+			ch <<= 1;
+			masks[i] = cmask;
+			values[i] = colb;
+		}
+		memcpy(&gc->masks[n], masks, sizeof(masks));
+		memcpy(&gc->values[n], values, sizeof(values));
+	}
+	gc->color = color;
+	gc->ready = true;
+	return gc;
+}
+
 void Video::drawPoint(uint8_t color, int16_t x, int16_t y) {
 	debug(DBG_VIDEO, "drawPoint(%d, %d, %d)", color, x, y);
 	if (x >= 0 && x <= 319 && y >= 0 && y <= 199) {
-		uint16_t off = y * 160 + x / 2;
-	
-		uint8_t cmasko, cmaskn;
-		if (x & 1) {
-			cmaskn = 0x0F;
-			cmasko = 0xF0;
-		} else {
-			cmaskn = 0xF0;
-			cmasko = 0x0F;
-		}
-
-		uint8_t colb = (color << 4) | color;
-		if (color == 0x10) {
-			cmaskn &= 0x88;
-			cmasko = ~cmaskn;
-			colb = 0x88;		
-		} else if (color == 0x11) {
-			colb = *(_pages[0] + off);
+		markDirty(_curPagePtr1, y, y + 1);
+		if (_deferred) {
+			RasterCommand *cmd = queueCommand(RasterCommand::CMD_POINT, _curPagePtr1, y, y + 1);
+			if (cmd) {
+				cmd->color = color;
+				cmd->pt = Point(x, y);
+			}
+			return;
 		}
-		uint8_t b = *(_curPagePtr1 + off);
-		*(_curPagePtr1 + off) = (b & cmasko) | (colb & cmaskn);
+		plotPoint(_curPagePtr1, color, x, y);
 	}
 }
 
-/* Blend a line in the current framebuffer (_curPagePtr1)
-*/
-void Video::drawLineBlend(int16_t x1, int16_t x2, uint8_t color) {
-	debug(DBG_VIDEO, "drawLineBlend(%d, %d, %d)", x1, x2, color);
-	int16_t xmax = MAX(x1, x2);
-	int16_t xmin = MIN(x1, x2);
-	uint8_t *p = _curPagePtr1 + _hliney * 160 + xmin / 2;
+void Video::plotPoint(uint8_t *page, uint8_t color, int16_t x, int16_t y) const {
+	uint16_t off = y * 160 + x / 2;
 
-	uint16_t w = xmax / 2 - xmin / 2 + 1;
-	uint8_t cmaske = 0;
-	uint8_t cmasks = 0;	
-	if (xmin & 1) {
-		--w;
-		cmasks = 0xF7;
-	}
-	if (!(xmax & 1)) {
-		--w;
-		cmaske = 0x7F;
+	uint8_t cmasko, cmaskn;
+	if (x & 1) {
+		cmaskn = 0x0F;
+		cmasko = 0xF0;
+	} else {
+		cmaskn = 0xF0;
+		cmasko = 0x0F;
 	}
 
-	if (cmasks != 0) {
-		*p = (*p & cmasks) | 0x08;
-		++p;
-	}
-	while (w--) {
-		*p = (*p & 0x77) | 0x88;
-		++p;
-	}
-	if (cmaske != 0) {
-		*p = (*p & cmaske) | 0x80;
-		++p;
+	uint8_t colb = (color << 4) | color;
+	if (color == 0x10) {
+		cmaskn &= 0x88;
+		cmasko = ~cmaskn;
+		colb = 0x88;		
+	} else if (color == 0x11) {
+		colb = *(_pages[0] + off);
 	}
+	uint8_t b = *(page + off);
+	*(page + off) = (b & cmasko) | (colb & cmaskn);
+}
 
-
+/* Blend a line in the current framebuffer (_curPagePtr1)
+*/
+void Video::drawLineBlend(int16_t x1, int16_t x2, uint8_t color) {
+	debug(DBG_VIDEO, "drawLineBlend(%d, %d, %d)", x1, x2, color);
+	drawSpanBlend(_curPagePtr1 + _hliney * 160, _pages[0] + _hliney * 160, x1, x2, color);
 }
 
 void Video::drawLineN(int16_t x1, int16_t x2, uint8_t color) {
 	debug(DBG_VIDEO, "drawLineN(%d, %d, %d)", x1, x2, color);
-	int16_t xmax = MAX(x1, x2);
-	int16_t xmin = MIN(x1, x2);
-	uint8_t *p = _curPagePtr1 + _hliney * 160 + xmin / 2;
-
-	uint16_t w = xmax / 2 - xmin / 2 + 1;
-	uint8_t cmaske = 0;
-	uint8_t cmasks = 0;	
-	if (xmin & 1) {
-		--w;
-		cmasks = 0xF0;
-	}
-	if (!(xmax & 1)) {
-		--w;
-		cmaske = 0x0F;
-	}
-
-	uint8_t colb = ((color & 0xF) << 4) | (color & 0xF);	
-	if (cmasks != 0) {
-		*p = (*p & cmasks) | (colb & 0x0F);
-		++p;
-	}
-	while (w--) {
-		*p++ = colb;
-	}
-	if (cmaske != 0) {
-		*p = (*p & cmaske) | (colb & 0xF0);
-		++p;		
-	}
-
-	
+	drawSpanN(_curPagePtr1 + _hliney * 160, _pages[0] + _hliney * 160, x1, x2, color);
 }
 
 void Video::drawLineP(int16_t x1, int16_t x2, uint8_t color) {
 	debug(DBG_VIDEO, "drawLineP(%d, %d, %d)", x1, x2, color);
-	int16_t xmax = MAX(x1, x2);
-	int16_t xmin = MIN(x1, x2);
-	uint16_t off = _hliney * 160 + xmin / 2;
-	uint8_t *p = _curPagePtr1 + off;
-	uint8_t *q = _pages[0] + off;
+	drawSpanP(_curPagePtr1 + _hliney * 160, _pages[0] + _hliney * 160, x1, x2, color);
+}
 
-	uint8_t w = xmax / 2 - xmin / 2 + 1;
-	uint8_t cmaske = 0;
-	uint8_t cmasks = 0;	
-	if (xmin & 1) {
-		--w;
-		cmasks = 0xF0;
-	}
-	if (!(xmax & 1)) {
-		--w;
-		cmaske = 0x0F;
-	}
+int Video::getPageIndex(const uint8_t *page) const {
+	return (page - _pages[0]) / VID_PAGE_SIZE;
+}
 
-	if (cmasks != 0) {
-		*p = (*p & cmasks) | (*q & 0x0F);
-		++p;
-		++q;
+void Video::markDirty(const uint8_t *page, int y1, int y2) {
+	if (y1 < 0) {
+		y1 = 0;
 	}
-	while (w--) {
-		*p++ = *q++;			
+	if (y2 > 200) {
+		y2 = 200;
 	}
-	if (cmaske != 0) {
-		*p = (*p & cmaske) | (*q & 0xF0);
-		++p;
-		++q;
+	if (y1 < y2) {
+		DirtyRows *d = &_dirtyRows[getPageIndex(page)];
+		if (d->y1 >= d->y2) {
+			d->y1 = y1;
+			d->y2 = y2;
+		} else {
+			d->y1 = MIN(d->y1, y1);
+			d->y2 = MAX(d->y2, y2);
+		}
 	}
+}
 
+void Video::markAllDirty() {
+	for (int i = 0; i < 4; ++i) {
+		_dirtyRows[i].y1 = 0;
+		_dirtyRows[i].y2 = 200;
+	}
+	_fullScreenUpdate = true;
 }
 
 uint8_t *Video::getPage(uint8_t page) {
@@ -480,7 +868,18 @@ void Video::fillPage(uint8_t pageId, uint8_t color) {
 	// clearing color to the upper part of the byte.
 	uint8_t c = (color << 4) | color;
 
+	markDirty(p, 0, 200);
+	if (_deferred) {
+		RasterCommand *cmd = queueCommand(RasterCommand::CMD_FILL_PAGE, p, 0, 200);
+		if (cmd) {
+			cmd->color = c;
+		}
+		return;
+	}
 	memset(p, c, VID_PAGE_SIZE);
+	if (_hires.enabled()) {
+		_hires.fillPage(getPageIndex(p), c);
+	}
 }
 
 /*  This opcode is used once the background of a scene has been drawn in one of the framebuffer:
@@ -498,11 +897,36 @@ void Video::copyPage(uint8_t srcPageId, uint8_t dstPageId, int16_t vscroll) {
 	if (srcPageId >= 0xFE || !((srcPageId &= 0xBF) & 0x80)) {
 		p = getPage(srcPageId);
 		q = getPage(dstPageId);
+		// the destination now differs from the screen where the source does
+		_dirtyRows[getPageIndex(q)] = _dirtyRows[getPageIndex(p)];
+		if (_deferred) {
+			RasterCommand *cmd = queueCommand(RasterCommand::CMD_COPY_PAGE, q, 0, 200);
+			if (cmd) {
+				cmd->srcPage = getPageIndex(p);
+			}
+			return;
+		}
 		memcpy(q, p, VID_PAGE_SIZE);
+		if (_hires.enabled()) {
+			_hires.copyPage(getPageIndex(p), getPageIndex(q), 0);
+		}
 			
 	} else {
 		p = getPage(srcPageId & 3);
 		q = getPage(dstPageId);
+		if (vscroll == 0 && _deferred) {
+			markDirty(q, 0, 200);
+			RasterCommand *cmd = queueCommand(RasterCommand::CMD_COPY_PAGE, q, 0, 200);
+			if (cmd) {
+				cmd->srcPage = getPageIndex(p);
+			}
+			return;
+		}
+		// the scrolled rows move across the bands
+		flush();
+		if (_hires.enabled() && vscroll >= -199 && vscroll <= 199) {
+			_hires.copyPage(getPageIndex(p), getPageIndex(q), vscroll);
+		}
 		if (vscroll >= -199 && vscroll <= 199) {
 			uint16_t h = 200;
 			if (vscroll < 0) {
@@ -513,6 +937,7 @@ void Video::copyPage(uint8_t srcPageId, uint8_t dstPageId, int16_t vscroll) {
 				q += vscroll * 160;
 			}
 			memcpy(q, p, h * 160);
+			markDirty(getPage(dstPageId), MAX(vscroll, 0), MAX(vscroll, 0) + h);
 		}
 	}
 }
@@ -520,33 +945,63 @@ void Video::copyPage(uint8_t srcPageId, uint8_t dstPageId, int16_t vscroll) {
 
 
 
-void Video::copyPage(const uint8_t *src) {
-	debug(DBG_VIDEO, "Video::copyPage()");
-	uint8_t *dst = _pages[0];
-	int h = 200;
-	while (h--) {
-		int w = 40;
-		while (w--) {
-			uint8_t p[] = {
-				*(src + 8000 * 3),
-				*(src + 8000 * 2),
-				*(src + 8000 * 1),
-				*(src + 8000 * 0)
-			};
-			for(int j = 0; j < 4; ++j) {
-				uint8_t acc = 0;
-				for (int i = 0; i < 8; ++i) {
-					acc <<= 1;
-					acc |= (p[i & 3] & 0x80) ? 1 : 0;
-					p[i & 3] <<= 1;
+/*
+	Planar to chunky conversion: the table spreads the 8 bits of a plane byte
+	to bit 0 of the 8 nibbles of a 4bpp word, in the order of the pixels. The
+	4 planes of 8000 bytes are then merged with shifts, 8 pixels at a time.
+*/
+static const uint32_t *getPlanarSpreadTable() {
+	static const struct SpreadTable {
+		uint32_t spread[256];
+
+		SpreadTable() {
+			for (int b = 0; b < 256; ++b) {
+				uint8_t pixels[4] = { 0, 0, 0, 0 };
+				for (int k = 0; k < 8; ++k) {
+					if (b & (0x80 >> k)) {
+						pixels[k / 2] |= (k & 1) ? 0x01 : 0x10;
+					}
 				}
-				*dst++ = acc;
+				memcpy(&spread[b], pixels, sizeof(pixels));
 			}
-			++src;
 		}
+	} table;
+	return table.spread;
+}
+
+void Video::convertPage(const uint8_t *src, uint8_t *dst) {
+	const uint32_t *spread = getPlanarSpreadTable();
+	for (int i = 0; i < VID_PAGE_SIZE / 4; ++i) {
+		const uint32_t pixels = (spread[src[8000 * 3]] << 3) | (spread[src[8000 * 2]] << 2) | (spread[src[8000 * 1]] << 1) | spread[src[8000 * 0]];
+		memcpy(dst, &pixels, sizeof(pixels));
+		dst += 4;
+		++src;
 	}
+}
 
+void Video::copyPage(const uint8_t *src, uint16_t num) {
+	debug(DBG_VIDEO, "Video::copyPage()");
+	flush();
+	convertPage(src, _pages[0]);
+	markDirty(_pages[0], 0, 200);
+	if (_hires.enabled()) {
+		_hires.upscalePage(0, _pages[0]);
+	}
+	_screenNum = num;
+	memcpy(_screenRef, _pages[0], VID_PAGE_SIZE);
+}
 
+// A screen already converted by copyPage()
+void Video::copyScreen(const uint8_t *page, uint16_t num) {
+	debug(DBG_VIDEO, "Video::copyScreen()");
+	flush();
+	memcpy(_pages[0], page, VID_PAGE_SIZE);
+	markDirty(_pages[0], 0, 200);
+	if (_hires.enabled()) {
+		_hires.upscalePage(0, _pages[0]);
+	}
+	_screenNum = num;
+	memcpy(_screenRef, page, VID_PAGE_SIZE);
 }
 
 /*
@@ -564,9 +1019,16 @@ void Video::changePal(uint8_t palNum) {
 	currentPaletteId = palNum;
 }
 
-void Video::updateDisplay(uint8_t pageId) {
+/*
+	A frame which is not presented still swaps the pages, changes the palette
+	and is hashed, only the screen is left as it is. The dirty rows of the
+	pages are kept, they still tell where each page differs from the screen.
+*/
+void Video::updateDisplay(uint8_t pageId, bool present) {
+
+	debug(DBG_VIDEO, "Video::updateDisplay(%d, %d)", pageId, present);
 
-	debug(DBG_VIDEO, "Video::updateDisplay(%d)", pageId);
+	flush();
 
 	if (pageId != 0xFE) {
 		if (pageId == 0xFF) {
@@ -576,20 +1038,273 @@ void Video::updateDisplay(uint8_t pageId) {
 		}
 	}
 
+	DirtyRows *d = &_dirtyRows[getPageIndex(_curPagePtr2)];
+
 	//Check if we need to change the palette
 	if (paletteIdRequested != NO_PALETTE_CHANGE_REQUESTED) {
 		changePal(paletteIdRequested);
 		paletteIdRequested = NO_PALETTE_CHANGE_REQUESTED;
+		_fullScreenUpdate = true;
+	}
+
+	if (_frameHasher) {
+		_frameHasher->addFrame(_curPagePtr2, currentPaletteId);
+	}
+
+	if (!present) {
+		return;
 	}
 
 	//Q: Why 160 ?
 	//A: Because one byte gives two palette indices so
 	//   we only need to move 320/2 per line.
-  sys->updateDisplay(_curPagePtr2);
+	int16_t y1 = d->y1;
+	int16_t y2 = d->y2;
+	if (_fullScreenUpdate) {
+		y1 = 0;
+		y2 = 200;
+		_fullScreenUpdate = false;
+	} else {
+		// The pages are often redrawn from a background copy, only keep the rows
+		// which really changed since the previous frame.
+		while (y1 < y2 && memcmp(_curPagePtr2 + y1 * 160, _screenPage + y1 * 160, 160) == 0) {
+			++y1;
+		}
+		while (y2 > y1 && memcmp(_curPagePtr2 + (y2 - 1) * 160, _screenPage + (y2 - 1) * 160, 160) == 0) {
+			--y2;
+		}
+	}
+	if (y1 < y2) {
+		memcpy(_screenPage + y1 * 160, _curPagePtr2 + y1 * 160, (y2 - y1) * 160);
+	}
+	if (_hires.enabled()) {
+		// the high resolution page is converted as a whole
+		sys->updateDisplayHires(_hires._pages[getPageIndex(_curPagePtr2)], _hires._w, _hires._h);
+	} else if (y1 < y2) {
+		sys->updateDisplay(_curPagePtr2, y1, y2 - y1);
+	} else {
+		sys->updateDisplay(_curPagePtr2, 0, 0);
+	}
+
+	// the screen now shows this page, the other pages may differ from it
+	// where it was changed
+	for (int i = 0; i < 4; ++i) {
+		if (&_dirtyRows[i] != d) {
+			markDirty(_pages[i], d->y1, d->y2);
+		}
+	}
+	d->y1 = d->y2 = 0;
+}
+
+// Shows _curPagePtr2 again, once the pages were restored
+void Video::refreshDisplay() {
+	if (_hires.enabled()) {
+		sys->updateDisplayHires(_hires._pages[getPageIndex(_curPagePtr2)], _hires._w, _hires._h);
+	} else {
+		sys->updateDisplay(_curPagePtr2, 0, 200);
+	}
+}
+
+/*
+	Deferred mode: the polygons, points, page fills and plain page copies are
+	queued until the next updateDisplay(), or until an operation which reads
+	or writes the pages across rows. They are then run again for each band of
+	rows, on the RasterPool threads, the bands being independent since all
+	these operations stay within the rows they draw. The dirty rows are
+	tracked when the operations are queued.
+*/
+void Video::setRasterThreads(uint32_t numThreads) {
+	flush();
+	_deferred = (numThreads != 0);
+	_hires._deferred = _deferred;
+	_rasterPool.init(_deferred ? numThreads - 1 : 0);
+	_rasterBands = MIN(_rasterPool.size() * BANDS_PER_THREAD, 200u);
+}
+
+Video::RasterCommand *Video::queueCommand(uint8_t type, const uint8_t *page, int16_t y1, int16_t y2) {
+	y1 = MAX(y1, (int16_t)0);
+	y2 = MIN(y2, (int16_t)200);
+	if (y1 >= y2) {
+		return 0;
+	}
+	_rasterCommands.push_back(RasterCommand());
+	RasterCommand *cmd = &_rasterCommands.back();
+	cmd->type = type;
+	cmd->page = getPageIndex(page);
+	cmd->y1 = y1;
+	cmd->y2 = y2;
+	return cmd;
+}
+
+// The rows of the polygon at the original resolution, rounded outwards
+void Video::queueHiresPolygon(uint32_t index) {
+	const HiresRenderer::Polygon &pg = _hires._polygons[index];
+	const int32_t scale = _hires._scale;
+	const int32_t y1 = MAX(pg.y, 0) / scale;
+	const int32_t y2 = (MIN(pg.y + pg.height, (int32_t)_hires._h) + scale - 1) / scale;
+	RasterCommand *cmd = queueCommand(RasterCommand::CMD_HIRES_POLYGON, _pages[pg.page], MIN(y1, 200), MAX(y2, 0));
+	if (cmd) {
+		cmd->hiresPolygon = index;
+	}
+}
+
+void Video::flush() {
+	if (_rasterCommands.empty()) {
+		_hires.clearPolygons();
+		return;
+	}
+	PROFILE_START(rasterStart);
+	_rasterPool.run(&Video::rasterizeBand, this, _rasterBands);
+	PROFILE_RASTER(_profiler, _rasterCommands.size(), rasterStart);
+	_rasterCommands.clear();
+	_rasterEdges.clear();
+	_hires.clearPolygons();
+}
+
+void Video::rasterizeBand(void *param, uint32_t band) {
+	Video *video = (Video *)param;
+	const uint32_t bands = video->_rasterBands;
+	video->rasterizeRows(band * 200 / bands, (band + 1) * 200 / bands);
+}
+
+// Runs the queued commands, in order, on the rows [y1, y2[ only
+void Video::rasterizeRows(int16_t y1, int16_t y2) {
+	for (size_t i = 0; i < _rasterCommands.size(); ++i) {
+		const RasterCommand *cmd = &_rasterCommands[i];
+		if (cmd->y2 <= y1 || cmd->y1 >= y2) {
+			continue;
+		}
+		uint8_t *page = _pages[cmd->page];
+		switch (cmd->type) {
+		case RasterCommand::CMD_POLYGON:
+			scanPolygon(cmd->cp, _rasterEdges.data() + cmd->cp.firstEdge, cmd->pt, page, y1, y2, false);
+			break;
+		case RasterCommand::CMD_POINT:
+			plotPoint(page, cmd->color, cmd->pt.x, cmd->pt.y);
+			break;
+		case RasterCommand::CMD_FILL_PAGE:
+			memset(page + y1 * 160, cmd->color, (y2 - y1) * 160);
+			if (_hires.enabled()) {
+				_hires.fillRows(cmd->page, cmd->color, y1 * _hires._scale, y2 * _hires._scale);
+			}
+			break;
+		case RasterCommand::CMD_COPY_PAGE:
+			memcpy(page + y1 * 160, _pages[cmd->srcPage] + y1 * 160, (y2 - y1) * 160);
+			if (_hires.enabled()) {
+				_hires.copyRows(cmd->srcPage, cmd->page, y1 * _hires._scale, y2 * _hires._scale);
+			}
+			break;
+		case RasterCommand::CMD_HIRES_POLYGON:
+			_hires.scanPolygon(_hires._polygons[cmd->hiresPolygon], y1 * _hires._scale, y2 * _hires._scale);
+			break;
+		}
+	}
+}
+
+// The four pages are allocated in a single block by init()
+void Video::captureState(State &st) {
+	flush();
+	memcpy(st.pages, _pages[0], sizeof(st.pages));
+	st.curPage1 = getPageIndex(_curPagePtr1);
+	st.curPage2 = getPageIndex(_curPagePtr2);
+	st.curPage3 = getPageIndex(_curPagePtr3);
+	st.paletteIdRequested = paletteIdRequested;
+	st.currentPaletteId = currentPaletteId;
+}
+
+void Video::restoreState(const State &st) {
+	flush();
+	memcpy(_pages[0], st.pages, sizeof(st.pages));
+	_curPagePtr1 = _pages[st.curPage1];
+	_curPagePtr2 = _pages[st.curPage2];
+	_curPagePtr3 = _pages[st.curPage3];
+	paletteIdRequested = st.paletteIdRequested;
+	currentPaletteId = st.currentPaletteId;
+	changePal(currentPaletteId);
+	markAllDirty();
+	upscaleHiresPages();
+}
+
+static uint32_t countDiffWords(const uint8_t *p, const uint8_t *q) {
+	uint32_t count = 0;
+	for (uint32_t k = 0; k < Video::VID_PAGE_SIZE; k += 8) {
+		count += (loadWord<uint64_t>(p + k) != loadWord<uint64_t>(q + k));
+	}
+	return count;
+}
+
+static void xorPage(uint8_t *dst, const uint8_t *p, const uint8_t *q) {
+	for (uint32_t k = 0; k < Video::VID_PAGE_SIZE; k += 8) {
+		storeWord<uint64_t>(dst + k, loadWord<uint64_t>(p + k) ^ loadWord<uint64_t>(q + k));
+	}
+}
+
+/*
+	Each page is stored as the XOR with the reference it differs the least
+	from, or as is when it differs from all of them on more than half of its
+	words. The references are the previous pages and the last bitmap copied
+	to page 0, which the loader reads again from the game data files. The
+	background page is mostly that bitmap and the double buffered pages are
+	mostly copies of the background, so the deltas are mostly zeroes and pack
+	very well.
+
+	refs holds for each page the reference page, the page itself when stored
+	as is, or SCREEN_REF.
+*/
+void Video::encodePageDeltas(uint8_t *deltas, uint8_t *refs) const {
+	for (int i = 0; i < 4; ++i) {
+		refs[i] = i;
+		uint32_t minCount = VID_PAGE_SIZE / 8 / 2;
+		if (_screenNum != NO_SCREEN) {
+			const uint32_t count = countDiffWords(_pages[i], _screenRef);
+			if (count < minCount) {
+				minCount = count;
+				refs[i] = SCREEN_REF;
+			}
+		}
+		for (int j = 0; j < i; ++j) {
+			const uint32_t count = countDiffWords(_pages[i], _pages[j]);
+			if (count < minCount) {
+				minCount = count;
+				refs[i] = j;
+			}
+		}
+		uint8_t *dst = deltas + i * VID_PAGE_SIZE;
+		if (refs[i] == i) {
+			memcpy(dst, _pages[i], VID_PAGE_SIZE);
+		} else {
+			xorPage(dst, _pages[i], (refs[i] == SCREEN_REF) ? _screenRef : _pages[refs[i]]);
+		}
+	}
+}
+
+void Video::decodePageDeltas(const uint8_t *deltas, const uint8_t *refs, uint16_t screenNum) {
+	for (int i = 0; i < 4; ++i) {
+		if (refs[i] == SCREEN_REF && screenNum != _screenNum) {
+			_screenNum = screenNum;
+			if (!res->readScreen(screenNum, _screenRef)) {
+				warning("Video::decodePageDeltas() unable to read screen %d", screenNum);
+				_screenNum = NO_SCREEN;
+				memset(_screenRef, 0, sizeof(_screenRef));
+			}
+		}
+		const uint8_t *src = deltas + i * VID_PAGE_SIZE;
+		if (refs[i] == SCREEN_REF) {
+			xorPage(_pages[i], src, _screenRef);
+		} else if (refs[i] < i) {
+			xorPage(_pages[i], src, _pages[refs[i]]);
+		} else {
+			memcpy(_pages[i], src, VID_PAGE_SIZE);
+		}
+	}
 }
 
 void Video::saveOrLoad(Serializer &ser) {
+	flush();
 	uint8_t mask = 0;
+	uint16_t screenNum = _screenNum;
+	uint8_t refs[4];
+	std::vector<uint8_t> deltas(4 * VID_PAGE_SIZE);
 	if (ser._mode == Serializer::SM_SAVE) {
 		for (int i = 0; i < 4; ++i) {
 			if (_pages[i] == _curPagePtr1)
@@ -599,23 +1314,35 @@ void Video::saveOrLoad(Serializer &ser) {
 			if (_pages[i] == _curPagePtr3)
 				mask |= i << 0;
 		}		
+		encodePageDeltas(deltas.data(), refs);
 	}
 	Serializer::Entry entries[] = {
 		SE_INT(&currentPaletteId, Serializer::SES_INT8, VER(1)),
 		SE_INT(&paletteIdRequested, Serializer::SES_INT8, VER(1)),
 		SE_INT(&mask, Serializer::SES_INT8, VER(1)),
-		SE_ARRAY(_pages[0], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1)),
-		SE_ARRAY(_pages[1], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1)),
-		SE_ARRAY(_pages[2], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1)),
-		SE_ARRAY(_pages[3], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1)),
+		SE_ARRAY_UPTO(_pages[0], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1), VER(2)),
+		SE_ARRAY_UPTO(_pages[1], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1), VER(2)),
+		SE_ARRAY_UPTO(_pages[2], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1), VER(2)),
+		SE_ARRAY_UPTO(_pages[3], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1), VER(2)),
+		SE_INT(&screenNum, Serializer::SES_INT16, VER(3)),
+		SE_ARRAY(refs, 4, Serializer::SES_INT8, VER(3)),
+		SE_ARRAY(&deltas[0], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(3)),
+		SE_ARRAY(&deltas[Video::VID_PAGE_SIZE], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(3)),
+		SE_ARRAY(&deltas[2 * Video::VID_PAGE_SIZE], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(3)),
+		SE_ARRAY(&deltas[3 * Video::VID_PAGE_SIZE], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(3)),
 		SE_END()
 	};
 	ser.saveOrLoadEntries(entries);
 
 	if (ser._mode == Serializer::SM_LOAD) {
+		if (ser._saveVer >= 3) {
+			decodePageDeltas(deltas.data(), refs, screenNum);
+		}
 		_curPagePtr1 = _pages[(mask >> 4) & 0x3];
 		_curPagePtr2 = _pages[(mask >> 2) & 0x3];
 		_curPagePtr3 = _pages[(mask >> 0) & 0x3];
 		changePal(currentPaletteId);
+		markAllDirty();
+		upscaleHiresPages();
 	}
 }
@@ -19,7 +19,12 @@
 #ifndef __VIDEO_H__
 #define __VIDEO_H__
 
+#include <vector>
 #include "intern.h"
+#include "hires.h"
+#include "polycache.h"
+#include "profiler.h"
+#include "raster.h"
 
 struct StrEntry {
 	uint16_t id;
@@ -38,6 +43,7 @@ struct Polygon {
 	void readVertices(const uint8_t *p, uint16_t zoom);
 };
 
+struct FrameHasher;
 struct Resource;
 struct Serializer;
 struct System;
@@ -57,10 +63,31 @@ struct Video {
 		VID_PAGE_SIZE  = 320 * 200 / 2
 	};
 
+	enum {
+		FONT_GLYPHS = 96 // from ' '
+	};
+
+	enum {
+		NO_SCREEN = 0xFFFF,
+		SCREEN_REF = 4 // the page delta is against _screenRef
+	};
+
 	static const uint8_t _font[];
 	static const StrEntry _stringsTableEng[];
 	static const StrEntry _stringsTableDemo[];
 
+	// _stringsTableEng indexed by string id, 0 for the missing ones
+	std::vector<const StrEntry *> _stringIndex;
+
+	// Each glyph row as the masks and the values of its 4 bytes, for one color
+	struct GlyphCache {
+		bool ready;
+		uint8_t color;
+		uint32_t masks[FONT_GLYPHS * 8];
+		uint32_t values[FONT_GLYPHS * 8];
+	};
+	GlyphCache _glyphCaches[16]; // by color & 15
+
 	Resource *res;
 	System *sys;
 	
@@ -75,38 +102,129 @@ struct Video {
 	// _curPagePtr3 is the background buffer2
 	uint8_t *_curPagePtr1, *_curPagePtr2, *_curPagePtr3;
 
+	// Pages and palette, for the rewind snapshots
+	struct State {
+		uint8_t pages[4 * VID_PAGE_SIZE];
+		uint8_t curPage1, curPage2, curPage3;
+		uint8_t paletteIdRequested, currentPaletteId;
+	};
+
 	Polygon polygon;
 	int16_t _hliney;
 
+	// For each page, the rows [y1, y2[ which may differ from the screen
+	struct DirtyRows {
+		int16_t y1, y2;
+	};
+	DirtyRows _dirtyRows[4];
+
+	// Copy of the page on screen, used to narrow down the dirty rows
+	uint8_t _screenPage[VID_PAGE_SIZE];
+	bool _fullScreenUpdate;
+
+	// Last bitmap resource copied to page 0, the reference of the page deltas of the game states
+	uint16_t _screenNum;
+	uint8_t _screenRef[VID_PAGE_SIZE];
+
 	//Precomputer division lookup table
 	uint16_t _interpTable[0x400];
 
 	Ptr _pData;
 	uint8_t *_dataBuf;
 
+	PolygonCache _polygonCache;
+	bool _cachePolygons;
+	bool _flattening;
+	uint8_t _polygonDepth; // nesting of readAndDrawPolygonHierarchy()
+
+	// draws the same operations at a higher resolution, when enabled
+	HiresRenderer _hires;
+
+	// hashes each displayed page, 0 when disabled
+	FrameHasher *_frameHasher;
+
+	// A drawing operation of the deferred mode, see flush()
+	struct RasterCommand {
+		enum {
+			CMD_POLYGON,
+			CMD_POINT,
+			CMD_FILL_PAGE,
+			CMD_COPY_PAGE,
+			CMD_HIRES_POLYGON
+		};
+		uint8_t type;
+		uint8_t page;    // destination page index
+		uint8_t srcPage; // CMD_COPY_PAGE
+		uint8_t color;
+		int16_t y1, y2;  // rows [y1, y2[ which are drawn
+		Point pt;
+		CachedPolygon cp; // CMD_POLYGON, firstEdge indexes _rasterEdges
+		uint32_t hiresPolygon; // CMD_HIRES_POLYGON, indexes _hires._polygons
+	};
+
+	enum {
+		BANDS_PER_THREAD = 2
+	};
+
+	bool _deferred;
+	std::vector<RasterCommand> _rasterCommands;
+	std::vector<PolygonEdge> _rasterEdges;
+	RasterPool _rasterPool;
+	uint32_t _rasterBands;
+
+#ifdef ENABLE_PROFILER
+	Profiler *_profiler;
+#endif
+
 	Video(Resource *res, System *stub);
 	void init();
+	void free();
+	void setRasterThreads(uint32_t numThreads);
+	void setHiresScale(uint8_t scale);
+	void upscaleHiresPages();
 
 	void setDataBuffer(uint8_t *dataBuf, uint16_t offset);
 	void readAndDrawPolygon(uint8_t color, uint16_t zoom, const Point &pt);
 	void fillPolygon(uint16_t color, uint16_t zoom, const Point &pt);
 	void readAndDrawPolygonHierarchy(uint16_t zoom, const Point &pt);
 	int32_t calcStep(const Point &p1, const Point &p2, uint16_t &dy);
+	void calcEdges(CachedPolygon &cp, PolygonEdge *edges);
+	void drawPolygon(const CachedPolygon &cp, const PolygonEdge *edges, const Point &pt);
+	void scanPolygon(const CachedPolygon &cp, const PolygonEdge *edges, const Point &pt, uint8_t *page, int16_t clipY1, int16_t clipY2, bool countSpans) const;
+	void drawShape(const PolygonCache::Shape &shape, const Point &pt);
 
 	void drawString(uint8_t color, uint16_t x, uint16_t y, uint16_t strId);
 	void drawChar(uint8_t c, uint16_t x, uint16_t y, uint8_t color, uint8_t *buf);
+	const GlyphCache *getGlyphCache(uint8_t color);
 	void drawPoint(uint8_t color, int16_t x, int16_t y);
+	void plotPoint(uint8_t *page, uint8_t color, int16_t x, int16_t y) const;
 	void drawLineBlend(int16_t x1, int16_t x2, uint8_t color);
 	void drawLineN(int16_t x1, int16_t x2, uint8_t color);
 	void drawLineP(int16_t x1, int16_t x2, uint8_t color);
+	int getPageIndex(const uint8_t *page) const;
+	void markDirty(const uint8_t *page, int y1, int y2);
+	void markAllDirty();
 	uint8_t *getPage(uint8_t page);
 	void changePagePtr1(uint8_t page);
 	void fillPage(uint8_t page, uint8_t color);
 	void copyPage(uint8_t src, uint8_t dst, int16_t vscroll);
-	void copyPage(const uint8_t *src);
+	static void convertPage(const uint8_t *src, uint8_t *dst);
+	void copyPage(const uint8_t *src, uint16_t num);
+	void copyScreen(const uint8_t *page, uint16_t num);
 	void changePal(uint8_t pal);
-	void updateDisplay(uint8_t page);
-	
+	void updateDisplay(uint8_t page, bool present);
+	void refreshDisplay();
+
+	RasterCommand *queueCommand(uint8_t type, const uint8_t *page, int16_t y1, int16_t y2);
+	void queueHiresPolygon(uint32_t index);
+	void flush();
+	static void rasterizeBand(void *param, uint32_t band);
+	void rasterizeRows(int16_t y1, int16_t y2);
+
+	void captureState(State &st);
+	void restoreState(const State &st);
+	void encodePageDeltas(uint8_t *deltas, uint8_t *refs) const;
+	void decodePageDeltas(const uint8_t *deltas, const uint8_t *refs, uint16_t screenNum);
 	void saveOrLoad(Serializer &ser);
 };
 
@@ -16,7 +16,6 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
-#include <ctime>
 #include "vm.h"
 #include "mixer.h"
 #include "resource.h"
@@ -28,14 +27,17 @@
 #include "file.h"
 
 VirtualMachine::VirtualMachine(Mixer *mix, Resource *resParameter, SfxPlayer *ply, Video *vid, System *stub)
-	: mixer(mix), res(resParameter), player(ply), video(vid), sys(stub) {
+	: mixer(mix), res(resParameter), player(ply), video(vid), sys(stub), _scheduler(stub) {
+#ifdef ENABLE_PROFILER
+	_profiler = 0;
+#endif
 }
 
-void VirtualMachine::init() {
+void VirtualMachine::init(uint16_t randomSeed) {
 
 	memset(vmVariables, 0, sizeof(vmVariables));
 	vmVariables[0x54] = 0x81;
-	vmVariables[VM_VARIABLE_RANDOM_SEED] = time(0);
+	vmVariables[VM_VARIABLE_RANDOM_SEED] = randomSeed;
 #ifdef BYPASS_PROTECTION
    // these 3 variables are set by the game code
    vmVariables[0xBC] = 0x10;
@@ -270,29 +272,31 @@ void VirtualMachine::op_copyVideoPage() {
 }
 
 
-uint32_t lastTimeStamp = 0;
 void VirtualMachine::op_blitFramebuffer() {
 
 	uint8_t pageId = _scriptPtr.fetchByte();
 	debug(DBG_VM, "VirtualMachine::op_blitFramebuffer(%d)", pageId);
 	inp_handleSpecialKeys();
 
-  int32_t delay = sys->getTimeStamp() - lastTimeStamp;
-  int32_t timeToSleep = vmVariables[VM_VARIABLE_PAUSE_SLICES] * 20 - delay;
+	// the deferred drawing of the frame is done before the frame pacing
+	video->flush();
 
   // The bytecode will set vmVariables[VM_VARIABLE_PAUSE_SLICES] from 1 to 5
   // The virtual machine hence indicate how long the image should be displayed.
 
-  if (timeToSleep > 0) {
-    sys->sleep(timeToSleep);
-  }
-
-  lastTimeStamp = sys->getTimeStamp();
+	PROFILE_START(sleepStart);
+	const bool present = _scheduler.waitFrame(vmVariables[VM_VARIABLE_PAUSE_SLICES] * 20);
+	PROFILE_SLEEP(_profiler, sleepStart);
+	if (_scheduler._frameInterval != FrameScheduler::NO_INTERVAL) {
+		PROFILE_PACING(_profiler, _scheduler._frameInterval, !present);
+	}
 
 	//WTF ?
 	vmVariables[0xF7] = 0;
 
-	video->updateDisplay(pageId);
+	PROFILE_START(displayStart);
+	video->updateDisplay(pageId, present);
+	PROFILE_DISPLAY(_profiler, displayStart);
 }
 
 void VirtualMachine::op_killThread() {
@@ -380,6 +384,8 @@ void VirtualMachine::op_playMusic() {
 
 void VirtualMachine::initForPart(uint16_t partId) {
 
+	PROFILE_PART(_profiler, partId);
+
 	player->stop();
 	mixer->stopAll();
 
@@ -458,7 +464,13 @@ void VirtualMachine::hostFrame() {
 
 			gotoNextThread = false;
 			debug(DBG_VM, "VirtualMachine::hostFrame() i=0x%02X n=0x%02X *p=0x%02X", threadId, n, *_scriptPtr.pc);
-			executeThread();
+			PROFILE_START(threadStart);
+			if (!res->_program.empty()) {
+				executeProgram();
+			} else {
+				executeThread();
+			}
+			PROFILE_THREAD(_profiler, threadId, threadStart);
 
 			//Since .pc is going to be modified by this next loop iteration, we need to save it.
 			threadsData[PC_OFFSET][threadId] = _scriptPtr.pc - res->segBytecode;
@@ -481,6 +493,7 @@ void VirtualMachine::executeThread() {
 
 	while (!gotoNextThread) {
 		uint8_t opcode = _scriptPtr.fetchByte();
+		PROFILE_OPCODE(_profiler, opcode);
 
 		// 1000 0000 is set
 		if (opcode & 0x80) 
@@ -583,6 +596,223 @@ void VirtualMachine::executeThread() {
 	}
 }
 
+/*
+	Same as executeThread(), on the instructions pre-decoded by Program. The
+	handlers are chained with computed gotos when the compiler supports them.
+	The thread falls back to the bytecode interpreter whenever its program
+	counter leaves the decoded instructions.
+*/
+void VirtualMachine::executeProgram() {
+
+	const Instruction *code = &res->_program._code[0];
+	uint8_t *seg = res->segBytecode;
+
+	uint16_t index = res->_program.lookup(_scriptPtr.pc - seg);
+	if (index == Program::NO_INDEX) {
+		executeThread();
+		return;
+	}
+	const Instruction *ip = code + index;
+
+#define VM_JUMP_TO(i) \
+	do { \
+		if ((i)->target == Program::NO_INDEX) { \
+			_scriptPtr.pc = seg + (i)->addr; \
+			executeThread(); \
+			return; \
+		} \
+		ip = code + (i)->target; \
+		VM_DISPATCH(); \
+	} while (0)
+
+#define VM_NEXT() \
+	do { \
+		++ip; \
+		VM_DISPATCH(); \
+	} while (0)
+
+#if defined(__GNUC__)
+	static const void *const handlers[Program::NUM_HANDLERS] = {
+		&&h_OP_MOV_CONST, &&h_OP_MOV, &&h_OP_ADD, &&h_OP_ADD_CONST,
+		&&h_OP_CALL, &&h_OP_RET, &&h_OP_BREAK, &&h_OP_JMP,
+		&&h_OP_SET_VEC, &&h_OP_JNZ,
+		&&h_OP_JZ_VAR, &&h_OP_JNZ_VAR, &&h_OP_JG_VAR, &&h_OP_JGE_VAR, &&h_OP_JL_VAR, &&h_OP_JLE_VAR,
+		&&h_OP_JZ_IMM, &&h_OP_JNZ_IMM, &&h_OP_JG_IMM, &&h_OP_JGE_IMM, &&h_OP_JL_IMM, &&h_OP_JLE_IMM,
+		&&h_OP_KILL, &&h_OP_SUB, &&h_OP_AND, &&h_OP_OR, &&h_OP_SHL, &&h_OP_SHR,
+		&&h_OP_POLY_CINEMATIC, &&h_OP_POLY_SPRITE,
+		&&h_OP_LEGACY, &&h_OP_LINK, &&h_OP_END
+	};
+#define VM_DISPATCH() goto *handlers[ip->handler]
+#define VM_LABEL(h) h_##h:
+	VM_DISPATCH();
+	{
+#else
+#define VM_DISPATCH() continue
+#define VM_LABEL(h) case Program::h:
+	while (1) {
+		switch (ip->handler) {
+#endif
+
+#define VM_HANDLER(h) VM_LABEL(h) PROFILE_OPCODE(_profiler, ip->opcode);
+
+#define VM_COND_JUMP(h, expr) \
+	VM_HANDLER(h) { \
+		const int16_t b = vmVariables[ip->a]; \
+		const int16_t a = (Program::h >= Program::OP_JZ_IMM) ? ip->x : vmVariables[(uint8_t)ip->x]; \
+		if (expr) { \
+			VM_JUMP_TO(ip); \
+		} \
+		VM_NEXT(); \
+	}
+
+	VM_HANDLER(OP_MOV_CONST)
+		vmVariables[ip->a] = ip->x;
+		VM_NEXT();
+
+	VM_HANDLER(OP_MOV)
+		vmVariables[ip->a] = vmVariables[ip->b];
+		VM_NEXT();
+
+	VM_HANDLER(OP_ADD)
+		vmVariables[ip->a] += vmVariables[ip->b];
+		VM_NEXT();
+
+	VM_HANDLER(OP_ADD_CONST)
+		vmVariables[ip->a] += ip->x;
+		VM_NEXT();
+
+	VM_HANDLER(OP_SUB)
+		vmVariables[ip->a] -= vmVariables[ip->b];
+		VM_NEXT();
+
+	VM_HANDLER(OP_AND)
+		vmVariables[ip->a] = (uint16_t)vmVariables[ip->a] & (uint16_t)ip->x;
+		VM_NEXT();
+
+	VM_HANDLER(OP_OR)
+		vmVariables[ip->a] = (uint16_t)vmVariables[ip->a] | (uint16_t)ip->x;
+		VM_NEXT();
+
+	VM_HANDLER(OP_SHL)
+		vmVariables[ip->a] = (uint16_t)vmVariables[ip->a] << (uint16_t)ip->x;
+		VM_NEXT();
+
+	VM_HANDLER(OP_SHR)
+		vmVariables[ip->a] = (uint16_t)vmVariables[ip->a] >> (uint16_t)ip->x;
+		VM_NEXT();
+
+	VM_HANDLER(OP_CALL)
+		if (_stackPtr == 0xFF) {
+			error("VirtualMachine::op_call() ec=0x%X stack overflow", 0x8F);
+		}
+		_scriptStackCalls[_stackPtr] = ip[1].pc;
+		++_stackPtr;
+		VM_JUMP_TO(ip);
+
+	VM_HANDLER(OP_RET)
+		if (_stackPtr == 0) {
+			error("VirtualMachine::op_ret() ec=0x%X stack underflow", 0x8F);
+		}
+		--_stackPtr;
+		index = res->_program.lookup(_scriptStackCalls[_stackPtr]);
+		if (index == Program::NO_INDEX) {
+			_scriptPtr.pc = seg + _scriptStackCalls[_stackPtr];
+			executeThread();
+			return;
+		}
+		ip = code + index;
+		VM_DISPATCH();
+
+	VM_HANDLER(OP_BREAK)
+		gotoNextThread = true;
+		_scriptPtr.pc = seg + ip[1].pc;
+		return;
+
+	VM_HANDLER(OP_JMP)
+		VM_JUMP_TO(ip);
+
+	VM_HANDLER(OP_SET_VEC)
+		threadsData[REQUESTED_PC_OFFSET][ip->a] = ip->addr;
+		VM_NEXT();
+
+	VM_HANDLER(OP_JNZ)
+		--vmVariables[ip->a];
+		if (vmVariables[ip->a] != 0) {
+			VM_JUMP_TO(ip);
+		}
+		VM_NEXT();
+
+	VM_COND_JUMP(OP_JZ_VAR, b == a)
+	VM_COND_JUMP(OP_JNZ_VAR, b != a)
+	VM_COND_JUMP(OP_JG_VAR, b > a)
+	VM_COND_JUMP(OP_JGE_VAR, b >= a)
+	VM_COND_JUMP(OP_JL_VAR, b < a)
+	VM_COND_JUMP(OP_JLE_VAR, b <= a)
+	VM_COND_JUMP(OP_JZ_IMM, b == a)
+	VM_COND_JUMP(OP_JNZ_IMM, b != a)
+	VM_COND_JUMP(OP_JG_IMM, b > a)
+	VM_COND_JUMP(OP_JGE_IMM, b >= a)
+	VM_COND_JUMP(OP_JL_IMM, b < a)
+	VM_COND_JUMP(OP_JLE_IMM, b <= a)
+
+	VM_HANDLER(OP_KILL)
+		_scriptPtr.pc = seg + 0xFFFF;
+		gotoNextThread = true;
+		return;
+
+	VM_HANDLER(OP_POLY_CINEMATIC)
+		res->_useSegVideo2 = false;
+		video->setDataBuffer(res->segCinematic, ip->addr);
+		video->readAndDrawPolygon(COLOR_BLACK, DEFAULT_ZOOM, Point(ip->x, ip->y));
+		VM_NEXT();
+
+	VM_HANDLER(OP_POLY_SPRITE) {
+			const int16_t x = (ip->c & Program::POLY_X_VAR) ? vmVariables[(uint8_t)ip->x] : ip->x;
+			const int16_t y = (ip->c & Program::POLY_Y_VAR) ? vmVariables[(uint8_t)ip->y] : ip->y;
+			const uint16_t zoom = (ip->c & Program::POLY_ZOOM_VAR) ? (uint16_t)vmVariables[ip->b] : ip->b;
+			res->_useSegVideo2 = (ip->c & Program::POLY_VIDEO2) != 0;
+			video->setDataBuffer(res->_useSegVideo2 ? res->_segVideo2 : res->segCinematic, ip->addr);
+			video->readAndDrawPolygon(0xFF, zoom, Point(x, y));
+		}
+		VM_NEXT();
+
+	VM_HANDLER(OP_LEGACY)
+		_scriptPtr.pc = seg + ip->pc + 1;
+		(this->*opcodeTable[ip->opcode])();
+		if (gotoNextThread) {
+			return;
+		}
+		index = res->_program.lookup(_scriptPtr.pc - seg);
+		if (index == Program::NO_INDEX) {
+			executeThread();
+			return;
+		}
+		ip = code + index;
+		VM_DISPATCH();
+
+	VM_LABEL(OP_LINK)
+		VM_JUMP_TO(ip);
+
+	VM_LABEL(OP_END)
+		_scriptPtr.pc = seg + ip->pc;
+		executeThread();
+		return;
+
+#if !defined(__GNUC__)
+		default:
+			break;
+		}
+#endif
+	}
+
+#undef VM_COND_JUMP
+#undef VM_HANDLER
+#undef VM_LABEL
+#undef VM_DISPATCH
+#undef VM_NEXT
+#undef VM_JUMP_TO
+}
+
 void VirtualMachine::inp_updatePlayer() {
 
 	sys->processEvents();
@@ -647,6 +877,7 @@ void VirtualMachine::inp_handleSpecialKeys() {
 				sys->processEvents();
 				sys->sleep(200);
 			}
+			_scheduler.reset();
 		}
 		sys->input.pause = false;
 	}
@@ -706,6 +937,21 @@ void VirtualMachine::snd_playMusic(uint16_t resNum, uint16_t delay, uint8_t pos)
 	}
 }
 
+void VirtualMachine::captureState(State &st) const {
+	memcpy(st.vmVariables, vmVariables, sizeof(vmVariables));
+	memcpy(st.scriptStackCalls, _scriptStackCalls, sizeof(_scriptStackCalls));
+	memcpy(st.threadsData, threadsData, sizeof(threadsData));
+	memcpy(st.vmIsChannelActive, vmIsChannelActive, sizeof(vmIsChannelActive));
+}
+
+void VirtualMachine::restoreState(const State &st) {
+	memcpy(vmVariables, st.vmVariables, sizeof(vmVariables));
+	memcpy(_scriptStackCalls, st.scriptStackCalls, sizeof(_scriptStackCalls));
+	memcpy(threadsData, st.threadsData, sizeof(threadsData));
+	memcpy(vmIsChannelActive, st.vmIsChannelActive, sizeof(vmIsChannelActive));
+	_scheduler.reset();
+}
+
 void VirtualMachine::saveOrLoad(Serializer &ser) {
 	Serializer::Entry entries[] = {
 		SE_ARRAY(vmVariables, 0x100, Serializer::SES_INT16, VER(1)),
@@ -715,4 +961,8 @@ void VirtualMachine::saveOrLoad(Serializer &ser) {
 		SE_END()
 	};
 	ser.saveOrLoadEntries(entries);
+	// reading the file took some time, do not catch it up
+	if (ser._mode == Serializer::SM_LOAD) {
+		_scheduler.reset();
+	}
 }
@@ -20,6 +20,8 @@
 #define __LOGIC_H__
 
 #include "intern.h"
+#include "profiler.h"
+#include "scheduler.h"
 
 #define VM_NUM_THREADS 64
 #define VM_NUM_VARIABLES 256
@@ -87,12 +89,26 @@ struct VirtualMachine {
 	//     1 When a setVec is requested for the next vm frame.
 	uint8_t vmIsChannelActive[NUM_THREAD_FIELDS][VM_NUM_THREADS];
 
+	// Copy of the arrays above, for the rewind snapshots
+	struct State {
+		int16_t vmVariables[VM_NUM_VARIABLES];
+		uint16_t scriptStackCalls[VM_NUM_THREADS];
+		uint16_t threadsData[NUM_DATA_FIELDS][VM_NUM_THREADS];
+		uint8_t vmIsChannelActive[NUM_THREAD_FIELDS][VM_NUM_THREADS];
+	};
+
 	Ptr _scriptPtr;
 	uint8_t _stackPtr;
 	bool gotoNextThread;
 
+	// paces op_blitFramebuffer(), and tells which frames are not presented
+	FrameScheduler _scheduler;
+#ifdef ENABLE_PROFILER
+	Profiler *_profiler;
+#endif
+
 	VirtualMachine(Mixer *mix, Resource *res, SfxPlayer *ply, Video *vid, System *stub);
-	void init();
+	void init(uint16_t randomSeed);
 	
 	void op_movConst();
 	void op_mov();
@@ -126,6 +142,7 @@ struct VirtualMachine {
 	void checkThreadRequests();
 	void hostFrame();
 	void executeThread();
+	void executeProgram();
 
 	void inp_updatePlayer();
 	void inp_handleSpecialKeys();
@@ -133,6 +150,8 @@ struct VirtualMachine {
 	void snd_playSound(uint16_t resNum, uint8_t freq, uint8_t vol, uint8_t channel);
 	void snd_playMusic(uint16_t resNum, uint16_t delay, uint8_t pos);
 	
+	void captureState(State &st) const;
+	void restoreState(const State &st);
 	void saveOrLoad(Serializer &ser);
 };
 
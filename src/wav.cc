@@ -0,0 +1,114 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include "wav.h"
+
+WavRecorder::WavRecorder(System *sys)
+	: SystemProxy(sys), _audioCallback(0), _audioParam(0), _sampleBits(8), _dataSize(0) {
+	memset(&input, 0, sizeof(input));
+}
+
+WavRecorder::~WavRecorder() {
+	close();
+}
+
+bool WavRecorder::open(const char *fileName, const char *dir) {
+	if (!_f.open(fileName, dir, "wb")) {
+		warning("Unable to create wav file '%s'", fileName);
+		return false;
+	}
+	_dataSize = 0;
+	return true;
+}
+
+void WavRecorder::close() {
+	stopAudio();
+	_f.close();
+}
+
+void WavRecorder::writeHeader(uint32_t sampleRate) {
+	const uint16_t bytesPerSample = _sampleBits / 8;
+	_f.seek(0);
+	_f.write((void *)"RIFF", 4);
+	_f.writeUint32LE(HEADER_SIZE - 8 + _dataSize);
+	_f.write((void *)"WAVE", 4);
+	_f.write((void *)"fmt ", 4);
+	_f.writeUint32LE(16);
+	_f.writeUint16LE(1); // PCM
+	_f.writeUint16LE(1); // mono
+	_f.writeUint32LE(sampleRate);
+	_f.writeUint32LE(sampleRate * bytesPerSample);
+	_f.writeUint16LE(bytesPerSample);
+	_f.writeUint16LE(_sampleBits);
+	_f.write((void *)"data", 4);
+	_f.writeUint32LE(_dataSize);
+	_f.seek(HEADER_SIZE + _dataSize);
+}
+
+void WavRecorder::destroy() {
+	close();
+	debug(DBG_INFO, "WavRecorder::destroy() %d bytes recorded", _dataSize);
+	SystemProxy::destroy();
+}
+
+void WavRecorder::processEvents() {
+	// same as ReplayRecorder, the wrapped system sees the input changes
+	_sys->input = input;
+	_sys->processEvents();
+	input = _sys->input;
+}
+
+void WavRecorder::startAudio(AudioCallback callback, void *param, uint32_t sampleRate, uint8_t sampleBits) {
+	_audioCallback = callback;
+	_audioParam = param;
+	_sampleBits = sampleBits;
+	_dataSize = 0;
+	writeHeader(sampleRate);
+	_sys->startAudio(WavRecorder::audioCallback, this, sampleRate, sampleBits);
+}
+
+void WavRecorder::stopAudio() {
+	if (_audioCallback == 0) {
+		return;
+	}
+	_sys->stopAudio();
+	writeHeader(_sys->getOutputSampleRate());
+	if (_f.ioErr()) {
+		warning("I/O error when writing wav file");
+	}
+	_audioCallback = 0;
+	_audioParam = 0;
+}
+
+void WavRecorder::audioCallback(void *param, uint8_t *stream, int len) {
+	WavRecorder *wr = (WavRecorder *)param;
+	wr->_audioCallback(wr->_audioParam, stream, len);
+#if defined(SYS_BIG_ENDIAN)
+	if (wr->_sampleBits == 16) {
+		for (int i = 0; i < len; i += 2) {
+			wr->_f.writeByte(stream[i + 1]);
+			wr->_f.writeByte(stream[i]);
+		}
+		wr->_dataSize += len;
+		return;
+	}
+#endif
+	wr->_f.write(stream, len);
+	wr->_dataSize += len;
+}
@@ -0,0 +1,62 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef __WAV_H__
+#define __WAV_H__
+
+#include "intern.h"
+#include "file.h"
+#include "replay.h"
+
+/*
+	A System writing the samples of the audio callback to a WAV file, on top of
+	the headless one. The mixer (and the music sequencer when it is run from the
+	mixer) is hence pulled on the virtual clock, and a turbo run renders the
+	soundtrack of a session as fast as the CPU allows.
+
+	The header is written when the audio starts, the chunk sizes are patched
+	when it stops.
+*/
+struct WavRecorder : SystemProxy {
+	enum {
+		HEADER_SIZE = 44
+	};
+
+	File _f;
+	AudioCallback _audioCallback;
+	void *_audioParam;
+	uint8_t _sampleBits;
+	uint32_t _dataSize;
+
+	WavRecorder(System *sys);
+	virtual ~WavRecorder();
+
+	bool open(const char *fileName, const char *dir);
+	void close();
+	void writeHeader(uint32_t sampleRate);
+
+	virtual void destroy();
+	virtual void processEvents();
+	virtual void startAudio(AudioCallback callback, void *param, uint32_t sampleRate, uint8_t sampleBits);
+	virtual void stopAudio();
+
+	static void audioCallback(void *param, uint8_t *stream, int len);
+};
+
+#endif